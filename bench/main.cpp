@@ -0,0 +1,292 @@
+/*
+	Copyright(C) 2014 EQEmu
+
+	This program is free software; you can redistribute it and/or
+	modify it under the terms of the GNU General Public License
+	as published by the Free Software Foundation; either version 2
+	of the License, or (at your option) any later version.
+
+	This program is distributed in the hope that it will be useful,
+	but WITHOUT ANY WARRANTY; without even the implied warranty of
+	MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+	GNU General Public License for more details.
+
+	You should have received a copy of the GNU General Public License
+	along with this program; if not, write to the Free Software
+	Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+*/
+
+/*
+	dbi-bench [--quick] [--sqlite=path]
+
+	Times the common paths of every backend it can reach and prints one JSON
+	document to stdout.  SQLite always runs, MySQL and PostgreSQL run when
+	DBI_BENCH_MYSQL / DBI_BENCH_PG hold "dbname,host,user,password".
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <string>
+#include <vector>
+#include <tuple>
+#include <memory>
+#include <chrono>
+#include <functional>
+#include "../dbi/dbh-sqlite.h"
+#ifdef MYSQL_ENGINE
+#include "../dbi/dbh-mysql.h"
+#endif
+#ifdef POSTGRESQL_ENGINE
+#include "../dbi/dbh-pg.h"
+#endif
+
+namespace
+{
+	struct BenchResult
+	{
+		std::string backend;
+		std::string name;
+		uint64_t operations;
+		double seconds;
+		//ResultSet::MemoryUsage() for fetch benchmarks, 0 otherwise
+		size_t result_bytes;
+	};
+
+	class Bench
+	{
+	public:
+		Bench(std::string backend_, double target_seconds_, std::vector<BenchResult> &results_)
+			: m_backend(backend_), m_target_seconds(target_seconds_), m_results(results_) { }
+
+		//Calls fn until it has run for the target time, ops is how many operations one call does.
+		void Measure(const std::string &name, uint64_t ops, std::function<void()> fn, size_t result_bytes = 0) {
+			typedef std::chrono::steady_clock Clock;
+
+			fn();
+			uint64_t calls = 1;
+			double elapsed = 0.0;
+			for (;;) {
+				auto start = Clock::now();
+				for (uint64_t i = 0; i < calls; ++i) {
+					fn();
+				}
+				elapsed = std::chrono::duration<double>(Clock::now() - start).count();
+
+				if (elapsed >= m_target_seconds || calls >= (1u << 24)) {
+					break;
+				}
+				calls *= elapsed < m_target_seconds / 10.0 ? 10 : 2;
+			}
+
+			BenchResult result;
+			result.backend = m_backend;
+			result.name = name;
+			result.operations = calls * ops;
+			result.seconds = elapsed;
+			result.result_bytes = result_bytes;
+			m_results.push_back(result);
+
+			fprintf(stderr, "%-10s %-32s %12.1f ns/op\n", m_backend.c_str(), name.c_str(), elapsed * 1e9 / (double)result.operations);
+		}
+
+	private:
+		std::string m_backend;
+		double m_target_seconds;
+		std::vector<BenchResult> &m_results;
+	};
+
+	const int TableRows = 10000;
+
+	void CreateTable(DBI::DatabaseHandle &dbh) {
+		dbh.Do("DROP TABLE IF EXISTS dbi_bench");
+		dbh.Do("CREATE TABLE dbi_bench (id INTEGER PRIMARY KEY, int_value INTEGER, real_value DOUBLE PRECISION, text_value VARCHAR(64))");
+
+		std::vector<std::tuple<int, int, double, std::string>> rows;
+		for (int i = 1; i <= TableRows; ++i) {
+			rows.push_back(std::make_tuple(i, i * 7, i * 0.5, std::string("row text value ") + std::to_string(i)));
+		}
+
+		auto sth = dbh.Prepare("INSERT INTO dbi_bench (id, int_value, real_value, text_value) VALUES(?, ?, ?, ?)");
+		sth->ExecuteBatch(rows);
+	}
+
+	void RunExecute(Bench &bench, DBI::DatabaseHandle &dbh) {
+		int id = 0;
+		bench.Measure("do_select", 1, [&dbh, &id]() {
+			dbh.Do("SELECT int_value FROM dbi_bench WHERE id = ?", (id++ % TableRows) + 1);
+		});
+
+		auto sth = dbh.Prepare("SELECT int_value FROM dbi_bench WHERE id = ?");
+		bench.Measure("prepared_select", 1, [&sth, &id]() {
+			sth->Execute((id++ % TableRows) + 1);
+		});
+
+		bench.Measure("prepare_and_select", 1, [&dbh, &id]() {
+			auto once = dbh.Prepare("SELECT int_value FROM dbi_bench WHERE id = ?");
+			once->Execute((id++ % TableRows) + 1);
+		});
+	}
+
+	void RunBind(Bench &bench, DBI::DatabaseHandle &dbh) {
+		//a round trip with one param, compared against each other the difference is the bind
+		auto sth = dbh.Prepare("SELECT ?");
+		std::string short_text(16, 'x');
+		std::string long_text(1024, 'x');
+
+		bench.Measure("bind/int32", 1, [&sth]() { sth->Execute((int32_t)12345); });
+		bench.Measure("bind/int64", 1, [&sth]() { sth->Execute((int64_t)1234567890123LL); });
+		bench.Measure("bind/double", 1, [&sth]() { sth->Execute(1234.5678); });
+		bench.Measure("bind/string16", 1, [&sth, &short_text]() { sth->Execute(short_text); });
+		bench.Measure("bind/string1024", 1, [&sth, &long_text]() { sth->Execute(long_text); });
+		bench.Measure("bind/null", 1, [&sth]() { sth->Execute(nullptr); });
+	}
+
+	void RunFetch(Bench &bench, DBI::DatabaseHandle &dbh) {
+		static const int row_counts[] = { 1, 100, TableRows };
+		static const char *widths[][2] = {
+			{ "narrow", "SELECT id FROM dbi_bench WHERE id <= ?" },
+			{ "wide", "SELECT id, int_value, real_value, text_value FROM dbi_bench WHERE id <= ?" },
+		};
+
+		for (auto &width : widths) {
+			auto sth = dbh.Prepare(width[1]);
+			for (int rows : row_counts) {
+				size_t bytes = sth->Execute(rows)->MemoryUsage();
+				std::string name = std::string("fetch/") + width[0] + "/" + std::to_string(rows);
+				bench.Measure(name, (uint64_t)rows, [&sth, rows]() { sth->Execute(rows); }, bytes);
+
+				bench.Measure(name + "/cursor", (uint64_t)rows, [&sth, rows]() {
+					auto cursor = sth->Query(rows);
+					while (cursor->Next()) {
+					}
+				});
+			}
+		}
+	}
+
+	void RunTransactions(Bench &bench, DBI::DatabaseHandle &dbh) {
+		static const int batch_sizes[] = { 1, 10, 100, 1000 };
+
+		auto sth = dbh.Prepare("UPDATE dbi_bench SET int_value = ? WHERE id = ?");
+		int id = 0;
+		for (int batch : batch_sizes) {
+			bench.Measure("txn_batch/" + std::to_string(batch), (uint64_t)batch, [&dbh, &sth, &id, batch]() {
+				dbh.Begin();
+				for (int i = 0; i < batch; ++i) {
+					int row = (id++ % TableRows) + 1;
+					sth->Execute(row * 3, row);
+				}
+				dbh.Commit();
+			});
+
+			std::vector<std::tuple<int, int>> rows;
+			for (int i = 0; i < batch; ++i) {
+				rows.push_back(std::make_tuple(i, i + 1));
+			}
+			bench.Measure("execute_batch/" + std::to_string(batch), (uint64_t)batch, [&sth, &rows]() {
+				sth->ExecuteBatch(rows);
+			});
+		}
+	}
+
+	void RunBackend(const std::string &backend, DBI::DatabaseHandle &dbh, double target_seconds, std::vector<BenchResult> &results) {
+		Bench bench(backend, target_seconds, results);
+		CreateTable(dbh);
+		RunExecute(bench, dbh);
+		RunBind(bench, dbh);
+		RunFetch(bench, dbh);
+		RunTransactions(bench, dbh);
+		dbh.Do("DROP TABLE dbi_bench");
+	}
+
+#if defined(MYSQL_ENGINE) || defined(POSTGRESQL_ENGINE)
+	//"dbname,host,user,password" from the environment, false if unset
+	bool ServerConfig(const char *name, std::vector<std::string> &config) {
+		const char *value = getenv(name);
+		if (!value) {
+			return false;
+		}
+
+		config.clear();
+		std::string remaining = value;
+		size_t comma = 0;
+		while ((comma = remaining.find(',')) != std::string::npos) {
+			config.push_back(remaining.substr(0, comma));
+			remaining = remaining.substr(comma + 1);
+		}
+		config.push_back(remaining);
+		config.resize(4);
+		return true;
+	}
+#endif
+
+	void PrintJson(const std::vector<BenchResult> &results) {
+		printf("{\n\t\"benchmarks\": [\n");
+		for (size_t i = 0; i < results.size(); ++i) {
+			const BenchResult &result = results[i];
+			double ns_per_op = result.seconds * 1e9 / (double)result.operations;
+			printf("\t\t{ \"backend\": \"%s\", \"name\": \"%s\", \"operations\": %llu, \"seconds\": %.6f, \"ns_per_op\": %.1f, "
+				"\"ops_per_sec\": %.1f, \"result_bytes\": %llu }%s\n",
+				result.backend.c_str(), result.name.c_str(), (unsigned long long)result.operations, result.seconds, ns_per_op,
+				(double)result.operations / result.seconds, (unsigned long long)result.result_bytes, i + 1 < results.size() ? "," : "");
+		}
+		printf("\t]\n}\n");
+	}
+}
+
+int main(int argc, char **argv) {
+	double target_seconds = 0.25;
+	std::string sqlite_path = "dbi-bench.db";
+	for (int i = 1; i < argc; ++i) {
+		if (strcmp(argv[i], "--quick") == 0) {
+			target_seconds = 0.02;
+		}
+		else if (strncmp(argv[i], "--sqlite=", 9) == 0) {
+			sqlite_path = argv[i] + 9;
+		}
+		else {
+			fprintf(stderr, "usage: %s [--quick] [--sqlite=path]\n", argv[0]);
+			return 1;
+		}
+	}
+
+	std::vector<BenchResult> results;
+	try {
+		{
+			DBI::DatabaseAttributes attr;
+			DBI::SQLiteDatabaseHandle dbh;
+			remove(sqlite_path.c_str());
+			dbh.Connect(sqlite_path, "", "", "", attr);
+			RunBackend("sqlite", dbh, target_seconds, results);
+		}
+
+#ifdef MYSQL_ENGINE
+		std::vector<std::string> config;
+		if (ServerConfig("DBI_BENCH_MYSQL", config)) {
+			DBI::DatabaseAttributes attr;
+			DBI::MySQLDatabaseHandle dbh;
+			dbh.Connect(config[0], config[1], config[2], config[3], attr);
+			RunBackend("mysql", dbh, target_seconds, results);
+		}
+#endif
+
+#ifdef POSTGRESQL_ENGINE
+		std::vector<std::string> pg_config;
+		if (ServerConfig("DBI_BENCH_PG", pg_config)) {
+			DBI::DatabaseAttributes attr;
+			DBI::PGDatabaseHandle dbh;
+			dbh.Connect(pg_config[0], pg_config[1], pg_config[2], pg_config[3], attr);
+			RunBackend("postgresql", dbh, target_seconds, results);
+		}
+#endif
+	}
+	catch (std::exception &ex) {
+		fprintf(stderr, "Benchmark failed with message: %s\n", ex.what());
+		return 1;
+	}
+
+	PrintJson(results);
+	return 0;
+}
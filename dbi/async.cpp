@@ -0,0 +1,236 @@
+/*
+	Copyright(C) 2014 EQEmu
+
+	This program is free software; you can redistribute it and/or
+	modify it under the terms of the GNU General Public License
+	as published by the Free Software Foundation; either version 2
+	of the License, or (at your option) any later version.
+
+	This program is distributed in the hope that it will be useful,
+	but WITHOUT ANY WARRANTY; without even the implied warranty of
+	MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+	GNU General Public License for more details.
+
+	You should have received a copy of the GNU General Public License
+	along with this program; if not, write to the Free Software
+	Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+*/
+#include "async.h"
+#include "rs.h"
+#include "result-cache.h"
+#include <stdexcept>
+
+#ifdef _WIN32
+#include <winsock2.h>
+#else
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/select.h>
+#endif
+
+bool DBI::AsyncResult::Poll()
+{
+	if (!m_done && Advance()) {
+		if (m_observer) {
+			ReportObserved();
+		}
+		if (m_result_cache && !m_failed) {
+			m_result_cache->Invalidate(m_sql);
+		}
+		Finished();
+	}
+
+	return m_done;
+}
+
+void DBI::AsyncResult::Wait()
+{
+	while (!Poll()) {
+		WaitForProgress();
+	}
+}
+
+std::unique_ptr<DBI::ResultSet> DBI::AsyncResult::Get()
+{
+	Wait();
+	if (m_failed) {
+		throw std::runtime_error(m_error);
+	}
+
+	return std::move(m_result);
+}
+
+void DBI::AsyncResult::OnComplete(Callback callback)
+{
+	m_callback = callback;
+	if (m_done) {
+		Finished();
+	}
+}
+
+void DBI::AsyncResult::Observe(std::shared_ptr<QueryObserver> observer, const std::string &sql, QueryClock::time_point start)
+{
+	m_observer = observer;
+	m_sql = sql;
+	m_start = start;
+}
+
+void DBI::AsyncResult::InvalidateWhenDone(std::shared_ptr<ResultCache> cache, const std::string &sql)
+{
+	m_result_cache = cache;
+	m_sql = sql;
+}
+
+void DBI::AsyncResult::ReportObserved()
+{
+	if (!m_failed) {
+		ReportQuery(*m_observer, QueryEvent::PhaseExecute, m_sql, m_start, m_result.get());
+		return;
+	}
+
+	QueryEvent event(QueryEvent::PhaseExecute, m_sql, m_start);
+	event.nanoseconds = (uint64_t)std::chrono::duration_cast<std::chrono::nanoseconds>(QueryClock::now() - m_start).count();
+	event.error = m_error.c_str();
+	m_observer->OnQuery(event);
+}
+
+void DBI::AsyncResult::Complete(std::unique_ptr<ResultSet> rs)
+{
+	m_result = std::move(rs);
+	m_failed = false;
+}
+
+void DBI::AsyncResult::Fail(const std::string &error)
+{
+	m_result.reset();
+	m_error = error;
+	m_failed = true;
+}
+
+void DBI::AsyncResult::Finished()
+{
+	m_done = true;
+	if (m_callback) {
+		Callback callback;
+		callback.swap(m_callback);
+		callback(std::move(m_result), m_error);
+	}
+}
+
+DBI::ThreadAsyncResult::ThreadAsyncResult(Work work) : m_finished(false), m_work_failed(false)
+{
+	m_pipe[0] = -1;
+	m_pipe[1] = -1;
+#ifndef _WIN32
+	if (pipe(m_pipe) == 0) {
+		fcntl(m_pipe[0], F_SETFL, fcntl(m_pipe[0], F_GETFL) | O_NONBLOCK);
+	}
+	else {
+		m_pipe[0] = -1;
+		m_pipe[1] = -1;
+	}
+#endif
+
+	m_thread = std::thread(&ThreadAsyncResult::Run, this, work);
+}
+
+DBI::ThreadAsyncResult::~ThreadAsyncResult() {
+	if (m_thread.joinable()) {
+		m_thread.join();
+	}
+
+#ifndef _WIN32
+	if (m_pipe[0] != -1) {
+		close(m_pipe[0]);
+		close(m_pipe[1]);
+	}
+#endif
+}
+
+bool DBI::ThreadAsyncResult::Advance()
+{
+	{
+		std::lock_guard<std::mutex> guard(m_lock);
+		if (!m_finished) {
+			return false;
+		}
+	}
+
+	m_thread.join();
+#ifndef _WIN32
+	char c;
+	while (m_pipe[0] != -1 && read(m_pipe[0], &c, 1) == 1) {
+	}
+#endif
+
+	if (m_work_failed) {
+		Fail(m_work_error);
+	}
+	else {
+		Complete(std::move(m_work_result));
+	}
+	return true;
+}
+
+void DBI::ThreadAsyncResult::WaitForProgress()
+{
+	std::unique_lock<std::mutex> guard(m_lock);
+	m_finished_cond.wait(guard, [this]() { return m_finished; });
+}
+
+void DBI::ThreadAsyncResult::Run(Work work)
+{
+	std::unique_ptr<ResultSet> result;
+	std::string error;
+	bool failed = false;
+	try {
+		result = work();
+	}
+	catch (std::exception &ex) {
+		error = ex.what();
+		failed = true;
+	}
+	catch (...) {
+		//anything escaping the thread would terminate the process
+		error = "Async Error: unknown exception";
+		failed = true;
+	}
+
+	{
+		std::lock_guard<std::mutex> guard(m_lock);
+		m_work_result = std::move(result);
+		m_work_error = error;
+		m_work_failed = failed;
+		m_finished = true;
+	}
+	m_finished_cond.notify_all();
+
+#ifndef _WIN32
+	if (m_pipe[1] != -1) {
+		char c = 1;
+		ssize_t written = write(m_pipe[1], &c, 1);
+		(void)written;
+	}
+#endif
+}
+
+void DBI::WaitForSocket(int fd, bool write, int timeout_ms)
+{
+	if (fd < 0) {
+		return;
+	}
+
+	fd_set read_set;
+	fd_set write_set;
+	FD_ZERO(&read_set);
+	FD_ZERO(&write_set);
+	FD_SET(fd, &read_set);
+	if (write) {
+		FD_SET(fd, &write_set);
+	}
+
+	timeval timeout;
+	timeout.tv_sec = timeout_ms / 1000;
+	timeout.tv_usec = (timeout_ms % 1000) * 1000;
+	select(fd + 1, &read_set, write ? &write_set : nullptr, nullptr, timeout_ms < 0 ? nullptr : &timeout);
+}
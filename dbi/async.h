@@ -0,0 +1,124 @@
+#pragma once
+
+#include <cstddef>
+#include <string>
+#include <memory>
+#include <functional>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+
+#include "observer.h"
+
+namespace DBI
+{
+
+	class ResultSet;
+	class StatementHandle;
+	class ResultCache;
+
+	/*
+		A statement executing in the background, returned by ExecuteAsync() and
+		DoAsync().  Socket() can be added to an event loop, Poll() is then called
+		whenever it turns readable (or on a timer when it is -1) and reports true
+		once the statement finished.  Get() blocks like a future would.  The
+		statement and its connection can't be used for anything else until the
+		result is ready, destroying an unfinished result waits for it.
+	*/
+	class AsyncResult
+	{
+	public:
+		//rs is null and error set if the statement failed
+		typedef std::function<void(std::unique_ptr<ResultSet> rs, const std::string &error)> Callback;
+
+		AsyncResult() : m_done(false), m_failed(false) { }
+		virtual ~AsyncResult() { }
+
+		//Descriptor that turns readable when Poll() can make progress, -1 if there is none.
+		virtual int Socket() const = 0;
+
+		//Does what work it can without blocking, returns true once finished.
+		bool Poll();
+
+		//Blocks until finished.
+		void Wait();
+
+		bool Ready() const { return m_done; }
+
+		//Blocks until finished and hands over the result, throws std::runtime_error if the statement
+		//failed.  Returns null if a completion callback already took the result.
+		std::unique_ptr<ResultSet> Get();
+
+		//Called from Poll(), Wait() or Get() on the calling thread once finished, or right away if it
+		//already is.  The callback takes ownership of the result.
+		void OnComplete(Callback callback);
+
+		//Keeps statement alive until this result is destroyed.
+		void KeepAlive(std::shared_ptr<StatementHandle> statement) { m_keep_alive = statement; }
+
+		//Reports the execute phase that began at start to observer once finished.
+		void Observe(std::shared_ptr<QueryObserver> observer, const std::string &sql, QueryClock::time_point start);
+
+		//Has cache drop what sql changed once it finished without error, see ResultCache::Invalidate().
+		void InvalidateWhenDone(std::shared_ptr<ResultCache> cache, const std::string &sql);
+
+		AsyncResult(const AsyncResult&) = delete;
+		AsyncResult &operator=(const AsyncResult&) = delete;
+
+	protected:
+		//Backend specific progress, calls Complete() or Fail() once finished and returns true.
+		virtual bool Advance() = 0;
+		//Blocks until Advance() might be able to make progress.
+		virtual void WaitForProgress() = 0;
+
+		void Complete(std::unique_ptr<ResultSet> rs);
+		void Fail(const std::string &error);
+		void Finished();
+		void ReportObserved();
+
+		bool m_done;
+		bool m_failed;
+		std::string m_error;
+		std::unique_ptr<ResultSet> m_result;
+		Callback m_callback;
+		std::shared_ptr<StatementHandle> m_keep_alive;
+		std::shared_ptr<QueryObserver> m_observer;
+		std::shared_ptr<ResultCache> m_result_cache;
+		std::string m_sql;
+		QueryClock::time_point m_start;
+	};
+
+	/*
+		Runs work on its own thread, used where the client library has no non
+		blocking API.  Socket() is the read end of a pipe the thread writes to when
+		it is done, there is none on Windows.
+	*/
+	class ThreadAsyncResult : public AsyncResult
+	{
+	public:
+		typedef std::function<std::unique_ptr<ResultSet>()> Work;
+
+		ThreadAsyncResult(Work work);
+		virtual ~ThreadAsyncResult();
+
+		virtual int Socket() const { return m_pipe[0]; }
+
+	protected:
+		virtual bool Advance();
+		virtual void WaitForProgress();
+		void Run(Work work);
+
+		std::thread m_thread;
+		std::mutex m_lock;
+		std::condition_variable m_finished_cond;
+		bool m_finished;
+		bool m_work_failed;
+		std::string m_work_error;
+		std::unique_ptr<ResultSet> m_work_result;
+		int m_pipe[2];
+	};
+
+	//Waits up to timeout_ms for fd to turn readable (or writable as well if asked), -1 waits forever.
+	void WaitForSocket(int fd, bool write, int timeout_ms);
+
+}
@@ -0,0 +1,460 @@
+/*
+	Copyright(C) 2014 EQEmu
+
+	This program is free software; you can redistribute it and/or
+	modify it under the terms of the GNU General Public License
+	as published by the Free Software Foundation; either version 2
+	of the License, or (at your option) any later version.
+
+	This program is distributed in the hope that it will be useful,
+	but WITHOUT ANY WARRANTY; without even the implied warranty of
+	MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+	GNU General Public License for more details.
+
+	You should have received a copy of the GNU General Public License
+	along with this program; if not, write to the Free Software
+	Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+*/
+#include "copy-pg.h"
+#include "oid-pg.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <limits>
+#include <stdexcept>
+#include <libpq-fe.h>
+
+//rows are handed to libpq once this much has been encoded
+#define COPY_CHUNK_SIZE 65536
+
+namespace
+{
+	bool IsTextType(unsigned int type) {
+		return type == TEXTOID || type == VARCHAROID || type == BPCHAROID || type == NAMEOID || type == CHAROID;
+	}
+
+	void PutBE(std::vector<char> &buffer, uint64_t v, int bytes) {
+		for (int i = bytes - 1; i >= 0; --i) {
+			buffer.push_back(static_cast<char>((v >> (i * 8)) & 0xFF));
+		}
+	}
+}
+
+DBI::PGCopyWriter::PGCopyWriter(PGconn *conn_, bool binary_, std::vector<unsigned int> types_)
+	: m_handle(conn_), m_binary(binary_), m_active(true), m_types(types_), m_field(0), m_row_start(0)
+{
+	m_buffer.reserve(COPY_CHUNK_SIZE + 1024);
+
+	if (m_binary) {
+		//signature, flags and header extension length
+		static const char signature[] = "PGCOPY\n\377\r\n";
+		m_buffer.insert(m_buffer.end(), signature, signature + sizeof(signature));
+		PutBE(m_buffer, 0, 4);
+		PutBE(m_buffer, 0, 4);
+	}
+}
+
+DBI::PGCopyWriter::~PGCopyWriter() {
+	Abort();
+}
+
+void DBI::PGCopyWriter::Add(bool v)
+{
+	AddInteger(v ? 1 : 0, false);
+}
+
+void DBI::PGCopyWriter::Add(int8_t v)
+{
+	AddInteger(v, false);
+}
+
+void DBI::PGCopyWriter::Add(uint8_t v)
+{
+	AddInteger(v, true);
+}
+
+void DBI::PGCopyWriter::Add(int16_t v)
+{
+	AddInteger(v, false);
+}
+
+void DBI::PGCopyWriter::Add(uint16_t v)
+{
+	AddInteger(v, true);
+}
+
+void DBI::PGCopyWriter::Add(int32_t v)
+{
+	AddInteger(v, false);
+}
+
+void DBI::PGCopyWriter::Add(uint32_t v)
+{
+	AddInteger(v, true);
+}
+
+void DBI::PGCopyWriter::Add(int64_t v)
+{
+	AddInteger(v, false);
+}
+
+void DBI::PGCopyWriter::Add(uint64_t v)
+{
+	if (v <= static_cast<uint64_t>(std::numeric_limits<int64_t>::max())) {
+		AddInteger(static_cast<int64_t>(v), true);
+		return;
+	}
+
+	//too big for int8, only a text column can take it
+	if (m_binary && !IsTextType(FieldType())) {
+		ThrowType("uint64");
+	}
+
+	char val[32];
+	int len = snprintf(val, sizeof(val), "%llu", (unsigned long long)v);
+	AddText(val, (size_t)len);
+}
+
+void DBI::PGCopyWriter::Add(float v)
+{
+	Add(static_cast<double>(v));
+}
+
+void DBI::PGCopyWriter::Add(double v)
+{
+	char val[32];
+	unsigned int type = FieldType();
+	if (m_binary && !IsTextType(type)) {
+		if (type == FLOAT8OID) {
+			uint64_t bits;
+			memcpy(&bits, &v, sizeof(bits));
+			BeginField();
+			PutBinaryLength(8);
+			PutBE(m_buffer, bits, 8);
+			return;
+		}
+
+		if (type == FLOAT4OID) {
+			float f = static_cast<float>(v);
+			uint32_t bits;
+			memcpy(&bits, &f, sizeof(bits));
+			BeginField();
+			PutBinaryLength(4);
+			PutBE(m_buffer, bits, 4);
+			return;
+		}
+
+		ThrowType("double");
+	}
+
+	int len = snprintf(val, sizeof(val), "%.17g", v);
+	AddText(val, (size_t)len);
+}
+
+void DBI::PGCopyWriter::Add(const std::string &v)
+{
+	//same rule as PGStatementHandle::BindString(), embedded nulls mean bytea
+	if (v.length() != strlen(v.c_str())) {
+		AddBytea(v.c_str(), v.length());
+	}
+	else {
+		AddText(v.c_str(), v.length());
+	}
+}
+
+void DBI::PGCopyWriter::Add(const char *v)
+{
+	//a null pointer is NULL, as it is when bound to a statement
+	if (!v) {
+		Add(nullptr);
+		return;
+	}
+
+	AddText(v, strlen(v));
+}
+
+void DBI::PGCopyWriter::Add(std::nullptr_t)
+{
+	FieldType();
+	BeginField();
+	if (m_binary) {
+		PutBinaryLength(-1);
+	}
+	else {
+		m_buffer.push_back('\\');
+		m_buffer.push_back('N');
+	}
+}
+
+void DBI::PGCopyWriter::EndRow()
+{
+	if (!m_active) {
+		throw std::runtime_error("Copy Error: the copy has already ended.");
+	}
+
+	if (m_field == 0) {
+		throw std::runtime_error("Copy Error: can't write an empty row.");
+	}
+
+	if (m_binary) {
+		if (m_field != m_types.size()) {
+			size_t fields = m_field;
+			DropRow();
+			throw std::runtime_error("Copy Error: row has " + std::to_string(fields) + " fields, expected " +
+				std::to_string(m_types.size()) + ".");
+		}
+
+		m_buffer[m_row_start] = static_cast<char>((m_field >> 8) & 0xFF);
+		m_buffer[m_row_start + 1] = static_cast<char>(m_field & 0xFF);
+	}
+	else {
+		m_buffer.push_back('\n');
+	}
+
+	m_field = 0;
+	Flush(false);
+}
+
+size_t DBI::PGCopyWriter::Finish()
+{
+	if (!m_active) {
+		throw std::runtime_error("Copy Error: the copy has already ended.");
+	}
+
+	if (m_field != 0) {
+		throw std::runtime_error("Copy Error: the last row was not ended.");
+	}
+
+	if (m_binary) {
+		PutBE(m_buffer, 0xFFFF, 2);
+	}
+
+	Flush(true);
+	m_active = false;
+	if (PQputCopyEnd(m_handle, nullptr) != 1) {
+		std::string error = "Copy Error: ";
+		error += PQerrorMessage(m_handle);
+		Drain();
+		throw std::runtime_error(error);
+	}
+
+	size_t rows = 0;
+	std::string error;
+	PGresult *res = nullptr;
+	while ((res = PQgetResult(m_handle)) != nullptr) {
+		if (PQresultStatus(res) == PGRES_COMMAND_OK) {
+			rows = (size_t)strtoull(PQcmdTuples(res), nullptr, 10);
+		}
+		else if (error.empty()) {
+			error = PQresultErrorMessage(res);
+		}
+		PQclear(res);
+	}
+
+	if (!error.empty()) {
+		throw std::runtime_error("Copy Error: " + error);
+	}
+
+	return rows;
+}
+
+void DBI::PGCopyWriter::Abort()
+{
+	if (!m_active) {
+		return;
+	}
+
+	m_active = false;
+	m_buffer.clear();
+	m_field = 0;
+	PQputCopyEnd(m_handle, "copy aborted by client");
+	Drain();
+}
+
+void DBI::PGCopyWriter::AddInteger(int64_t v, bool is_unsigned)
+{
+	char val[32];
+	unsigned int type = FieldType();
+	if (m_binary && !IsTextType(type)) {
+		switch (type) {
+		case INT2OID:
+			if (v < std::numeric_limits<int16_t>::min() || v > std::numeric_limits<int16_t>::max()) {
+				ThrowType("integer outside int2 range");
+			}
+			BeginField();
+			PutBinaryLength(2);
+			PutBE(m_buffer, static_cast<uint64_t>(v), 2);
+			return;
+		case INT4OID:
+			if (v < std::numeric_limits<int32_t>::min() || v > std::numeric_limits<int32_t>::max()) {
+				ThrowType("integer outside int4 range");
+			}
+			BeginField();
+			PutBinaryLength(4);
+			PutBE(m_buffer, static_cast<uint64_t>(v), 4);
+			return;
+		case INT8OID:
+			BeginField();
+			PutBinaryLength(8);
+			PutBE(m_buffer, static_cast<uint64_t>(v), 8);
+			return;
+		case BOOLOID:
+			BeginField();
+			PutBinaryLength(1);
+			m_buffer.push_back(v != 0 ? 1 : 0);
+			return;
+		case FLOAT4OID:
+		case FLOAT8OID:
+			Add(static_cast<double>(v));
+			return;
+		default:
+			ThrowType(is_unsigned ? "unsigned integer" : "integer");
+		}
+	}
+
+	int len = snprintf(val, sizeof(val), "%lld", (long long)v);
+	AddText(val, (size_t)len);
+}
+
+void DBI::PGCopyWriter::AddText(const char *v, size_t len)
+{
+	unsigned int type = FieldType();
+	if (m_binary) {
+		//text and varchar send their bytes as is, bytea takes them raw too
+		if (!IsTextType(type) && type != BYTEAOID) {
+			ThrowType("string");
+		}
+
+		BeginField();
+		PutBinaryLength(static_cast<int32_t>(len));
+		m_buffer.insert(m_buffer.end(), v, v + len);
+		return;
+	}
+
+	BeginField();
+	for (size_t i = 0; i < len; ++i) {
+		char c = v[i];
+		switch (c) {
+		case '\\':
+			m_buffer.push_back('\\');
+			m_buffer.push_back('\\');
+			break;
+		case '\t':
+			m_buffer.push_back('\\');
+			m_buffer.push_back('t');
+			break;
+		case '\n':
+			m_buffer.push_back('\\');
+			m_buffer.push_back('n');
+			break;
+		case '\r':
+			m_buffer.push_back('\\');
+			m_buffer.push_back('r');
+			break;
+		default:
+			m_buffer.push_back(c);
+			break;
+		}
+	}
+}
+
+void DBI::PGCopyWriter::AddBytea(const char *v, size_t len)
+{
+	if (m_binary) {
+		AddText(v, len);
+		return;
+	}
+
+	//hex bytea input, the backslash itself has to be escaped for COPY
+	static const char hex[] = "0123456789abcdef";
+	FieldType();
+	BeginField();
+	m_buffer.push_back('\\');
+	m_buffer.push_back('\\');
+	m_buffer.push_back('x');
+	for (size_t i = 0; i < len; ++i) {
+		unsigned char c = static_cast<unsigned char>(v[i]);
+		m_buffer.push_back(hex[c >> 4]);
+		m_buffer.push_back(hex[c & 0x0F]);
+	}
+}
+
+void DBI::PGCopyWriter::BeginField()
+{
+	if (m_field == 0) {
+		m_row_start = m_buffer.size();
+		if (m_binary) {
+			//field count, filled in by EndRow()
+			PutBE(m_buffer, 0, 2);
+		}
+	}
+	else if (!m_binary) {
+		m_buffer.push_back('\t');
+	}
+
+	++m_field;
+}
+
+void DBI::PGCopyWriter::PutBinaryLength(int32_t len)
+{
+	PutBE(m_buffer, static_cast<uint32_t>(len), 4);
+}
+
+void DBI::PGCopyWriter::Flush(bool force)
+{
+	if (m_buffer.empty() || (!force && m_buffer.size() < COPY_CHUNK_SIZE)) {
+		return;
+	}
+
+	if (PQputCopyData(m_handle, &m_buffer[0], (int)m_buffer.size()) != 1) {
+		std::string error = "Copy Error: ";
+		error += PQerrorMessage(m_handle);
+		throw std::runtime_error(error);
+	}
+
+	m_buffer.clear();
+}
+
+void DBI::PGCopyWriter::Drain()
+{
+	PGresult *res = nullptr;
+	while ((res = PQgetResult(m_handle)) != nullptr) {
+		PQclear(res);
+	}
+}
+
+unsigned int DBI::PGCopyWriter::FieldType()
+{
+	if (!m_active) {
+		throw std::runtime_error("Copy Error: the copy has already ended.");
+	}
+
+	if (!m_binary) {
+		return 0;
+	}
+
+	if (m_field >= m_types.size()) {
+		DropRow();
+		throw std::runtime_error("Copy Error: row has more fields than the copy has columns.");
+	}
+
+	return m_types[m_field];
+}
+
+void DBI::PGCopyWriter::ThrowType(const char *value_type)
+{
+	std::string error = "Copy Error: can't send a ";
+	error += value_type;
+	error += " to column " + std::to_string(m_field + 1) + " (type oid " + std::to_string(m_types[m_field]) +
+		") in binary format, use a text format copy.";
+	DropRow();
+	throw std::runtime_error(error);
+}
+
+void DBI::PGCopyWriter::DropRow()
+{
+	if (m_field > 0) {
+		m_buffer.resize(m_row_start);
+		m_field = 0;
+	}
+}
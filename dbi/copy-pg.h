@@ -0,0 +1,95 @@
+#pragma once
+
+#include <stdint.h>
+#include <cstddef>
+#include <string>
+#include <vector>
+
+struct pg_conn;
+typedef struct pg_conn PGconn;
+
+namespace DBI
+{
+
+	class PGDatabaseHandle;
+
+	/*
+		Streams rows into a table with COPY FROM STDIN, created through
+		PGDatabaseHandle::CopyIn().  Rows are encoded into a local buffer and sent
+		in large chunks; nothing is committed until Finish().  The connection
+		can't be used for anything else until the writer is finished or destroyed,
+		destroying an unfinished writer aborts the copy.
+	*/
+	class PGCopyWriter
+	{
+	public:
+		virtual ~PGCopyWriter();
+
+		template<typename T, typename... Args>
+		void WriteRow(T value, Args... args)
+		{
+			Add(value);
+			WriteRow(args...);
+		}
+
+		void WriteRow() {
+			EndRow();
+		}
+
+		//Field at a time alternative to WriteRow(), fields go in column order.  A field the
+		//column can't take throws std::runtime_error and discards the rest of that row.
+		void Add(bool v);
+		void Add(int8_t v);
+		void Add(uint8_t v);
+		void Add(int16_t v);
+		void Add(uint16_t v);
+		void Add(int32_t v);
+		void Add(uint32_t v);
+		void Add(int64_t v);
+		void Add(uint64_t v);
+		void Add(float v);
+		void Add(double v);
+		void Add(const std::string &v);
+		void Add(const char *v);
+		void Add(std::nullptr_t v);
+		void EndRow();
+
+		//Ends the copy and returns the number of rows the server stored, throws std::runtime_error on failure.
+		size_t Finish();
+
+		//Cancels the copy, the server discards every row sent so far.
+		void Abort();
+
+		bool IsBinary() const { return m_binary; }
+
+		PGCopyWriter(const PGCopyWriter&) = delete;
+		PGCopyWriter &operator=(const PGCopyWriter&) = delete;
+
+	protected:
+		PGCopyWriter(PGconn *conn_, bool binary_, std::vector<unsigned int> types_);
+
+		void AddInteger(int64_t v, bool is_unsigned);
+		void AddText(const char *v, size_t len);
+		void AddBytea(const char *v, size_t len);
+		void BeginField();
+		void PutBinaryLength(int32_t len);
+		void Flush(bool force);
+		void Drain();
+		unsigned int FieldType();
+		//Drops the partly written row so the copy can carry on after a bad field.
+		void ThrowType(const char *value_type);
+		void DropRow();
+
+		PGconn *m_handle;
+		bool m_binary;
+		bool m_active;
+		//column type oids, only known and needed in binary mode
+		std::vector<unsigned int> m_types;
+		size_t m_field;
+		size_t m_row_start;
+		std::vector<char> m_buffer;
+
+		friend class DBI::PGDatabaseHandle;
+	};
+
+}
@@ -0,0 +1,50 @@
+#pragma once
+
+#include <cstddef>
+#include <string>
+#include <vector>
+
+namespace DBI
+{
+
+	/*
+		Forward only view over the rows of an executing statement, only the current
+		row is held in memory.  Data returned by GetData() is only valid until the
+		next call to Next().  The statement that created the cursor must outlive it
+		and can not be executed again until the cursor is destroyed.
+	*/
+	class Cursor
+	{
+	public:
+		Cursor() { }
+		virtual ~Cursor() { }
+
+		virtual bool Next() = 0;
+
+		const std::vector<std::string>& Fields() const { return m_fields; }
+		size_t FieldCount() const { return m_fields.size(); }
+
+		int FieldIndex(const std::string &name) const {
+			for (size_t i = 0; i < m_fields.size(); ++i) {
+				if (m_fields[i] == name) {
+					return static_cast<int>(i);
+				}
+			}
+
+			return -1;
+		}
+
+		virtual bool IsNull(size_t col) const = 0;
+		virtual const char *GetData(size_t col) const = 0;
+		virtual size_t GetLength(size_t col) const = 0;
+
+		std::string GetValue(size_t col) const {
+			const char *data = GetData(col);
+			return std::string(data, GetLength(col));
+		}
+
+	protected:
+		std::vector<std::string> m_fields;
+	};
+
+}
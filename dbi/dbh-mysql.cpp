@@ -10,9 +10,10 @@
 
 #include "sth-mysql.h"
 
-DBI::MySQLDatabaseHandle::MySQLDatabaseHandle()
+DBI::MySQLDatabaseHandle::MySQLDatabaseHandle() : m_do_cache(DefaultDoCacheSize)
 {
 	m_handle = nullptr;
+	m_do_statement = nullptr;
 }
 
 DBI::MySQLDatabaseHandle::~MySQLDatabaseHandle()
@@ -202,6 +203,8 @@ void DBI::MySQLDatabaseHandle::Connect(std::string dbname, std::string host, std
 		port = static_cast<int>(std::stoi(iter->second));
 	}
 	
+	ConfigureDoCache(attr);
+
 	MYSQL* result = mysql_real_connect(m_handle, host.c_str(), username.c_str(), auth.c_str(), dbname.c_str(), port,
 		socket.empty() ? nullptr : socket.c_str(), client_flag);
 	
@@ -215,6 +218,12 @@ void DBI::MySQLDatabaseHandle::Connect(std::string dbname, std::string host, std
 
 void DBI::MySQLDatabaseHandle::Disconnect()
 {
+	CloseWrites(m_handle != nullptr);
+
+	m_do_statement = nullptr;
+	m_do_uncached.reset();
+	m_do_cache.Clear();
+
 	if (!m_handle) {
 		return;
 	}
@@ -223,7 +232,7 @@ void DBI::MySQLDatabaseHandle::Disconnect()
 	m_handle = nullptr;
 }
 
-std::unique_ptr<DBI::StatementHandle> DBI::MySQLDatabaseHandle::Prepare(std::string stmt)
+std::unique_ptr<DBI::StatementHandle> DBI::MySQLDatabaseHandle::InternalPrepare(std::string stmt)
 {
 	auto *s = mysql_stmt_init(m_handle);
 	if (mysql_stmt_prepare(s, stmt.c_str(), static_cast<unsigned long>(stmt.length()))) {
@@ -263,6 +272,11 @@ void DBI::MySQLDatabaseHandle::Commit()
 
 void DBI::MySQLDatabaseHandle::Rollback()
 {
+	//results read inside the transaction may have seen its writes
+	if(m_result_cache) {
+		m_result_cache->InvalidateAll();
+	}
+
 	if(mysql_rollback(m_handle)) {
 		mysql_autocommit(m_handle, 1);
 		throw std::runtime_error("DBI::MySQLDatabaseHandle::Rollback() failed.");
@@ -271,95 +285,82 @@ void DBI::MySQLDatabaseHandle::Rollback()
 	mysql_autocommit(m_handle, 1);
 }
 
-void DBI::MySQLDatabaseHandle::BindArg(bool v, int i)
-{
-	m_do_statement->BindArg(v, i);
-}
-
-void DBI::MySQLDatabaseHandle::BindArg(int8_t v, int i)
-{
-	m_do_statement->BindArg(v, i);
-}
-
-void DBI::MySQLDatabaseHandle::BindArg(uint8_t v, int i)
-{
-	m_do_statement->BindArg(v, i);
-}
-
-void DBI::MySQLDatabaseHandle::BindArg(int16_t v, int i)
-{
-	m_do_statement->BindArg(v, i);
-}
-
-void DBI::MySQLDatabaseHandle::BindArg(uint16_t v, int i)
+bool DBI::MySQLDatabaseHandle::InTransaction() const
 {
-	m_do_statement->BindArg(v, i);
+	//Begin() turns autocommit off, a BEGIN through Do() leaves it on and sets IN_TRANS
+	return m_handle && ((m_handle->server_status & SERVER_STATUS_IN_TRANS) || !(m_handle->server_status & SERVER_STATUS_AUTOCOMMIT));
 }
 
-void DBI::MySQLDatabaseHandle::BindArg(int32_t v, int i)
+DBI::CacheStats DBI::MySQLDatabaseHandle::DoCacheStats() const
 {
-	m_do_statement->BindArg(v, i);
+	return m_do_cache.Stats();
 }
 
-void DBI::MySQLDatabaseHandle::BindArg(uint32_t v, int i)
+int DBI::MySQLDatabaseHandle::ErrorCode() const
 {
-	m_do_statement->BindArg(v, i);
+	//statement errors are copied from the connection so this covers Do() as well
+	return m_handle ? (int)mysql_errno(m_handle) : 0;
 }
 
-void DBI::MySQLDatabaseHandle::BindArg(int64_t v, int i)
+void DBI::MySQLDatabaseHandle::BindParamBlock(const ParamBlock &params)
 {
-	m_do_statement->BindArg(v, i);
+	m_do_statement->BindParamBlock(params);
 }
 
-void DBI::MySQLDatabaseHandle::BindArg(uint64_t v, int i)
+std::unique_ptr<DBI::ResultSet> DBI::MySQLDatabaseHandle::ExecuteDo()
 {
-	m_do_statement->BindArg(v, i);
+	auto res = m_do_statement->InternalExecute();
+	m_do_uncached.reset();
+	return res;
 }
 
-void DBI::MySQLDatabaseHandle::BindArg(float v, int i)
+std::unique_ptr<DBI::AsyncResult> DBI::MySQLDatabaseHandle::ExecuteDoAsync()
 {
-	m_do_statement->BindArg(v, i);
+	auto res = m_do_statement->InternalExecuteAsync();
+	if (m_do_uncached) {
+		res->KeepAlive(std::shared_ptr<StatementHandle>(std::move(m_do_uncached)));
+	}
+	return res;
 }
 
-void DBI::MySQLDatabaseHandle::BindArg(double v, int i)
+void DBI::MySQLDatabaseHandle::InitDo(const std::string &stmt)
 {
-	m_do_statement->BindArg(v, i);
-}
+	m_do_statement = nullptr;
+	if (m_do_cache.Capacity() > 0) {
+		auto cached = m_do_cache.Get(stmt);
+		if (cached) {
+			m_do_statement = cached->get();
+			return;
+		}
+	}
 
-void DBI::MySQLDatabaseHandle::BindArg(const std::string &v, int i)
-{
-	m_do_statement->BindArg(v, i);
-}
+	auto *s = mysql_stmt_init(m_handle);
+	if (mysql_stmt_prepare(s, stmt.c_str(), static_cast<unsigned long>(stmt.length()))) {
+		std::string err = "Prepare failure: ";
+		err += mysql_stmt_error(s);
+		mysql_stmt_close(s);
 
-void DBI::MySQLDatabaseHandle::BindArg(const char *v, int i)
-{
-	m_do_statement->BindArg(v, i);
-}
+		throw std::runtime_error(err);
+	}
 
-void DBI::MySQLDatabaseHandle::BindArg(std::nullptr_t v, int i)
-{
-	m_do_statement->BindArg(v, i);
+	CacheDoStatement(stmt, std::unique_ptr<MySQLStatementHandle>(new MySQLStatementHandle(m_handle, s)));
 }
 
-std::unique_ptr<DBI::ResultSet> DBI::MySQLDatabaseHandle::ExecuteDo()
+void DBI::MySQLDatabaseHandle::ConfigureDoCache(DatabaseAttributes &attr)
 {
-	auto res = m_do_statement->InternalExecute();
-	m_do_statement.release();
-	return res;
+	auto iter = attr.find("dbi_do_cache_size");
+	if (iter != attr.end()) {
+		m_do_cache.SetCapacity(static_cast<size_t>(std::stoul(iter->second)));
+	}
 }
 
-void DBI::MySQLDatabaseHandle::InitDo(const std::string &stmt)
+void DBI::MySQLDatabaseHandle::CacheDoStatement(const std::string &stmt, std::unique_ptr<MySQLStatementHandle> handle)
 {
-	if (!m_do_statement) {
-		auto *s = mysql_stmt_init(m_handle);
-		if (mysql_stmt_prepare(s, stmt.c_str(), static_cast<unsigned long>(stmt.length()))) {
-			std::string err = "Prepare failure: ";
-			err += mysql_stmt_error(s);
-			mysql_stmt_close(s);
-
-			throw std::runtime_error(err);
-		}
-
-		m_do_statement.reset(new MySQLStatementHandle(m_handle, s));
+	if (m_do_cache.Capacity() > 0) {
+		m_do_statement = m_do_cache.Put(stmt, std::move(handle)).get();
+	}
+	else {
+		m_do_uncached = std::move(handle);
+		m_do_statement = m_do_uncached.get();
 	}
 }
@@ -24,33 +24,29 @@ namespace DBI
 			std::string auth, DatabaseAttributes &attr);
 		virtual void Disconnect();
 
-		virtual std::unique_ptr<StatementHandle> Prepare(std::string stmt);
-
 		virtual void Ping();
 		virtual void Begin();
 		virtual void Commit();
 		virtual void Rollback();
+		virtual bool InTransaction() const;
+
+		virtual CacheStats DoCacheStats() const;
+
+		virtual int ErrorCode() const;
 
 	protected:
-		virtual void BindArg(bool v, int i);
-		virtual void BindArg(int8_t v, int i);
-		virtual void BindArg(uint8_t v, int i);
-		virtual void BindArg(int16_t v, int i);
-		virtual void BindArg(uint16_t v, int i);
-		virtual void BindArg(int32_t v, int i);
-		virtual void BindArg(uint32_t v, int i);
-		virtual void BindArg(int64_t v, int i);
-		virtual void BindArg(uint64_t v, int i);
-		virtual void BindArg(float v, int i);
-		virtual void BindArg(double v, int i);
-		virtual void BindArg(const std::string &v, int i);
-		virtual void BindArg(const char *v, int i);
-		virtual void BindArg(std::nullptr_t v, int i);
+		virtual void BindParamBlock(const ParamBlock &params);
+		virtual std::unique_ptr<StatementHandle> InternalPrepare(std::string stmt);
 		virtual std::unique_ptr<ResultSet> ExecuteDo();
+		virtual std::unique_ptr<AsyncResult> ExecuteDoAsync();
 		virtual void InitDo(const std::string& stmt);
+		void ConfigureDoCache(DatabaseAttributes &attr);
+		void CacheDoStatement(const std::string &stmt, std::unique_ptr<MySQLStatementHandle> handle);
 
 		MYSQL *m_handle;
-		std::unique_ptr<MySQLStatementHandle> m_do_statement;
+		MySQLStatementHandle *m_do_statement;
+		std::unique_ptr<MySQLStatementHandle> m_do_uncached;
+		LRUCache<std::string, std::unique_ptr<MySQLStatementHandle>> m_do_cache;
 	};
 
 }
@@ -17,15 +17,19 @@
 */
 #include "dbh-pg.h"
 #include "sth-pg.h"
+#include "pipeline-pg.h"
 #include "rs.h"
+#include "fingerprint.h"
 #include <stdint.h>
+#include <stdio.h>
 #include <string.h>
 #include <assert.h>
 #include <cstddef>
 #include <string>
 #include <libpq-fe.h>
 
-DBI::PGDatabaseHandle::PGDatabaseHandle() : m_handle(nullptr) {
+DBI::PGDatabaseHandle::PGDatabaseHandle() : m_handle(nullptr), m_binary(false), m_fetch_rows(0), m_error_code(0), m_do_statement(nullptr), m_do_cache(DefaultDoCacheSize),
+	m_rewrite_cache(DefaultRewriteCacheSize) {
 }
 
 DBI::PGDatabaseHandle::~PGDatabaseHandle() {
@@ -98,6 +102,20 @@ void DBI::PGDatabaseHandle::Connect(std::string dbname, std::string host, std::s
 		connection_string += "'";
 	}
 	
+	//params and results go over the wire in binary where the types allow it
+	iter = attr.find("pg_binary");
+	if(iter != attr.end()) {
+		m_binary = std::stoi(iter->second) != 0;
+	}
+
+	//Execute() streams results in chunks of this many rows instead of buffering them in libpq first
+	iter = attr.find("pg_fetch_rows");
+	if(iter != attr.end()) {
+		m_fetch_rows = std::stoi(iter->second);
+	}
+
+	ConfigureDoCache(attr);
+
 	m_handle = PQconnectdb(connection_string.c_str());
 		
 	auto status = PQstatus(m_handle);
@@ -108,34 +126,45 @@ void DBI::PGDatabaseHandle::Connect(std::string dbname, std::string host, std::s
 		throw std::runtime_error(error);
 	}
 
+	m_registry = std::make_shared<PGStatementRegistry>(m_handle);
 }
 
 void DBI::PGDatabaseHandle::Disconnect() {
+	CloseWrites(m_handle != nullptr);
+
+	//dropped first so the statements released below don't each DEALLOCATE on a closing connection
+	m_registry.reset();
+
+	m_do_statement = nullptr;
+	m_do_uncached.reset();
+	m_do_cache.Clear();
+
 	if (m_handle) {
 		PQfinish(m_handle);
 		m_handle = nullptr;
 	}
 }
 
-std::unique_ptr<DBI::StatementHandle> DBI::PGDatabaseHandle::Prepare(std::string stmt) {
+std::unique_ptr<DBI::StatementHandle> DBI::PGDatabaseHandle::InternalPrepare(std::string stmt) {
+	if (!m_registry) {
+		throw std::runtime_error("Prepare Error: not connected.");
+	}
+
 	int params = 0;
 	std::string query = InternalProcessQuery(stmt, &params);
-	
-	PGresult *res = PQprepare(m_handle, "", query.c_str(), params, nullptr); 
-	if(PQresultStatus(res) == PGRES_TUPLES_OK || PQresultStatus(res) == PGRES_COMMAND_OK) {
-		PQclear(res);
 
-		std::unique_ptr<DBI::StatementHandle> st(new DBI::PGStatementHandle(m_handle, ""));
-		return st;
-	}
-	
-	std::string error = "Prepare Error: ";
-	error += PQresultErrorMessage(res);
-	PQclear(res);
-	throw std::runtime_error(error);
+	auto prepared = m_registry->Prepare(query, params);
+	std::unique_ptr<DBI::PGStatementHandle> st(new DBI::PGStatementHandle(m_handle, prepared->name, prepared));
+	ConfigureStatement(*st);
+	return st;
 }
 
 std::unique_ptr<DBI::StatementHandle> DBI::PGDatabaseHandle::Prepare(std::string stmt, std::string name)
+{
+	return PrepareStatement(stmt, [this, &stmt, &name]() { return PrepareNamed(stmt, name); });
+}
+
+std::unique_ptr<DBI::StatementHandle> DBI::PGDatabaseHandle::PrepareNamed(const std::string &stmt, const std::string &name)
 {
 	int params = 0;
 	std::string query = InternalProcessQuery(stmt, &params);
@@ -144,7 +173,8 @@ std::unique_ptr<DBI::StatementHandle> DBI::PGDatabaseHandle::Prepare(std::string
 	if (PQresultStatus(res) == PGRES_TUPLES_OK || PQresultStatus(res) == PGRES_COMMAND_OK) {
 		PQclear(res);
 
-		std::unique_ptr<DBI::StatementHandle> st(new DBI::PGStatementHandle(m_handle, name));
+		std::unique_ptr<DBI::PGStatementHandle> st(new DBI::PGStatementHandle(m_handle, name));
+		ConfigureStatement(*st);
 		return st;
 	}
 
@@ -154,6 +184,61 @@ std::unique_ptr<DBI::StatementHandle> DBI::PGDatabaseHandle::Prepare(std::string
 	throw std::runtime_error(error);
 }
 
+std::unique_ptr<DBI::PGCopyWriter> DBI::PGDatabaseHandle::CopyIn(const std::string &table,
+	const std::vector<std::string> &columns, bool binary)
+{
+	std::string column_list;
+	for (auto &column : columns) {
+		if (!column_list.empty()) {
+			column_list += ", ";
+		}
+		column_list += column;
+	}
+
+	//binary fields have to match the column types exactly so look them up first
+	std::vector<unsigned int> types;
+	if (binary) {
+		std::string query = "SELECT ";
+		query += column_list.empty() ? "*" : column_list;
+		query += " FROM " + table + " LIMIT 0";
+
+		PGresult *res = PQexec(m_handle, query.c_str());
+		if (PQresultStatus(res) != PGRES_TUPLES_OK) {
+			std::string error = "Copy Error: ";
+			error += PQresultErrorMessage(res);
+			PQclear(res);
+			throw std::runtime_error(error);
+		}
+
+		for (int i = 0; i < PQnfields(res); ++i) {
+			types.push_back(PQftype(res, i));
+		}
+		PQclear(res);
+	}
+
+	std::string query = "COPY " + table;
+	if (!column_list.empty()) {
+		query += " (" + column_list + ")";
+	}
+	query += binary ? " FROM STDIN (FORMAT binary)" : " FROM STDIN";
+
+	PGresult *res = PQexec(m_handle, query.c_str());
+	if (PQresultStatus(res) != PGRES_COPY_IN) {
+		std::string error = "Copy Error: ";
+		error += PQresultErrorMessage(res);
+		PQclear(res);
+		throw std::runtime_error(error);
+	}
+	PQclear(res);
+
+	return std::unique_ptr<PGCopyWriter>(new PGCopyWriter(m_handle, binary, types));
+}
+
+std::unique_ptr<DBI::PGPipeline> DBI::PGDatabaseHandle::Pipeline()
+{
+	return std::unique_ptr<PGPipeline>(new PGPipeline(m_handle));
+}
+
 void DBI::PGDatabaseHandle::Ping() {
 	auto status = PQstatus(m_handle);
 	if (status != CONNECTION_OK)
@@ -164,6 +249,11 @@ void DBI::PGDatabaseHandle::Ping() {
 		if(status != CONNECTION_OK) {
 			throw std::runtime_error("Could not perform database ping, connection seems to be lost.");
 		}
+
+		//prepared statements died with the old session
+		if (m_registry) {
+			m_registry->Reprepare();
+		}
 	}
 }
 
@@ -173,135 +263,150 @@ void DBI::PGDatabaseHandle::Begin() {
 
 void DBI::PGDatabaseHandle::Commit() {
 	Do("COMMIT");
+	m_registry->DeallocateReleased();
 }
 
 void DBI::PGDatabaseHandle::Rollback() {
 	Do("ROLLBACK");
+	m_registry->DeallocateReleased();
 }
 
-void DBI::PGDatabaseHandle::BindArg(bool v, int i) {
-	m_do_statement->BindArg(v, i);
-}
+bool DBI::PGDatabaseHandle::InTransaction() const {
+	if (!m_handle) {
+		return false;
+	}
 
-void DBI::PGDatabaseHandle::BindArg(int8_t v, int i)
-{
-	m_do_statement->BindArg(v, i);
+	auto status = PQtransactionStatus(m_handle);
+	return status == PQTRANS_INTRANS || status == PQTRANS_INERROR;
 }
 
-void DBI::PGDatabaseHandle::BindArg(uint8_t v, int i)
-{
-	m_do_statement->BindArg(v, i);
+DBI::CacheStats DBI::PGDatabaseHandle::DoCacheStats() const {
+	return m_do_cache.Stats();
 }
 
-void DBI::PGDatabaseHandle::BindArg(int16_t v, int i)
-{
-	m_do_statement->BindArg(v, i);
+void DBI::PGDatabaseHandle::BindParamBlock(const ParamBlock &params) {
+	m_do_statement->BindParamBlock(params);
 }
 
-void DBI::PGDatabaseHandle::BindArg(uint16_t v, int i)
+std::unique_ptr<DBI::ResultSet> DBI::PGDatabaseHandle::ExecuteDo()
 {
-	m_do_statement->BindArg(v, i);
-}
+	std::unique_ptr<DBI::ResultSet> res;
+	try {
+		res = m_do_statement->InternalExecute();
+	}
+	catch (...) {
+		m_error_code = m_do_statement->m_error_code;
+		throw;
+	}
 
-void DBI::PGDatabaseHandle::BindArg(int32_t v, int i)
-{
-	m_do_statement->BindArg(v, i);
+	m_do_uncached.reset();
+	return res;
 }
 
-void DBI::PGDatabaseHandle::BindArg(uint32_t v, int i)
+std::unique_ptr<DBI::AsyncResult> DBI::PGDatabaseHandle::ExecuteDoAsync()
 {
-	m_do_statement->BindArg(v, i);
+	auto res = m_do_statement->InternalExecuteAsync();
+	if (m_do_uncached) {
+		res->KeepAlive(std::shared_ptr<StatementHandle>(std::move(m_do_uncached)));
+	}
+	return res;
 }
 
-void DBI::PGDatabaseHandle::BindArg(int64_t v, int i)
+void DBI::PGDatabaseHandle::InitDo(const std::string& stmt)
 {
-	m_do_statement->BindArg(v, i);
-}
+	m_do_statement = nullptr;
+	m_error_code = 0;
+	if (m_registry) {
+		//cached Do()s never reach Prepare(), which would send these otherwise
+		m_registry->DeallocateReleased();
+	}
 
-void DBI::PGDatabaseHandle::BindArg(uint64_t v, int i)
-{
-	m_do_statement->BindArg(v, i);
-}
+	if (m_do_cache.Capacity() > 0) {
+		auto cached = m_do_cache.Get(stmt);
+		if (cached) {
+			m_do_statement = cached->get();
+			return;
+		}
+	}
 
-void DBI::PGDatabaseHandle::BindArg(float v, int i)
-{
-	m_do_statement->BindArg(v, i);
-}
+	if (!m_registry) {
+		throw std::runtime_error("Prepare Error: not connected.");
+	}
 
-void DBI::PGDatabaseHandle::BindArg(double v, int i)
-{
-	m_do_statement->BindArg(v, i);
-}
+	//shares the server side statement with any Prepare() of the same SQL
+	int params = 0;
+	std::string query = InternalProcessQuery(stmt, &params);
+	auto prepared = m_registry->Prepare(query, params);
 
-void DBI::PGDatabaseHandle::BindArg(const std::string &v, int i)
-{
-	m_do_statement->BindArg(v, i);
+	std::unique_ptr<PGStatementHandle> st(new DBI::PGStatementHandle(m_handle, prepared->name, prepared));
+	ConfigureStatement(*st);
+	CacheDoStatement(stmt, std::move(st));
 }
 
-void DBI::PGDatabaseHandle::BindArg(const char *v, int i)
+void DBI::PGDatabaseHandle::ConfigureStatement(PGStatementHandle &handle)
 {
-	m_do_statement->BindArg(v, i);
+	handle.m_fetch_rows = m_fetch_rows;
+	if (m_binary) {
+		handle.Describe();
+	}
 }
 
-void DBI::PGDatabaseHandle::BindArg(std::nullptr_t v, int i)
+void DBI::PGDatabaseHandle::ConfigureDoCache(DatabaseAttributes &attr)
 {
-	m_do_statement->BindArg(v, i);
+	auto iter = attr.find("dbi_do_cache_size");
+	if (iter != attr.end()) {
+		m_do_cache.SetCapacity(static_cast<size_t>(std::stoul(iter->second)));
+	}
 }
 
-std::unique_ptr<DBI::ResultSet> DBI::PGDatabaseHandle::ExecuteDo()
+void DBI::PGDatabaseHandle::CacheDoStatement(const std::string &stmt, std::unique_ptr<PGStatementHandle> handle)
 {
-	auto res = m_do_statement->InternalExecute();
-	m_do_statement.release();
-	return res;
+	if (m_do_cache.Capacity() > 0) {
+		m_do_statement = m_do_cache.Put(stmt, std::move(handle)).get();
+	}
+	else {
+		m_do_uncached = std::move(handle);
+		m_do_statement = m_do_uncached.get();
+	}
 }
 
-void DBI::PGDatabaseHandle::InitDo(const std::string& stmt)
-{
-	if (!m_do_statement) {
-		int params = 0;
-		std::string query = InternalProcessQuery(stmt, &params);
-
-		PGresult *res = PQprepare(m_handle, "", query.c_str(), params, nullptr);
-		if (PQresultStatus(res) == PGRES_TUPLES_OK || PQresultStatus(res) == PGRES_COMMAND_OK) {
-			PQclear(res);
-
-			m_do_statement.reset(new DBI::PGStatementHandle(m_handle, ""));
-			return;
-		}
+std::string DBI::PGDatabaseHandle::InternalProcessQuery(std::string stmt, int *params) {
+	auto cached = m_rewrite_cache.Get(stmt);
+	if (!cached) {
+		RewrittenQuery rewritten;
+		rewritten.params = RewritePlaceholders(stmt, rewritten.query);
+		cached = &m_rewrite_cache.Put(stmt, std::move(rewritten));
+	}
 
-		std::string error = "Prepare Error: ";
-		error += PQresultErrorMessage(res);
-		PQclear(res);
-		throw std::runtime_error(error);
+	if (params) {
+		*params = cached->params;
 	}
+
+	return cached->query;
 }
 
-std::string DBI::PGDatabaseHandle::InternalProcessQuery(std::string stmt, int *params) {
-	std::string ret;
-	size_t sz = stmt.size();
-	size_t current = 1;
-	bool escaped = false;
-
-	if(params)
-		*params = 0;
-
-	for(size_t i = 0; i < sz; ++i) {
-		char c = stmt[i];
-		if(escaped) {
-			ret.push_back(c);
-			escaped = false;
-		} else if(c == '\\') {
-			ret.push_back(c);
-			escaped = true;
-		} else if(c == '?') {
-			ret.push_back('$');
-			ret += std::to_string((unsigned long)current++);
-			if(params)
-				*params = *params + 1;
-		} else {
-			ret.push_back(c);
+int DBI::PGDatabaseHandle::RewritePlaceholders(const std::string &stmt, std::string &out) {
+	int current = 0;
+	out.clear();
+	out.reserve(stmt.size() + 16);
+
+	//copies the text between placeholders in one go, the lexer already steps over strings and comments
+	size_t start = 0;
+	SQLLexer lexer(stmt);
+	SQLToken token;
+	while (lexer.Next(token)) {
+		if (token.type != SQLToken::TokenPlaceholder) {
+			continue;
 		}
+
+		out.append(stmt, start, token.offset - start);
+		out.push_back('$');
+		char number[16];
+		int len = snprintf(number, sizeof(number), "%d", ++current);
+		out.append(number, (size_t)len);
+		start = token.offset + token.length;
 	}
 
-	return ret;
+	out.append(stmt, start, std::string::npos);
+	return current;
 }
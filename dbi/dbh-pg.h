@@ -1,6 +1,8 @@
 #pragma once
 
 #include "dbh.h"
+#include "copy-pg.h"
+#include <vector>
 
 struct pg_conn;
 typedef struct pg_conn PGconn;
@@ -8,6 +10,8 @@ typedef struct pg_conn PGconn;
 namespace DBI
 {
 	class PGStatementHandle;
+	class PGPipeline;
+	class PGStatementRegistry;
 	class PGDatabaseHandle : public DatabaseHandle
 	{
 	public:
@@ -18,35 +22,65 @@ namespace DBI
 			std::string auth, DatabaseAttributes &attr);
 		virtual void Disconnect();
 
-		virtual std::unique_ptr<StatementHandle> Prepare(std::string stmt);
+		//Statements are named automatically and identical SQL shares one server side statement.
+		using DatabaseHandle::Prepare;
+		//Prepares under a caller chosen name, not shared, kept until the session ends and not restored by Ping().
 		std::unique_ptr<StatementHandle> Prepare(std::string stmt, std::string name);
 
 		virtual void Ping();
 		virtual void Begin();
 		virtual void Commit();
 		virtual void Rollback();
+		virtual bool InTransaction() const;
+
+		virtual CacheStats DoCacheStats() const;
+
+		//SQLSTATE of the last failed Do(), packed like the server's ERRCODE_ macros.
+		virtual int ErrorCode() const { return m_error_code; }
+
+		/*
+			Starts a COPY FROM STDIN into table, columns defaults to every column in
+			table order.  Names are put into the statement as given.  Binary format
+			skips the server's text parsing but only takes bool, integer, float, text
+			and bytea columns.
+		*/
+		std::unique_ptr<PGCopyWriter> CopyIn(const std::string &table,
+			const std::vector<std::string> &columns = std::vector<std::string>(), bool binary = false);
+
+		//Starts queueing executes without waiting on results, see pipeline-pg.h.
+		std::unique_ptr<PGPipeline> Pipeline();
 
 	protected:
-		virtual void BindArg(bool v, int i);
-		virtual void BindArg(int8_t v, int i);
-		virtual void BindArg(uint8_t v, int i);
-		virtual void BindArg(int16_t v, int i);
-		virtual void BindArg(uint16_t v, int i);
-		virtual void BindArg(int32_t v, int i);
-		virtual void BindArg(uint32_t v, int i);
-		virtual void BindArg(int64_t v, int i);
-		virtual void BindArg(uint64_t v, int i);
-		virtual void BindArg(float v, int i);
-		virtual void BindArg(double v, int i);
-		virtual void BindArg(const std::string &v, int i);
-		virtual void BindArg(const char *v, int i);
-		virtual void BindArg(std::nullptr_t v, int i);
+		virtual void BindParamBlock(const ParamBlock &params);
+		virtual std::unique_ptr<StatementHandle> InternalPrepare(std::string stmt);
+		std::unique_ptr<StatementHandle> PrepareNamed(const std::string &stmt, const std::string &name);
 		virtual std::unique_ptr<ResultSet> ExecuteDo();
+		virtual std::unique_ptr<AsyncResult> ExecuteDoAsync();
 		virtual void InitDo(const std::string& stmt);
+		void ConfigureStatement(PGStatementHandle &handle);
+		void ConfigureDoCache(DatabaseAttributes &attr);
+		void CacheDoStatement(const std::string &stmt, std::unique_ptr<PGStatementHandle> handle);
+		//Turns ? placeholders into $n, results are memoized per SQL text.
 		std::string InternalProcessQuery(std::string stmt, int *params = nullptr);
+		static int RewritePlaceholders(const std::string &stmt, std::string &out);
+
+		struct RewrittenQuery
+		{
+			RewrittenQuery() : params(0) { }
+			std::string query;
+			int params;
+		};
+		static const size_t DefaultRewriteCacheSize = 256;
 
 		PGconn *m_handle;
-		std::unique_ptr<PGStatementHandle> m_do_statement;
+		bool m_binary;
+		int m_fetch_rows;
+		int m_error_code;
+		std::shared_ptr<PGStatementRegistry> m_registry;
+		PGStatementHandle *m_do_statement;
+		std::unique_ptr<PGStatementHandle> m_do_uncached;
+		LRUCache<std::string, std::unique_ptr<PGStatementHandle>> m_do_cache;
+		LRUCache<std::string, RewrittenQuery> m_rewrite_cache;
 	};
 }
 
@@ -23,9 +23,59 @@
 #include <assert.h>
 #include <cstddef>
 #include <string>
+#include <algorithm>
+#include <cctype>
 #include "sqlite3.h"
 
-DBI::SQLiteDatabaseHandle::SQLiteDatabaseHandle() : m_handle(nullptr) {
+namespace DBI
+{
+	//a read only connection and the statements prepared on it, only touched while leased
+	struct SQLiteReader
+	{
+		SQLiteReader(size_t cache_size) : handle(nullptr), statements(cache_size) { }
+
+		sqlite3 *handle;
+		LRUCache<std::string, std::unique_ptr<SQLiteStatementHandle>> statements;
+	};
+}
+
+namespace
+{
+	struct SQLitePragma
+	{
+		const char *attribute;
+		const char *pragma;
+		//accepted names separated by |, null for an integer
+		const char *names;
+	};
+
+	//applied in this order, page_size can't change once the database is in WAL mode
+	const SQLitePragma sqlite_pragmas[] = {
+		{ "sqlite_page_size", "page_size", nullptr },
+		{ "sqlite_journal_mode", "journal_mode", "DELETE|TRUNCATE|PERSIST|MEMORY|WAL|OFF" },
+		{ "sqlite_synchronous", "synchronous", "OFF|NORMAL|FULL|EXTRA|0|1|2|3" },
+		{ "sqlite_cache_size", "cache_size", nullptr },
+		{ "sqlite_mmap_size", "mmap_size", nullptr },
+		{ "sqlite_temp_store", "temp_store", "DEFAULT|FILE|MEMORY|0|1|2" },
+	};
+
+	bool IsPragmaName(const std::string &value, const char *names) {
+		std::string upper = value;
+		std::transform(upper.begin(), upper.end(), upper.begin(), [](char c) { return (char)toupper((unsigned char)c); });
+
+		std::string list = std::string("|") + names + "|";
+		return !upper.empty() && list.find("|" + upper + "|") != std::string::npos;
+	}
+
+	bool IsPragmaInteger(const std::string &value) {
+		size_t start = (!value.empty() && value[0] == '-') ? 1 : 0;
+		return value.length() > start && value.length() < 20 &&
+			std::all_of(value.begin() + start, value.end(), [](char c) { return c >= '0' && c <= '9'; });
+	}
+}
+
+DBI::SQLiteDatabaseHandle::SQLiteDatabaseHandle() : m_handle(nullptr), m_do_statement(nullptr), m_do_cache(DefaultDoCacheSize),
+	m_do_reader(nullptr), m_do_reads(DefaultDoCacheSize), m_reader_reads(0), m_reader_fallbacks(0) {
 }
 
 DBI::SQLiteDatabaseHandle::~SQLiteDatabaseHandle() {
@@ -78,6 +128,17 @@ void DBI::SQLiteDatabaseHandle::Connect(std::string dbname, std::string host, st
 		}
 	}
 
+	size_t readers = 0;
+	iter = attr.find("sqlite_readers");
+	if(iter != attr.end()) {
+		readers = static_cast<size_t>(std::stoul(iter->second));
+		if(readers > 0 && (dbname.empty() || dbname.compare(":memory:") == 0 || dbname.find("mode=memory") != std::string::npos)) {
+			throw std::runtime_error("Error sqlite_readers needs a database file, readers would each open their own memory database");
+		}
+	}
+
+	ConfigureDoCache(attr);
+
 	int rc = sqlite3_open_v2(dbname.c_str(), &m_handle, flags, vfs.empty() ? nullptr : vfs.c_str());
 
 	if(rc) {
@@ -85,16 +146,198 @@ void DBI::SQLiteDatabaseHandle::Connect(std::string dbname, std::string host, st
 		Disconnect();
 		throw std::runtime_error(error);
 	}
+
+	try {
+		ConfigurePragmas(m_handle, attr, false);
+		OpenReaders(dbname, flags, vfs, readers, attr);
+	}
+	catch(std::exception&) {
+		Disconnect();
+		throw;
+	}
 }
 
 void DBI::SQLiteDatabaseHandle::Disconnect() {
+	CloseWrites(m_handle != nullptr);
+
+	//statements have to be finalized before the connection will close
+	m_do_statement = nullptr;
+	m_do_uncached.reset();
+	m_do_cache.Clear();
+	m_do_reads.Clear();
+
+	ReleaseDoReader();
+	for(auto &reader : m_readers) {
+		reader->statements.Clear();
+		sqlite3_close(reader->handle);
+	}
+	m_free_readers.clear();
+	m_readers.clear();
+
 	if(m_handle) {
 		sqlite3_close(m_handle);
 		m_handle = nullptr;
 	}
 }
 
-std::unique_ptr<DBI::StatementHandle> DBI::SQLiteDatabaseHandle::Prepare(std::string stmt) {
+void DBI::SQLiteDatabaseHandle::ConfigurePragmas(sqlite3 *handle, DatabaseAttributes &attr, bool reader) {
+	//presets only fill in what the caller didn't set themselves
+	DatabaseAttributes settings;
+	auto iter = attr.find("sqlite_profile");
+	if(iter != attr.end()) {
+		if(iter->second.compare("fast-read") == 0) {
+			settings["sqlite_journal_mode"] = "WAL";
+			settings["sqlite_synchronous"] = "NORMAL";
+			settings["sqlite_cache_size"] = "-65536";
+			settings["sqlite_mmap_size"] = "268435456";
+			settings["sqlite_temp_store"] = "MEMORY";
+			settings["sqlite_busy_timeout"] = "5000";
+		}
+		else if(iter->second.compare("durable-write") == 0) {
+			settings["sqlite_journal_mode"] = "WAL";
+			settings["sqlite_synchronous"] = "FULL";
+			settings["sqlite_cache_size"] = "-16384";
+			settings["sqlite_busy_timeout"] = "5000";
+		}
+		else {
+			throw std::runtime_error("Error unknown sqlite_profile: " + iter->second);
+		}
+	}
+
+	for(auto &setting : attr) {
+		settings[setting.first] = setting.second;
+	}
+
+	//readers only see a consistent snapshot next to a writer in WAL mode
+	iter = settings.find("sqlite_readers");
+	if(!reader && iter != settings.end() && std::stoul(iter->second) > 0 && settings.count("sqlite_journal_mode") == 0) {
+		settings["sqlite_journal_mode"] = "WAL";
+	}
+
+	for(auto &pragma : sqlite_pragmas) {
+		iter = settings.find(pragma.attribute);
+		if(iter == settings.end()) {
+			continue;
+		}
+
+		//the file format settings belong to the writer, read only connections can't change them
+		if(reader && (strcmp(pragma.pragma, "page_size") == 0 || strcmp(pragma.pragma, "journal_mode") == 0)) {
+			continue;
+		}
+
+		//values end up in the statement text so anything unexpected is refused
+		bool valid = pragma.names ? IsPragmaName(iter->second, pragma.names) : IsPragmaInteger(iter->second);
+		if(!valid) {
+			throw std::runtime_error(std::string("Error invalid ") + pragma.attribute + " value: " + iter->second);
+		}
+
+		std::string stmt = std::string("PRAGMA ") + pragma.pragma + " = " + iter->second;
+		if(sqlite3_exec(handle, stmt.c_str(), nullptr, nullptr, nullptr) != SQLITE_OK) {
+			throw std::runtime_error(std::string("Error setting ") + pragma.attribute + ": " + sqlite3_errmsg(handle));
+		}
+	}
+
+	iter = settings.find("sqlite_busy_timeout");
+	if(iter != settings.end()) {
+		if(!IsPragmaInteger(iter->second)) {
+			throw std::runtime_error("Error invalid sqlite_busy_timeout value: " + iter->second);
+		}
+		sqlite3_busy_timeout(handle, static_cast<int>(std::stoi(iter->second)));
+	}
+}
+
+void DBI::SQLiteDatabaseHandle::OpenReaders(const std::string &dbname, int flags, const std::string &vfs, size_t readers,
+	DatabaseAttributes &attr) {
+	flags &= ~(SQLITE_OPEN_READWRITE | SQLITE_OPEN_CREATE);
+	flags |= SQLITE_OPEN_READONLY;
+
+	size_t cache_size = m_do_cache.Capacity() > 0 ? m_do_cache.Capacity() : 1;
+	for(size_t i = 0; i < readers; ++i) {
+		std::unique_ptr<SQLiteReader> reader(new SQLiteReader(cache_size));
+		int rc = sqlite3_open_v2(dbname.c_str(), &reader->handle, flags, vfs.empty() ? nullptr : vfs.c_str());
+		if(rc) {
+			auto error = std::string("Error failed to open reader: ") + sqlite3_errmsg(reader->handle);
+			sqlite3_close(reader->handle);
+			throw std::runtime_error(error);
+		}
+
+		SQLiteReader *opened = reader.get();
+		m_readers.push_back(std::move(reader));
+		m_free_readers.push_back(opened);
+		ConfigurePragmas(opened->handle, attr, true);
+	}
+}
+
+DBI::SQLiteReader *DBI::SQLiteDatabaseHandle::AcquireReader() {
+	std::unique_lock<std::mutex> guard(m_reader_lock);
+	m_reader_available.wait(guard, [this]() { return !m_free_readers.empty(); });
+
+	SQLiteReader *reader = m_free_readers.back();
+	m_free_readers.pop_back();
+	return reader;
+}
+
+DBI::SQLiteReader *DBI::SQLiteDatabaseHandle::TryAcquireReader() {
+	std::lock_guard<std::mutex> guard(m_reader_lock);
+	if(m_free_readers.empty()) {
+		return nullptr;
+	}
+
+	SQLiteReader *reader = m_free_readers.back();
+	m_free_readers.pop_back();
+	return reader;
+}
+
+void DBI::SQLiteDatabaseHandle::ReleaseReader(SQLiteReader *reader) {
+	{
+		std::lock_guard<std::mutex> guard(m_reader_lock);
+		m_free_readers.push_back(reader);
+	}
+	m_reader_available.notify_one();
+}
+
+DBI::SQLiteStatementHandle *DBI::SQLiteDatabaseHandle::FindReaderStatement(SQLiteReader *reader, const std::string &stmt, bool *needs_writer) {
+	auto cached = reader->statements.Get(stmt);
+	if(cached) {
+		return cached->get();
+	}
+
+	sqlite3_stmt *my_stmt = nullptr;
+	int rc = sqlite3_prepare_v2(reader->handle, stmt.c_str(), (int)stmt.length() + 1, &my_stmt, nullptr);
+
+	//BEGIN and friends count as read only too, only statements returning rows go to readers
+	if(rc != SQLITE_OK || !sqlite3_stmt_readonly(my_stmt) || sqlite3_column_count(my_stmt) == 0) {
+		if(needs_writer) {
+			*needs_writer = rc == SQLITE_OK;
+		}
+		if(my_stmt) {
+			sqlite3_finalize(my_stmt);
+		}
+		return nullptr;
+	}
+
+	std::unique_ptr<SQLiteStatementHandle> handle(new SQLiteStatementHandle(reader->handle, my_stmt));
+	handle->m_sql = stmt;
+	return reader->statements.Put(stmt, std::move(handle)).get();
+}
+
+DBI::StatementHandle *DBI::SQLiteDatabaseHandle::ReaderStatement(SQLiteReader *reader, const std::string &stmt) {
+	SQLiteStatementHandle *statement = FindReaderStatement(reader, stmt);
+	if(!statement) {
+		throw std::runtime_error("Read failure: not a read only query: " + stmt);
+	}
+
+	return statement;
+}
+
+void DBI::SQLiteDatabaseHandle::ReleaseDoReader() {
+	if(m_do_reader) {
+		ReleaseReader(m_do_reader);
+		m_do_reader = nullptr;
+	}
+}
+
+std::unique_ptr<DBI::StatementHandle> DBI::SQLiteDatabaseHandle::InternalPrepare(std::string stmt) {
 	sqlite3_stmt *my_stmt = nullptr;
 	int rc = sqlite3_prepare_v2(m_handle, stmt.c_str(), (int)stmt.length() + 1, &my_stmt, nullptr);
 	if(rc != SQLITE_OK) {
@@ -127,97 +370,138 @@ void DBI::SQLiteDatabaseHandle::Rollback() {
 	Do("ROLLBACK");
 }
 
-void DBI::SQLiteDatabaseHandle::BindArg(bool v, int i) {
-	m_do_statement->BindArg(v, i);
+bool DBI::SQLiteDatabaseHandle::InTransaction() const {
+	return m_handle && !sqlite3_get_autocommit(m_handle);
 }
 
-void DBI::SQLiteDatabaseHandle::BindArg(int8_t v, int i)
-{
-	m_do_statement->BindArg(v, i);
+DBI::SQLiteReaderStats DBI::SQLiteDatabaseHandle::ReaderStats() const {
+	SQLiteReaderStats stats;
+	stats.reads = m_reader_reads.load();
+	stats.busy_fallbacks = m_reader_fallbacks.load();
+	return stats;
 }
 
-void DBI::SQLiteDatabaseHandle::BindArg(uint8_t v, int i)
-{
-	m_do_statement->BindArg(v, i);
+DBI::CacheStats DBI::SQLiteDatabaseHandle::DoCacheStats() const {
+	return m_do_cache.Stats();
 }
 
-void DBI::SQLiteDatabaseHandle::BindArg(int16_t v, int i)
-{
-	m_do_statement->BindArg(v, i);
+int DBI::SQLiteDatabaseHandle::ErrorCode() const {
+	return m_handle ? sqlite3_extended_errcode(m_handle) : 0;
 }
 
-void DBI::SQLiteDatabaseHandle::BindArg(uint16_t v, int i)
-{
-	m_do_statement->BindArg(v, i);
+void DBI::SQLiteDatabaseHandle::BindParamBlock(const ParamBlock &params) {
+	m_do_statement->BindParamBlock(params);
 }
 
-void DBI::SQLiteDatabaseHandle::BindArg(int32_t v, int i)
+std::unique_ptr<DBI::ResultSet> DBI::SQLiteDatabaseHandle::ExecuteDo()
 {
-	m_do_statement->BindArg(v, i);
-}
+	if (m_do_reader) {
+		ReaderLease lease(*this, m_do_reader);
+		m_do_reader = nullptr;
+		return m_do_statement->InternalExecute();
+	}
 
-void DBI::SQLiteDatabaseHandle::BindArg(uint32_t v, int i)
-{
-	m_do_statement->BindArg(v, i);
+	auto res = m_do_statement->InternalExecute();
+	m_do_uncached.reset();
+	return res;
 }
 
-void DBI::SQLiteDatabaseHandle::BindArg(int64_t v, int i)
+std::unique_ptr<DBI::AsyncResult> DBI::SQLiteDatabaseHandle::ExecuteDoAsync()
 {
-	m_do_statement->BindArg(v, i);
-}
+	if (m_do_reader) {
+		//the reader stays leased until the worker thread is done with its statement
+		SQLiteReader *reader = m_do_reader;
+		SQLiteStatementHandle *statement = m_do_statement;
+		m_do_reader = nullptr;
+		return std::unique_ptr<AsyncResult>(new ThreadAsyncResult([this, reader, statement]() {
+			ReaderLease lease(*this, reader);
+			return statement->InternalExecute();
+		}));
+	}
 
-void DBI::SQLiteDatabaseHandle::BindArg(uint64_t v, int i)
-{
-	m_do_statement->BindArg(v, i);
+	auto res = m_do_statement->InternalExecuteAsync();
+	if (m_do_uncached) {
+		res->KeepAlive(std::shared_ptr<StatementHandle>(std::move(m_do_uncached)));
+	}
+	return res;
 }
 
-void DBI::SQLiteDatabaseHandle::BindArg(float v, int i)
+void DBI::SQLiteDatabaseHandle::InitDo(const std::string& stmt)
 {
-	m_do_statement->BindArg(v, i);
-}
+	//an earlier Do() that failed while binding may still hold its reader
+	ReleaseDoReader();
+	m_do_statement = nullptr;
+
+	//inside a transaction reads stay on the writer so they see its changes, and when Read() callers
+	//hold every reader the idle writer serves the query rather than this thread waiting
+	bool *known_read = m_do_reads.Get(stmt);
+	if (!m_readers.empty() && sqlite3_get_autocommit(m_handle) && (!known_read || *known_read)) {
+		SQLiteReader *reader = TryAcquireReader();
+		if (!reader) {
+			//only statements a reader would have served count, unclassified ones may be writes
+			if (known_read) {
+				++m_reader_fallbacks;
+			}
+		}
+		else {
+			bool needs_writer = false;
+			SQLiteStatementHandle *statement = FindReaderStatement(reader, stmt, &needs_writer);
+			if (statement) {
+				if (!known_read) {
+					m_do_reads.Put(stmt, true);
+				}
+				m_do_reader = reader;
+				m_do_statement = statement;
+				++m_reader_reads;
+				return;
+			}
 
-void DBI::SQLiteDatabaseHandle::BindArg(double v, int i)
-{
-	m_do_statement->BindArg(v, i);
-}
+			ReleaseReader(reader);
+			//a failed prepare (say the table doesn't exist yet) is tried on a reader again next time
+			if (needs_writer) {
+				m_do_reads.Put(stmt, false);
+			}
+		}
+	}
 
-void DBI::SQLiteDatabaseHandle::BindArg(const std::string &v, int i)
-{
-	m_do_statement->BindArg(v, i);
-}
+	if (m_do_cache.Capacity() > 0) {
+		auto cached = m_do_cache.Get(stmt);
+		if (cached) {
+			m_do_statement = cached->get();
+			return;
+		}
+	}
 
-void DBI::SQLiteDatabaseHandle::BindArg(const char *v, int i)
-{
-	m_do_statement->BindArg(v, i);
-}
+	sqlite3_stmt *my_stmt = nullptr;
+	int rc = sqlite3_prepare_v2(m_handle, stmt.c_str(), (int)stmt.length() + 1, &my_stmt, nullptr);
+	if (rc != SQLITE_OK) {
+		if (my_stmt) {
+			sqlite3_finalize(my_stmt);
+		}
 
-void DBI::SQLiteDatabaseHandle::BindArg(std::nullptr_t v, int i)
-{
-	m_do_statement->BindArg(v, i);
+		std::string err = "Do failure: ";
+		err += sqlite3_errmsg(m_handle);
+		throw std::runtime_error(err);
+	}
+
+	CacheDoStatement(stmt, std::unique_ptr<SQLiteStatementHandle>(new SQLiteStatementHandle(m_handle, my_stmt)));
 }
 
-std::unique_ptr<DBI::ResultSet> DBI::SQLiteDatabaseHandle::ExecuteDo()
+void DBI::SQLiteDatabaseHandle::ConfigureDoCache(DatabaseAttributes &attr)
 {
-	auto res = m_do_statement->InternalExecute();
-	m_do_statement.release();
-	return res;
+	auto iter = attr.find("dbi_do_cache_size");
+	if (iter != attr.end()) {
+		m_do_cache.SetCapacity(static_cast<size_t>(std::stoul(iter->second)));
+	}
 }
 
-void DBI::SQLiteDatabaseHandle::InitDo(const std::string& stmt)
+void DBI::SQLiteDatabaseHandle::CacheDoStatement(const std::string &stmt, std::unique_ptr<SQLiteStatementHandle> handle)
 {
-	if (!m_do_statement) {
-		sqlite3_stmt *my_stmt = nullptr;
-		int rc = sqlite3_prepare_v2(m_handle, stmt.c_str(), (int)stmt.length() + 1, &my_stmt, nullptr);
-		if (rc != SQLITE_OK) {
-			if (my_stmt) {
-				sqlite3_finalize(my_stmt);
-			}
-
-			std::string err = "Do failure: ";
-			err += sqlite3_errmsg(m_handle);
-			throw std::runtime_error(err);
-		}
-
-		m_do_statement.reset(new SQLiteStatementHandle(m_handle, my_stmt));
+	if (m_do_cache.Capacity() > 0) {
+		m_do_statement = m_do_cache.Put(stmt, std::move(handle)).get();
 	}
-}
\ No newline at end of file
+	else {
+		m_do_uncached = std::move(handle);
+		m_do_statement = m_do_uncached.get();
+	}
+}
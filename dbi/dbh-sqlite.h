@@ -1,12 +1,34 @@
 #pragma once
 
 #include "dbh.h"
+#include <vector>
+#include <mutex>
+#include <condition_variable>
+#include <atomic>
 
 struct sqlite3;
 
 namespace DBI
 {
 	class SQLiteStatementHandle;
+	struct SQLiteReader;
+
+	struct SQLiteReaderStats
+	{
+		SQLiteReaderStats() : reads(0), busy_fallbacks(0) { }
+		//queries run on a reader by Do() or Read()
+		uint64_t reads;
+		//read only Do()s run on the writer because every reader was busy
+		uint64_t busy_fallbacks;
+	};
+
+	/*
+		With the "sqlite_readers" attribute set to N the handle also opens N read
+		only connections to the same file (WAL mode is turned on unless a journal
+		mode was given).  Do() runs read only queries on a free reader while no
+		transaction is open, or on the writer rather than wait when none is free.
+		Read() waits for a reader and can be called from any thread.
+	*/
 	class SQLiteDatabaseHandle : public DatabaseHandle
 	{
 	public:
@@ -17,33 +39,79 @@ namespace DBI
 			std::string auth, DatabaseAttributes &attr);
 		virtual void Disconnect();
 	
-		virtual std::unique_ptr<StatementHandle> Prepare(std::string stmt);
-
 		virtual void Ping();
 		virtual void Begin();
 		virtual void Commit();
 		virtual void Rollback();
+		virtual bool InTransaction() const;
+
+		virtual CacheStats DoCacheStats() const;
+
+		virtual int ErrorCode() const;
+
+		//Thread safe with readers, waits for a free one and throws std::runtime_error if stmt isn't a
+		//read only query.  Without readers it is Do() on the calling thread.
+		template<typename... Args>
+		std::unique_ptr<ResultSet> Read(const std::string &stmt, Args... args)
+		{
+			if (m_readers.empty()) {
+				return Do(stmt, args...);
+			}
+
+			ReaderLease lease(*this, AcquireReader());
+			StatementHandle *statement = ReaderStatement(lease.reader, stmt);
+			statement->SetObserver(m_observer);
+			++m_reader_reads;
+			return statement->Execute(args...);
+		}
+
+		size_t Readers() const { return m_readers.size(); }
+		SQLiteReaderStats ReaderStats() const;
 
 	protected:
-		virtual void BindArg(bool v, int i);
-		virtual void BindArg(int8_t v, int i);
-		virtual void BindArg(uint8_t v, int i);
-		virtual void BindArg(int16_t v, int i);
-		virtual void BindArg(uint16_t v, int i);
-		virtual void BindArg(int32_t v, int i);
-		virtual void BindArg(uint32_t v, int i);
-		virtual void BindArg(int64_t v, int i);
-		virtual void BindArg(uint64_t v, int i);
-		virtual void BindArg(float v, int i);
-		virtual void BindArg(double v, int i);
-		virtual void BindArg(const std::string &v, int i);
-		virtual void BindArg(const char *v, int i);
-		virtual void BindArg(std::nullptr_t v, int i);
+		struct ReaderLease
+		{
+			ReaderLease(SQLiteDatabaseHandle &dbh_, SQLiteReader *reader_) : dbh(dbh_), reader(reader_) { }
+			~ReaderLease() { dbh.ReleaseReader(reader); }
+
+			SQLiteDatabaseHandle &dbh;
+			SQLiteReader *reader;
+		};
+
+		virtual void BindParamBlock(const ParamBlock &params);
+		virtual std::unique_ptr<StatementHandle> InternalPrepare(std::string stmt);
 		virtual std::unique_ptr<ResultSet> ExecuteDo();
+		virtual std::unique_ptr<AsyncResult> ExecuteDoAsync();
 		virtual void InitDo(const std::string& stmt);
+		void ConfigureDoCache(DatabaseAttributes &attr);
+		//sqlite_profile ("fast-read" or "durable-write") and the sqlite_* pragma attributes
+		void ConfigurePragmas(sqlite3 *handle, DatabaseAttributes &attr, bool reader);
+		void OpenReaders(const std::string &dbname, int flags, const std::string &vfs, size_t readers, DatabaseAttributes &attr);
+		SQLiteReader *AcquireReader();
+		//Null instead of waiting when every reader is leased.
+		SQLiteReader *TryAcquireReader();
+		void ReleaseReader(SQLiteReader *reader);
+		//Reader's cached statement for stmt, null if it isn't a read only query.  needs_writer is set
+		//when stmt prepared but isn't a read, it stays false when the prepare itself failed.
+		SQLiteStatementHandle *FindReaderStatement(SQLiteReader *reader, const std::string &stmt, bool *needs_writer = nullptr);
+		StatementHandle *ReaderStatement(SQLiteReader *reader, const std::string &stmt);
+		void ReleaseDoReader();
+		void CacheDoStatement(const std::string &stmt, std::unique_ptr<SQLiteStatementHandle> handle);
 
 		sqlite3 *m_handle;
-		std::unique_ptr<SQLiteStatementHandle> m_do_statement;
+		SQLiteStatementHandle *m_do_statement;
+		std::unique_ptr<SQLiteStatementHandle> m_do_uncached;
+		LRUCache<std::string, std::unique_ptr<SQLiteStatementHandle>> m_do_cache;
+		std::vector<std::unique_ptr<SQLiteReader>> m_readers;
+		std::vector<SQLiteReader*> m_free_readers;
+		std::mutex m_reader_lock;
+		std::condition_variable m_reader_available;
+		//reader the current Do() statement belongs to, null when it runs on the writer
+		SQLiteReader *m_do_reader;
+		//Do() statements a reader has classified, true for reads and false for ones needing the writer
+		LRUCache<std::string, bool> m_do_reads;
+		std::atomic<uint64_t> m_reader_reads;
+		std::atomic<uint64_t> m_reader_fallbacks;
 	};
 }
 
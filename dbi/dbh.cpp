@@ -1 +1,300 @@
+/*
+	Copyright(C) 2014 EQEmu
 
+	This program is free software; you can redistribute it and/or
+	modify it under the terms of the GNU General Public License
+	as published by the Free Software Foundation; either version 2
+	of the License, or (at your option) any later version.
+
+	This program is distributed in the hope that it will be useful,
+	but WITHOUT ANY WARRANTY; without even the implied warranty of
+	MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+	GNU General Public License for more details.
+
+	You should have received a copy of the GNU General Public License
+	along with this program; if not, write to the Free Software
+	Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+*/
+#include "dbh.h"
+
+DBI::DatabaseHandle::~DatabaseHandle()
+{
+	//backends flush in Disconnect(), this only catches what one left behind
+	FailWrites("Write Error: handle destroyed before the write was flushed");
+}
+
+void DBI::DatabaseHandle::EnableWriteCoalescing(size_t max_statements, unsigned int max_delay_ms)
+{
+	m_write_max_statements = max_statements > 0 ? max_statements : 1;
+	m_write_max_delay_ms = max_delay_ms;
+}
+
+void DBI::DatabaseHandle::DisableWriteCoalescing()
+{
+	FlushWrites();
+	m_write_max_statements = 0;
+}
+
+size_t DBI::DatabaseHandle::FlushWrites()
+{
+	if (m_writes.empty()) {
+		return 0;
+	}
+
+	std::vector<DeferredWrite> writes;
+	writes.swap(m_writes);
+
+	//a single statement gains nothing from the extra round trips, and inside the caller's transaction
+	//Begin() would fail or commit it early and the Rollback() below would undo the caller's work
+	bool committed = false;
+	std::vector<size_t> affected(writes.size(), 0);
+	if (writes.size() > 1 && !InTransaction()) {
+		try {
+			Begin();
+			for (size_t i = 0; i < writes.size(); ++i) {
+				affected[i] = writes[i].run()->AffectedRows();
+			}
+			Commit();
+			committed = true;
+		}
+		catch (std::exception&) {
+			try {
+				Rollback();
+			}
+			catch (std::exception&) {
+			}
+			m_write_stats.fallbacks++;
+		}
+	}
+
+	m_write_stats.statements += writes.size();
+	if (committed) {
+		m_write_stats.flushes++;
+		for (size_t i = 0; i < writes.size(); ++i) {
+			if (writes[i].callback) {
+				writes[i].callback(affected[i], std::string());
+			}
+		}
+	}
+	else {
+		for (auto &write : writes) {
+			RunDeferredWrite(write);
+		}
+	}
+
+	return writes.size();
+}
+
+void DBI::DatabaseHandle::CloseWrites(bool connected)
+{
+	if (!connected) {
+		FailWrites("Write Error: not connected");
+		return;
+	}
+
+	//may run from a destructor, nothing can be thrown out of here
+	try {
+		FlushWrites();
+	}
+	catch (...) {
+	}
+	FailWrites("Write Error: flush failed while disconnecting");
+}
+
+void DBI::DatabaseHandle::FailWrites(const std::string &error)
+{
+	std::vector<DeferredWrite> writes;
+	writes.swap(m_writes);
+	for (auto &write : writes) {
+		if (write.callback) {
+			try {
+				write.callback(0, error);
+			}
+			catch (...) {
+			}
+		}
+	}
+}
+
+void DBI::DatabaseHandle::PollWrites()
+{
+	if (!m_writes.empty() && std::chrono::steady_clock::now() - m_first_write >= std::chrono::milliseconds(m_write_max_delay_ms)) {
+		FlushWrites();
+	}
+}
+
+void DBI::DatabaseHandle::AddDeferredWrite(DeferredWrite write)
+{
+	if (m_write_max_statements == 0) {
+		RunDeferredWrite(write);
+		return;
+	}
+
+	if (m_writes.empty()) {
+		m_first_write = std::chrono::steady_clock::now();
+	}
+	m_writes.push_back(std::move(write));
+
+	if (m_writes.size() >= m_write_max_statements) {
+		FlushWrites();
+	}
+	else {
+		PollWrites();
+	}
+}
+
+void DBI::DatabaseHandle::RunDeferredWrite(DeferredWrite &write)
+{
+	size_t affected = 0;
+	std::string error;
+	try {
+		affected = write.run()->AffectedRows();
+	}
+	catch (std::exception &ex) {
+		error = ex.what();
+	}
+
+	if (write.callback) {
+		write.callback(affected, error);
+	}
+}
+
+std::unique_ptr<DBI::StatementHandle> DBI::DatabaseHandle::Prepare(std::string stmt)
+{
+	return PrepareStatement(stmt, [this, &stmt]() { return InternalPrepare(stmt); });
+}
+
+std::unique_ptr<DBI::StatementHandle> DBI::DatabaseHandle::PrepareStatement(const std::string &stmt,
+	const std::function<std::unique_ptr<StatementHandle>()> &prepare)
+{
+	std::shared_ptr<QueryObserver> observer = m_observer;
+	QueryClock::time_point start;
+	if (observer) {
+		start = QueryClock::now();
+	}
+
+	std::unique_ptr<StatementHandle> sth;
+	try {
+		sth = prepare();
+	}
+	catch (...) {
+		if (observer) {
+			ReportQueryError(*observer, QueryEvent::PhasePrepare, stmt, start, ErrorCode());
+		}
+		throw;
+	}
+
+	sth->m_sql = stmt;
+	sth->m_observer = observer;
+	sth->m_result_cache = m_result_cache;
+	if (observer) {
+		ReportQuery(*observer, QueryEvent::PhasePrepare, stmt, start, 0, 0);
+	}
+	return sth;
+}
+
+DBI::QueryClock::time_point DBI::DatabaseHandle::ObservedInitDo(QueryObserver &observer, const std::string &stmt,
+	const ParamBlock *params)
+{
+	QueryClock::time_point start = QueryClock::now();
+	try {
+		InitDo(stmt);
+	}
+	catch (...) {
+		ReportQueryError(observer, QueryEvent::PhasePrepare, stmt, start, ErrorCode());
+		throw;
+	}
+	start = ReportQuery(observer, QueryEvent::PhasePrepare, stmt, start, 0, 0);
+
+	if (!params) {
+		return start;
+	}
+
+	try {
+		BindParamBlock(*params);
+	}
+	catch (...) {
+		ReportQueryError(observer, QueryEvent::PhaseBind, stmt, start, ErrorCode());
+		throw;
+	}
+	return ReportQuery(observer, QueryEvent::PhaseBind, stmt, start, 0, 0);
+}
+
+std::unique_ptr<DBI::ResultSet> DBI::DatabaseHandle::HookedDo(const std::string &stmt, const ParamBlock *params)
+{
+	std::shared_ptr<ResultCache> cache = m_result_cache;
+	std::unique_ptr<ResultSet> rs;
+	if (m_observer) {
+		rs = ObservedDo(stmt, params);
+	}
+	else {
+		InitDo(stmt);
+		if (params) {
+			BindParamBlock(*params);
+		}
+		rs = ExecuteDo();
+	}
+
+	if (cache) {
+		cache->Invalidate(stmt);
+	}
+	return rs;
+}
+
+std::unique_ptr<DBI::AsyncResult> DBI::DatabaseHandle::HookedDoAsync(const std::string &stmt, const ParamBlock *params)
+{
+	std::shared_ptr<ResultCache> cache = m_result_cache;
+	std::unique_ptr<AsyncResult> result;
+	if (m_observer) {
+		result = ObservedDoAsync(stmt, params);
+	}
+	else {
+		InitDo(stmt);
+		if (params) {
+			BindParamBlock(*params);
+		}
+		result = ExecuteDoAsync();
+	}
+
+	if (cache) {
+		result->InvalidateWhenDone(cache, stmt);
+	}
+	return result;
+}
+
+std::unique_ptr<DBI::ResultSet> DBI::DatabaseHandle::ObservedDo(const std::string &stmt, const ParamBlock *params)
+{
+	//the observer could be swapped out from under us by a callback
+	std::shared_ptr<QueryObserver> observer = m_observer;
+	QueryClock::time_point start = ObservedInitDo(*observer, stmt, params);
+
+	std::unique_ptr<ResultSet> rs;
+	try {
+		rs = ExecuteDo();
+	}
+	catch (...) {
+		ReportQueryError(*observer, QueryEvent::PhaseExecute, stmt, start, ErrorCode());
+		throw;
+	}
+
+	ReportQuery(*observer, QueryEvent::PhaseExecute, stmt, start, rs.get());
+	return rs;
+}
+
+std::unique_ptr<DBI::AsyncResult> DBI::DatabaseHandle::ObservedDoAsync(const std::string &stmt, const ParamBlock *params)
+{
+	std::shared_ptr<QueryObserver> observer = m_observer;
+	QueryClock::time_point start = ObservedInitDo(*observer, stmt, params);
+
+	std::unique_ptr<AsyncResult> result;
+	try {
+		result = ExecuteDoAsync();
+	}
+	catch (...) {
+		ReportQueryError(*observer, QueryEvent::PhaseExecute, stmt, start, ErrorCode());
+		throw;
+	}
+
+	result->Observe(observer, stmt, start);
+	return result;
+}
@@ -6,33 +6,64 @@
 #include <vector>
 #include <list>
 #include <map>
+#include <tuple>
+#include <functional>
+#include <chrono>
 
 #include "rs.h"
 #include "sth.h"
+#include "lru-cache.h"
+#include "result-cache.h"
 
 namespace DBI
 {
 	typedef std::map<std::string, std::string> DatabaseAttributes;
 	class StatementHandle;
 	class ResultSet;
+
+	struct WriteCoalescingStats
+	{
+		WriteCoalescingStats() : flushes(0), statements(0), fallbacks(0) { }
+		//transactions committed by FlushWrites()
+		uint64_t flushes;
+		uint64_t statements;
+		//flushes that failed and were replayed one statement at a time
+		uint64_t fallbacks;
+	};
+
 	class DatabaseHandle
 	{
 	public:
-		DatabaseHandle() { }
-		virtual ~DatabaseHandle() { }
+		//affected_rows is 0 and error set if the statement failed
+		typedef std::function<void(size_t affected_rows, const std::string &error)> WriteCallback;
+
+		DatabaseHandle() : m_write_max_statements(0), m_write_max_delay_ms(0) { }
+		virtual ~DatabaseHandle();
 	
 		virtual void Connect(std::string dbname, std::string host, std::string username,
 			std::string auth, DatabaseAttributes &attr) = 0;
 		virtual void Disconnect() = 0;
 
-		virtual std::unique_ptr<StatementHandle> Prepare(std::string stmt) = 0;
+		//Reported to the observer as a prepare phase, the statement inherits the observer.
+		std::unique_ptr<StatementHandle> Prepare(std::string stmt);
 
 		virtual void Ping() = 0;
 		virtual void Begin() = 0;
 		virtual void Commit() = 0;
 		virtual void Rollback() = 0;
+		//True while Begin() or a BEGIN run through Do() has a transaction open.
+		virtual bool InTransaction() const = 0;
+
+		//Counters for the statements Do() keeps prepared, keyed on the SQL text.
+		//Capacity is set with the "dbi_do_cache_size" attribute, 0 disables it.
+		virtual CacheStats DoCacheStats() const = 0;
+
+		static const size_t DefaultDoCacheSize = 64;
 
 		std::unique_ptr<ResultSet> Do(const std::string &stmt) {
+			if (m_observer || m_result_cache) {
+				return HookedDo(stmt, nullptr);
+			}
 			InitDo(stmt);
 			return ExecuteDo();
 		}
@@ -40,39 +71,170 @@ namespace DBI
 		template<typename T, typename... Args>
 		std::unique_ptr<ResultSet> Do(const std::string &stmt, T value, Args... args)
 		{
-			InitDo(stmt);
-			BindArg(value, 1);
-			return _Do(2, args...);
+			Param params[] = { Param(value), Param(args)... };
+			return DoBound(stmt, ParamBlock(params, sizeof...(Args) + 1));
 		}
 
-	protected:
-		std::unique_ptr<ResultSet> _Do(int i) {
+		//Do() with params packed by the caller, they only need to live until it returns.
+		std::unique_ptr<ResultSet> DoBound(const std::string &stmt, const ParamBlock &params) {
+			if (m_observer || m_result_cache) {
+				return HookedDo(stmt, &params);
+			}
+			InitDo(stmt);
+			BindParamBlock(params);
 			return ExecuteDo();
 		}
 
+		//Do() through the result cache, see ResultCache.  Runs Do() when there is none.
+		template<typename... Args>
+		std::shared_ptr<const ResultSet> DoCached(const std::string &stmt, Args... args)
+		{
+			std::shared_ptr<ResultCache> cache = m_result_cache;
+			if (!cache) {
+				return std::shared_ptr<const ResultSet>(Do(stmt, args...));
+			}
+
+			std::string key = ResultCache::Key(stmt, args...);
+			std::shared_ptr<const ResultSet> rs = cache->Get(key);
+			if (!rs) {
+				uint64_t generation = cache->Generation();
+				rs = Do(stmt, args...);
+				cache->Put(stmt, key, rs, generation);
+			}
+			return rs;
+		}
+
+		//Do() that returns right away, see AsyncResult.  The handle can't be used until the result is ready.
+		std::unique_ptr<AsyncResult> DoAsync(const std::string &stmt) {
+			if (m_observer || m_result_cache) {
+				return HookedDoAsync(stmt, nullptr);
+			}
+			InitDo(stmt);
+			return ExecuteDoAsync();
+		}
+
 		template<typename T, typename... Args>
-		std::unique_ptr<ResultSet> _Do(int i, T value, Args... args)
+		std::unique_ptr<AsyncResult> DoAsync(const std::string &stmt, T value, Args... args)
 		{
-			BindArg(value, i);
-			return _Do(i + 1, args...);
+			Param params[] = { Param(value), Param(args)... };
+			ParamBlock block(params, sizeof...(Args) + 1);
+			if (m_observer || m_result_cache) {
+				return HookedDoAsync(stmt, &block);
+			}
+			InitDo(stmt);
+			BindParamBlock(block);
+			return ExecuteDoAsync();
 		}
 
-		virtual void BindArg(bool v, int i) = 0;
-		virtual void BindArg(int8_t v, int i) = 0;
-		virtual void BindArg(uint8_t v, int i) = 0;
-		virtual void BindArg(int16_t v, int i) = 0;
-		virtual void BindArg(uint16_t v, int i) = 0;
-		virtual void BindArg(int32_t v, int i) = 0;
-		virtual void BindArg(uint32_t v, int i) = 0;
-		virtual void BindArg(int64_t v, int i) = 0;
-		virtual void BindArg(uint64_t v, int i) = 0;
-		virtual void BindArg(float v, int i) = 0;
-		virtual void BindArg(double v, int i) = 0;
-		virtual void BindArg(const std::string &v, int i) = 0;
-		virtual void BindArg(const char *v, int i) = 0;
-		virtual void BindArg(std::nullptr_t v, int i) = 0;
+		/*
+			Group commit for writes.  Once enabled DoDeferred() buffers statements
+			and FlushWrites() runs them in one transaction, which happens on its own
+			once max_statements are buffered or the oldest is max_delay_ms old (checked
+			by DoDeferred() and PollWrites()).  If the transaction fails every
+			statement is replayed on its own so only the bad ones report errors.
+			A flush while the caller has a transaction open runs the statements in
+			it, they commit or roll back with the caller's work.  Nothing buffered
+			is visible to Do() until flushed, Disconnect() flushes what is left.
+		*/
+		void EnableWriteCoalescing(size_t max_statements, unsigned int max_delay_ms);
+
+		//Flushes what is buffered, DoDeferred() runs statements right away after this.
+		void DisableWriteCoalescing();
+
+		//Buffers stmt for the next flush, or runs it now when coalescing is off.  callback may be null.
+		template<typename... Args>
+		void DoDeferred(WriteCallback callback, const std::string &stmt, Args... args)
+		{
+			std::tuple<typename StoredArg<Args>::type...> stored(args...);
+			DeferredWrite write;
+			write.run = [this, stmt, stored]() {
+				return DoStored(stmt, stored, typename MakeIndexSequence<sizeof...(Args)>::type());
+			};
+			write.callback = callback;
+			AddDeferredWrite(std::move(write));
+		}
+
+		//Runs every buffered statement, returns how many there were.
+		size_t FlushWrites();
+
+		//Flushes if the oldest buffered statement has waited max_delay_ms, call it from a timer or main loop.
+		void PollWrites();
+
+		size_t PendingWrites() const { return m_writes.size(); }
+
+		WriteCoalescingStats WriteStats() const { return m_write_stats; }
+
+		//Sees every statement run through this handle from now on, see QueryObserver.  Statements
+		//prepared earlier keep the observer they had, null turns reporting off.
+		void SetObserver(std::shared_ptr<QueryObserver> observer) { m_observer = observer; }
+		const std::shared_ptr<QueryObserver> &Observer() const { return m_observer; }
+
+		//Results of DoCached() and ExecuteCached() are kept in cache, which drops them when a statement
+		//run through this handle writes to their tables.  Statements prepared earlier keep the cache they
+		//had, null turns caching off.
+		void SetResultCache(std::shared_ptr<ResultCache> cache) { m_result_cache = cache; }
+		const std::shared_ptr<ResultCache> &GetResultCache() const { return m_result_cache; }
+
+		//Backend code of the last error, see QueryEvent::error_code.
+		virtual int ErrorCode() const { return 0; }
+
+	protected:
+		struct DeferredWrite
+		{
+			DeferredWrite() { }
+			DeferredWrite(DeferredWrite &&other) : run(std::move(other.run)), callback(std::move(other.callback)) { }
+			DeferredWrite &operator=(DeferredWrite &&other) {
+				run = std::move(other.run);
+				callback = std::move(other.callback);
+				return *this;
+			}
+
+			std::function<std::unique_ptr<ResultSet>()> run;
+			WriteCallback callback;
+		};
+
+		//Runs prepare as the prepare phase and hands the statement its SQL and the observer.
+		std::unique_ptr<StatementHandle> PrepareStatement(const std::string &stmt,
+			const std::function<std::unique_ptr<StatementHandle>()> &prepare);
+
+		//Do() and DoAsync() when there is an observer or a result cache to tell about writes, params is
+		//null without any.
+		std::unique_ptr<ResultSet> HookedDo(const std::string &stmt, const ParamBlock *params);
+		std::unique_ptr<AsyncResult> HookedDoAsync(const std::string &stmt, const ParamBlock *params);
+		//Do() and DoAsync() with each phase reported to m_observer.
+		std::unique_ptr<ResultSet> ObservedDo(const std::string &stmt, const ParamBlock *params);
+		std::unique_ptr<AsyncResult> ObservedDoAsync(const std::string &stmt, const ParamBlock *params);
+		//InitDo() and binding params as the prepare and bind phases, returns when they finished.
+		QueryClock::time_point ObservedInitDo(QueryObserver &observer, const std::string &stmt, const ParamBlock *params);
+
+		void AddDeferredWrite(DeferredWrite write);
+		static void RunDeferredWrite(DeferredWrite &write);
+		//Called first thing by the backends' Disconnect(), flushes what is buffered while the
+		//connection is still there or fails every callback if there is none.
+		void CloseWrites(bool connected);
+		void FailWrites(const std::string &error);
+
+		template<typename Tuple, size_t... I>
+		std::unique_ptr<ResultSet> DoStored(const std::string &stmt, const Tuple &args, IndexSequence<I...>)
+		{
+			return Do(stmt, std::get<I>(args)...);
+		}
+
+		//Binds params to the statement InitDo() set up, in one call rather than one per param.
+		virtual void BindParamBlock(const ParamBlock &params) = 0;
+		virtual std::unique_ptr<StatementHandle> InternalPrepare(std::string stmt) = 0;
 		virtual std::unique_ptr<ResultSet> ExecuteDo() = 0;
+		virtual std::unique_ptr<AsyncResult> ExecuteDoAsync() = 0;
 		virtual void InitDo(const std::string& stmt) = 0;
+
+		//0 when write coalescing is off
+		size_t m_write_max_statements;
+		unsigned int m_write_max_delay_ms;
+		std::vector<DeferredWrite> m_writes;
+		std::chrono::steady_clock::time_point m_first_write;
+		WriteCoalescingStats m_write_stats;
+		std::shared_ptr<QueryObserver> m_observer;
+		std::shared_ptr<ResultCache> m_result_cache;
 	};
 }
 
@@ -0,0 +1,208 @@
+/*
+	Copyright(C) 2014 EQEmu
+
+	This program is free software; you can redistribute it and/or
+	modify it under the terms of the GNU General Public License
+	as published by the Free Software Foundation; either version 2
+	of the License, or (at your option) any later version.
+
+	This program is distributed in the hope that it will be useful,
+	but WITHOUT ANY WARRANTY; without even the implied warranty of
+	MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+	GNU General Public License for more details.
+
+	You should have received a copy of the GNU General Public License
+	along with this program; if not, write to the Free Software
+	Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+*/
+#include "executor.h"
+#include <stdexcept>
+
+void DBI::CompletionQueue::Push(Completion completion)
+{
+	{
+		std::lock_guard<std::mutex> guard(m_lock);
+		m_completions.push_back(std::move(completion));
+	}
+	m_available.notify_one();
+}
+
+bool DBI::CompletionQueue::TryPop(Completion &completion)
+{
+	std::lock_guard<std::mutex> guard(m_lock);
+	if (m_completions.empty()) {
+		return false;
+	}
+
+	completion = std::move(m_completions.front());
+	m_completions.pop_front();
+	return true;
+}
+
+bool DBI::CompletionQueue::Pop(Completion &completion, unsigned int timeout_ms)
+{
+	std::unique_lock<std::mutex> guard(m_lock);
+	if (!m_available.wait_for(guard, std::chrono::milliseconds(timeout_ms), [this]() { return !m_completions.empty(); })) {
+		return false;
+	}
+
+	completion = std::move(m_completions.front());
+	m_completions.pop_front();
+	return true;
+}
+
+size_t DBI::CompletionQueue::Dispatch()
+{
+	std::deque<Completion> completions;
+	{
+		std::lock_guard<std::mutex> guard(m_lock);
+		completions.swap(m_completions);
+	}
+
+	//callbacks run unlocked so they can submit more work
+	for (auto &completion : completions) {
+		if (completion.callback) {
+			completion.callback(completion);
+		}
+	}
+
+	return completions.size();
+}
+
+size_t DBI::CompletionQueue::Size() const
+{
+	std::lock_guard<std::mutex> guard(m_lock);
+	return m_completions.size();
+}
+
+DBI::Executor::Executor(DatabaseFactory factory, std::string dbname, std::string host, std::string username,
+	std::string auth, const DatabaseAttributes &attr, size_t workers, CompletionQueue *completions)
+	: m_completions(completions), m_next_id(1), m_next_worker(0), m_pending(0), m_stopping(false)
+{
+	if (workers == 0) {
+		workers = 1;
+	}
+
+	//every connection is made before any thread starts so a failure has nothing to stop
+	DatabaseAttributes conn_attr = attr;
+	for (size_t i = 0; i < workers; ++i) {
+		std::unique_ptr<Worker> worker(new Worker());
+		worker->handle = factory();
+		worker->handle->Connect(dbname, host, username, auth, conn_attr);
+		m_workers.push_back(std::move(worker));
+	}
+
+	for (auto &worker : m_workers) {
+		worker->thread = std::thread(&Executor::Run, this, std::ref(*worker));
+	}
+}
+
+DBI::Executor::~Executor()
+{
+	m_stopping.store(true);
+	for (auto &worker : m_workers) {
+		{
+			std::lock_guard<std::mutex> guard(worker->lock);
+		}
+		worker->wake.notify_one();
+	}
+
+	for (auto &worker : m_workers) {
+		worker->thread.join();
+		worker->handle->Disconnect();
+	}
+}
+
+uint64_t DBI::Executor::Submit(uint64_t key, Work work, CompletionQueue::Callback callback)
+{
+	return Enqueue(*m_workers[key % m_workers.size()], work, callback);
+}
+
+uint64_t DBI::Executor::Submit(Work work, CompletionQueue::Callback callback)
+{
+	return Enqueue(*m_workers[m_next_worker++ % m_workers.size()], work, callback);
+}
+
+uint64_t DBI::Executor::Enqueue(Worker &worker, Work work, CompletionQueue::Callback callback)
+{
+	Job job;
+	job.id = m_next_id++;
+	job.work = work;
+	job.callback = callback;
+
+	uint64_t id = job.id;
+	++m_pending;
+	worker.jobs.Push(std::move(job));
+
+	//pairs with the worker setting sleeping before its last look at the queue
+	if (worker.sleeping.load()) {
+		{
+			std::lock_guard<std::mutex> guard(worker.lock);
+		}
+		worker.wake.notify_one();
+	}
+
+	return id;
+}
+
+void DBI::Executor::Run(Worker &worker)
+{
+	Job job;
+	for (;;) {
+		if (worker.jobs.Pop(job)) {
+			RunJob(worker, job);
+			continue;
+		}
+
+		std::unique_lock<std::mutex> guard(worker.lock);
+		worker.sleeping.store(true);
+		if (!worker.jobs.Empty()) {
+			worker.sleeping.store(false);
+			continue;
+		}
+
+		//only reached once the queue is drained, nothing may be submitted while the executor is destroyed
+		if (m_stopping.load()) {
+			worker.sleeping.store(false);
+			return;
+		}
+
+		worker.wake.wait(guard);
+		worker.sleeping.store(false);
+	}
+}
+
+void DBI::Executor::RunJob(Worker &worker, Job &job)
+{
+	CompletionQueue::Completion completion;
+	completion.id = job.id;
+	completion.callback = std::move(job.callback);
+
+	try {
+		completion.result_set = job.work(*worker.handle);
+	}
+	catch (std::exception &ex) {
+		completion.error = ex.what();
+		if (completion.error.empty()) {
+			completion.error = "Executor Error: job failed";
+		}
+	}
+	catch (...) {
+		//anything escaping the worker thread would terminate the process
+		completion.error = "Executor Error: job failed with an unknown exception";
+	}
+
+	job.work = nullptr;
+	if (m_completions) {
+		m_completions->Push(std::move(completion));
+	}
+	else if (completion.callback) {
+		//with no queue to hand it to the callback is the only way the caller hears back
+		try {
+			completion.callback(completion);
+		}
+		catch (...) {
+		}
+	}
+	--m_pending;
+}
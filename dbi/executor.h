@@ -0,0 +1,165 @@
+#pragma once
+
+#include <stdint.h>
+#include <cstddef>
+#include <string>
+#include <memory>
+#include <vector>
+#include <deque>
+#include <tuple>
+#include <functional>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <atomic>
+
+#include "dbh.h"
+#include "pool.h"
+#include "mpsc-queue.h"
+
+namespace DBI
+{
+
+	/*
+		Thread safe queue an Executor hands finished jobs to.  The owner drains it
+		from its own thread with TryPop()/Pop() or runs the job callbacks with
+		Dispatch().
+	*/
+	class CompletionQueue
+	{
+	public:
+		struct Completion;
+		typedef std::function<void(Completion &completion)> Callback;
+
+		struct Completion
+		{
+			Completion() : id(0) { }
+			Completion(Completion &&other) : id(other.id), result_set(std::move(other.result_set)), error(std::move(other.error)),
+				callback(std::move(other.callback)) { }
+			Completion &operator=(Completion &&other) {
+				id = other.id;
+				result_set = std::move(other.result_set);
+				error = std::move(other.error);
+				callback = std::move(other.callback);
+				return *this;
+			}
+
+			bool Ok() const { return error.empty(); }
+
+			//id returned by Submit()/Do()
+			uint64_t id;
+			//null if the job failed or returned none
+			std::unique_ptr<ResultSet> result_set;
+			std::string error;
+			Callback callback;
+		};
+
+		void Push(Completion completion);
+
+		bool TryPop(Completion &completion);
+
+		//Waits up to timeout_ms for a completion, false if none arrived.
+		bool Pop(Completion &completion, unsigned int timeout_ms);
+
+		//Pops everything queued and runs each callback, returns how many completions were popped.
+		size_t Dispatch();
+
+		size_t Size() const;
+
+	private:
+		mutable std::mutex m_lock;
+		std::condition_variable m_available;
+		std::deque<Completion> m_completions;
+	};
+
+	/*
+		Owns one connection and one thread per worker and runs jobs on them.  Jobs
+		submitted with the same key always run on the same worker in submit order,
+		so everything for one character can be keyed on its id.  Finished jobs go
+		to the completion queue if one was given, otherwise their callbacks run on
+		the worker thread and results without one are dropped.  The destructor
+		runs every job already submitted before returning.
+	*/
+	class Executor
+	{
+	public:
+		typedef std::function<std::unique_ptr<ResultSet>(DatabaseHandle &dbh)> Work;
+
+		//Connects every worker up front, throws std::runtime_error if one can't connect.
+		Executor(DatabaseFactory factory, std::string dbname, std::string host, std::string username,
+			std::string auth, const DatabaseAttributes &attr, size_t workers, CompletionQueue *completions = nullptr);
+		~Executor();
+
+		//Runs work on the worker key maps to and returns the job id.
+		uint64_t Submit(uint64_t key, Work work, CompletionQueue::Callback callback = nullptr);
+
+		//Runs work on the next worker in turn, for jobs with no ordering needs.
+		uint64_t Submit(Work work, CompletionQueue::Callback callback = nullptr);
+
+		//Submit() of DatabaseHandle::Do(sql, args...), string args are copied.
+		template<typename... Args>
+		uint64_t Do(uint64_t key, const std::string &sql, Args... args)
+		{
+			std::tuple<typename StoredArg<Args>::type...> stored(args...);
+			return Submit(key, [sql, stored](DatabaseHandle &dbh) {
+				return DoStored(dbh, sql, stored, typename MakeIndexSequence<sizeof...(Args)>::type());
+			});
+		}
+
+		size_t Workers() const { return m_workers.size(); }
+
+		//Jobs submitted but not finished yet.
+		size_t Pending() const { return m_pending.load(); }
+
+		Executor(const Executor&) = delete;
+		Executor &operator=(const Executor&) = delete;
+
+	private:
+		struct Job
+		{
+			Job() : id(0) { }
+			Job(Job &&other) : id(other.id), work(std::move(other.work)), callback(std::move(other.callback)) { }
+			Job &operator=(Job &&other) {
+				id = other.id;
+				work = std::move(other.work);
+				callback = std::move(other.callback);
+				return *this;
+			}
+
+			uint64_t id;
+			Work work;
+			CompletionQueue::Callback callback;
+		};
+
+		struct Worker
+		{
+			Worker() : sleeping(false) { }
+
+			std::unique_ptr<DatabaseHandle> handle;
+			MPSCQueue<Job> jobs;
+			std::thread thread;
+			//set while the thread waits on wake, producers only take the lock then
+			std::atomic<bool> sleeping;
+			std::mutex lock;
+			std::condition_variable wake;
+		};
+
+		template<typename Tuple, size_t... I>
+		static std::unique_ptr<ResultSet> DoStored(DatabaseHandle &dbh, const std::string &sql, const Tuple &args, IndexSequence<I...>)
+		{
+			return dbh.Do(sql, std::get<I>(args)...);
+		}
+
+		uint64_t Enqueue(Worker &worker, Work work, CompletionQueue::Callback callback);
+		void Run(Worker &worker);
+		void RunJob(Worker &worker, Job &job);
+
+		std::vector<std::unique_ptr<Worker>> m_workers;
+		CompletionQueue *m_completions;
+		std::atomic<uint64_t> m_next_id;
+		std::atomic<size_t> m_next_worker;
+		std::atomic<size_t> m_pending;
+		std::atomic<bool> m_stopping;
+	};
+
+}
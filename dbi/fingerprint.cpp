@@ -0,0 +1,365 @@
+/*
+	Copyright(C) 2014 EQEmu
+
+	This program is free software; you can redistribute it and/or
+	modify it under the terms of the GNU General Public License
+	as published by the Free Software Foundation; either version 2
+	of the License, or (at your option) any later version.
+
+	This program is distributed in the hope that it will be useful,
+	but WITHOUT ANY WARRANTY; without even the implied warranty of
+	MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+	GNU General Public License for more details.
+
+	You should have received a copy of the GNU General Public License
+	along with this program; if not, write to the Free Software
+	Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+*/
+#include "fingerprint.h"
+#include <string.h>
+
+namespace
+{
+	bool IsSpace(char c) {
+		return c == ' ' || c == '\t' || c == '\r' || c == '\n' || c == '\f' || c == '\v';
+	}
+
+	bool IsDigit(char c) {
+		return c >= '0' && c <= '9';
+	}
+
+	//Whether the fingerprint puts a space between two tokens, decided by the tokens alone so
+	//any spacing in the original collapses to the same text.
+	bool NeedsSpace(DBI::SQLToken::Type last, char last_char, DBI::SQLToken::Type type, char first) {
+		if (type == DBI::SQLToken::TokenPunctuation && first != '(') {
+			return false;
+		}
+
+		if (last == DBI::SQLToken::TokenPunctuation && (last_char == '(' || last_char == '.' || last_char == '[')) {
+			return false;
+		}
+
+		//calls and column lists hug their name
+		if (type == DBI::SQLToken::TokenPunctuation && (last == DBI::SQLToken::TokenWord || last == DBI::SQLToken::TokenQuotedIdentifier)) {
+			return false;
+		}
+
+		return true;
+	}
+}
+
+bool DBI::SQLLexer::Next(SQLToken &token)
+{
+	size_t sz = m_sql.size();
+	if (m_pos >= sz) {
+		return false;
+	}
+
+	size_t start = m_pos;
+	char c = m_sql[m_pos];
+	char next = m_pos + 1 < sz ? m_sql[m_pos + 1] : '\0';
+	token.offset = start;
+
+	if (IsSpace(c)) {
+		while (m_pos < sz && IsSpace(m_sql[m_pos])) {
+			++m_pos;
+		}
+		token.type = SQLToken::TokenSpace;
+	}
+	else if (c == '-' && next == '-') {
+		while (m_pos < sz && m_sql[m_pos] != '\n') {
+			++m_pos;
+		}
+		token.type = SQLToken::TokenComment;
+	}
+	else if (c == '/' && next == '*') {
+		ReadBlockComment();
+		token.type = SQLToken::TokenComment;
+	}
+	else if (c == '\'') {
+		//E'' whose E was read as part of something else still takes escapes
+		bool prefixed = start > 0 && (m_sql[start - 1] == 'E' || m_sql[start - 1] == 'e') &&
+			(start == 1 || !IsIdentifierChar(m_sql[start - 2]));
+		ReadString(m_pos, m_backslash_escapes || prefixed);
+		token.type = SQLToken::TokenString;
+	}
+	else if (c == '"' || c == '`') {
+		ReadQuoted(c);
+		token.type = SQLToken::TokenQuotedIdentifier;
+	}
+	else if (c == '?') {
+		++m_pos;
+		token.type = SQLToken::TokenPlaceholder;
+	}
+	else if (c == '$' && (start == 0 || !IsIdentifierChar(m_sql[start - 1]))) {
+		//after an identifier character (even an escaped one) it's part of a name
+		if (IsDigit(next)) {
+			++m_pos;
+			while (m_pos < sz && IsDigit(m_sql[m_pos])) {
+				++m_pos;
+			}
+			token.type = SQLToken::TokenParameter;
+		}
+		else if (ReadDollarQuote()) {
+			token.type = SQLToken::TokenString;
+		}
+		else {
+			++m_pos;
+			token.type = SQLToken::TokenOther;
+		}
+	}
+	else if (c == '\\') {
+		//a backslash keeps the next character from being a placeholder
+		m_pos = m_pos + 2 < sz ? m_pos + 2 : sz;
+		token.type = SQLToken::TokenOther;
+	}
+	else if (IsDigit(c) || (c == '.' && IsDigit(next))) {
+		bool hex = c == '0' && (next == 'x' || next == 'X');
+		++m_pos;
+		while (m_pos < sz) {
+			char n = m_sql[m_pos];
+			char prev = m_sql[m_pos - 1];
+			if (IsIdentifierChar(n) && (n != '$' || IsIdentifierChar(prev))) {
+				++m_pos;
+			}
+			else if (n == '.' || ((n == '+' || n == '-') && !hex && (prev == 'e' || prev == 'E') &&
+				m_pos + 1 < sz && IsDigit(m_sql[m_pos + 1]))) {
+				++m_pos;
+			}
+			else {
+				break;
+			}
+		}
+		token.type = SQLToken::TokenNumber;
+	}
+	else if (IsIdentifierChar(c)) {
+		while (m_pos < sz && IsIdentifierChar(m_sql[m_pos])) {
+			++m_pos;
+		}
+
+		//E'', N'', X'' and B'' are strings with a prefix, E'' ones take backslash escapes
+		if (m_pos - start == 1 && m_pos < sz && m_sql[m_pos] == '\'' && strchr("EeNnXxBb", c) != nullptr &&
+			(start == 0 || !IsIdentifierChar(m_sql[start - 1]))) {
+			ReadString(m_pos, m_backslash_escapes || c == 'E' || c == 'e');
+			token.type = SQLToken::TokenString;
+		}
+		else {
+			token.type = SQLToken::TokenWord;
+		}
+	}
+	else if (c != '\0' && strchr("(),;.[]", c) != nullptr) {
+		++m_pos;
+		token.type = SQLToken::TokenPunctuation;
+	}
+	else if (IsOperatorChar(c)) {
+		++m_pos;
+		while (m_pos < sz && IsOperatorChar(m_sql[m_pos])) {
+			char n = m_pos + 1 < sz ? m_sql[m_pos + 1] : '\0';
+			if ((m_sql[m_pos] == '-' && n == '-') || (m_sql[m_pos] == '/' && n == '*')) {
+				break;
+			}
+			++m_pos;
+		}
+		token.type = SQLToken::TokenOperator;
+	}
+	else {
+		++m_pos;
+		token.type = SQLToken::TokenOther;
+	}
+
+	token.length = m_pos - start;
+	return true;
+}
+
+std::string DBI::SQLLexer::Word(const SQLToken &token) const
+{
+	std::string word(m_sql, token.offset, token.length);
+	for (auto &c : word) {
+		if (c >= 'A' && c <= 'Z') {
+			c = c - 'A' + 'a';
+		}
+	}
+
+	return word;
+}
+
+bool DBI::SQLLexer::IsIdentifierChar(char c)
+{
+	return (c >= 'a' && c <= 'z') || (c >= 'A' && c <= 'Z') || (c >= '0' && c <= '9') || c == '_' || c == '$' ||
+		static_cast<unsigned char>(c) >= 0x80;
+}
+
+void DBI::SQLLexer::ReadString(size_t quote, bool escapes)
+{
+	size_t sz = m_sql.size();
+	m_pos = quote + 1;
+	while (m_pos < sz) {
+		if (escapes && m_sql[m_pos] == '\\') {
+			m_pos += 2;
+		}
+		else if (m_sql[m_pos] == '\'') {
+			if (m_pos + 1 < sz && m_sql[m_pos + 1] == '\'') {
+				m_pos += 2;
+			}
+			else {
+				++m_pos;
+				break;
+			}
+		}
+		else {
+			++m_pos;
+		}
+	}
+
+	if (m_pos > sz) {
+		m_pos = sz;
+	}
+}
+
+void DBI::SQLLexer::ReadQuoted(char quote)
+{
+	size_t sz = m_sql.size();
+	++m_pos;
+	while (m_pos < sz) {
+		if (m_sql[m_pos] == quote) {
+			if (m_pos + 1 < sz && m_sql[m_pos + 1] == quote) {
+				m_pos += 2;
+				continue;
+			}
+			++m_pos;
+			break;
+		}
+		++m_pos;
+	}
+}
+
+void DBI::SQLLexer::ReadBlockComment()
+{
+	//block comments nest in postgres
+	size_t sz = m_sql.size();
+	int depth = 1;
+	m_pos += 2;
+	while (m_pos < sz && depth > 0) {
+		if (m_sql[m_pos] == '/' && m_pos + 1 < sz && m_sql[m_pos + 1] == '*') {
+			++depth;
+			m_pos += 2;
+		}
+		else if (m_sql[m_pos] == '*' && m_pos + 1 < sz && m_sql[m_pos + 1] == '/') {
+			--depth;
+			m_pos += 2;
+		}
+		else {
+			++m_pos;
+		}
+	}
+}
+
+bool DBI::SQLLexer::ReadDollarQuote()
+{
+	//$tag$ ... $tag$, a lone $ is left to the caller
+	size_t sz = m_sql.size();
+	size_t tag_end = m_pos + 1;
+	while (tag_end < sz && IsIdentifierChar(m_sql[tag_end]) && m_sql[tag_end] != '$') {
+		++tag_end;
+	}
+
+	if (tag_end >= sz || m_sql[tag_end] != '$') {
+		return false;
+	}
+
+	std::string tag = m_sql.substr(m_pos, tag_end - m_pos + 1);
+	size_t close = m_sql.find(tag, tag_end + 1);
+	m_pos = close == std::string::npos ? sz : close + tag.length();
+	return true;
+}
+
+bool DBI::SQLLexer::IsOperatorChar(char c) const
+{
+	return c != '\0' && strchr("+-*/<>=~!@#%^&|:", c) != nullptr;
+}
+
+DBI::SQLFingerprint DBI::Fingerprint(const std::string &sql, bool backslash_escapes)
+{
+	SQLFingerprint fingerprint;
+	std::string &text = fingerprint.text;
+	text.reserve(sql.size());
+
+	SQLLexer lexer(sql, backslash_escapes);
+	SQLToken token;
+	SQLToken::Type last = SQLToken::TokenSpace;
+	char last_char = '\0';
+	bool last_in = false;
+	//offset in text of the ( of an IN list that can still collapse, npos outside one
+	size_t in_list = std::string::npos;
+	size_t in_values = 0;
+
+	while (lexer.Next(token)) {
+		if (token.type == SQLToken::TokenSpace || token.type == SQLToken::TokenComment) {
+			continue;
+		}
+
+		bool literal = token.IsLiteral();
+		char first = sql[token.offset];
+		bool punctuation = token.type == SQLToken::TokenPunctuation;
+
+		if (in_list != std::string::npos) {
+			if (literal) {
+				++in_values;
+			}
+			else if (punctuation && first == ')' && in_values > 0) {
+				text.resize(in_list);
+				text += "(?+)";
+				in_list = std::string::npos;
+				last = SQLToken::TokenPunctuation;
+				last_char = ')';
+				last_in = false;
+				continue;
+			}
+			else if (!punctuation || first != ',') {
+				//a sub query or expression, left as it is
+				in_list = std::string::npos;
+			}
+		}
+
+		if (!text.empty() && NeedsSpace(last, last_char, token.type, first)) {
+			text += ' ';
+		}
+
+		size_t token_start = text.size();
+		if (literal) {
+			text += '?';
+		}
+		else if (token.type == SQLToken::TokenWord) {
+			text += lexer.Word(token);
+		}
+		else {
+			text.append(sql, token.offset, token.length);
+		}
+
+		if (punctuation && first == '(' && last_in) {
+			in_list = token_start;
+			in_values = 0;
+		}
+		last_in = token.type == SQLToken::TokenWord && text.compare(token_start, std::string::npos, "in") == 0;
+		last = token.type;
+		last_char = first;
+	}
+
+	if (last == SQLToken::TokenPunctuation && last_char == ';') {
+		text.resize(text.size() - 1);
+	}
+
+	fingerprint.hash = FingerprintHash(text);
+	return fingerprint;
+}
+
+uint64_t DBI::FingerprintHash(const char *data, size_t length)
+{
+	uint64_t hash = 14695981039346656037ULL;
+	for (size_t i = 0; i < length; ++i) {
+		hash ^= static_cast<unsigned char>(data[i]);
+		hash *= 1099511628211ULL;
+	}
+
+	return hash;
+}
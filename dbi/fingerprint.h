@@ -0,0 +1,100 @@
+#pragma once
+
+#include <stdint.h>
+#include <cstddef>
+#include <string>
+
+namespace DBI
+{
+
+	struct SQLToken
+	{
+		enum Type
+		{
+			//keyword or bare identifier
+			TokenWord = 0,
+			TokenNumber = 1,
+			//'...', E'...' and friends, $tag$...$tag$
+			TokenString = 2,
+			//"..." or `...`
+			TokenQuotedIdentifier = 3,
+			//?
+			TokenPlaceholder = 4,
+			//$1
+			TokenParameter = 5,
+			TokenOperator = 6,
+			//( ) , ; . [ ]
+			TokenPunctuation = 7,
+			TokenComment = 8,
+			TokenSpace = 9,
+			//anything else, including a backslash and the character it escapes
+			TokenOther = 10
+		};
+
+		SQLToken() : type(TokenOther), offset(0), length(0) { }
+
+		bool IsLiteral() const { return type == TokenNumber || type == TokenString || type == TokenPlaceholder || type == TokenParameter; }
+
+		Type type;
+		size_t offset;
+		size_t length;
+	};
+
+	/*
+		Single pass tokenizer shared by everything that has to look inside SQL
+		text.  It knows enough of the PostgreSQL, MySQL and SQLite dialects to
+		step over strings, quoted identifiers and (nested) comments so what is
+		inside them is never mistaken for a placeholder or keyword.  Plain
+		strings take backslash escapes only when asked, as MySQL does.
+	*/
+	class SQLLexer
+	{
+	public:
+		SQLLexer(const std::string &sql_, bool backslash_escapes_ = false) : m_sql(sql_), m_pos(0), m_backslash_escapes(backslash_escapes_) { }
+
+		//Reads the next token, false once the whole statement was read.
+		bool Next(SQLToken &token);
+
+		//Lower cased copy of a word token.
+		std::string Word(const SQLToken &token) const;
+
+		static bool IsIdentifierChar(char c);
+
+	private:
+		void ReadString(size_t quote, bool escapes);
+		void ReadQuoted(char quote);
+		void ReadBlockComment();
+		bool ReadDollarQuote();
+		bool IsOperatorChar(char c) const;
+
+		const std::string &m_sql;
+		size_t m_pos;
+		bool m_backslash_escapes;
+	};
+
+	struct SQLFingerprint
+	{
+		SQLFingerprint() : hash(0) { }
+
+		std::string text;
+		//FingerprintHash() of text
+		uint64_t hash;
+	};
+
+	/*
+		Canonical shape of a statement: literals and placeholders become ?,
+		lists of them inside IN (...) become (?+), comments are dropped, words
+		are lower cased and spacing is rebuilt from the tokens.  Statements that
+		only differ in their values share a fingerprint, so it is a key for
+		metrics but never for anything that depends on those values.
+	*/
+	SQLFingerprint Fingerprint(const std::string &sql, bool backslash_escapes = false);
+
+	//64 bit FNV-1a.
+	uint64_t FingerprintHash(const char *data, size_t length);
+
+	inline uint64_t FingerprintHash(const std::string &data) {
+		return FingerprintHash(data.data(), data.size());
+	}
+
+}
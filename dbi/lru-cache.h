@@ -0,0 +1,102 @@
+#pragma once
+
+#include <stdint.h>
+#include <cstddef>
+#include <list>
+#include <unordered_map>
+#include <utility>
+#include <assert.h>
+
+namespace DBI
+{
+
+	struct CacheStats
+	{
+		CacheStats() : hits(0), misses(0), evictions(0), size(0), capacity(0) { }
+		uint64_t hits;
+		uint64_t misses;
+		uint64_t evictions;
+		size_t size;
+		size_t capacity;
+	};
+
+	/*
+		Fixed capacity map that evicts the least recently used entry when full.
+		Not thread safe, callers own the locking if they need it.
+	*/
+	template<typename Key, typename Value>
+	class LRUCache
+	{
+	public:
+		LRUCache(size_t capacity_) : m_capacity(capacity_) { }
+
+		size_t Capacity() const { return m_capacity; }
+		size_t Size() const { return m_index.size(); }
+
+		void SetCapacity(size_t capacity_) {
+			m_capacity = capacity_;
+			Trim();
+		}
+
+		//Returns the cached value and marks it most recently used, nullptr on a miss.
+		Value *Get(const Key &key) {
+			auto iter = m_index.find(key);
+			if (iter == m_index.end()) {
+				m_stats.misses++;
+				return nullptr;
+			}
+
+			m_stats.hits++;
+			m_items.splice(m_items.begin(), m_items, iter->second);
+			return &iter->second->second;
+		}
+
+		//Inserts or replaces key, evicting old entries to stay within capacity.
+		Value &Put(const Key &key, Value value) {
+			assert(m_capacity > 0);
+			Erase(key);
+
+			m_items.push_front(std::make_pair(key, std::move(value)));
+			m_index[key] = m_items.begin();
+			Trim();
+			return m_items.front().second;
+		}
+
+		void Erase(const Key &key) {
+			auto iter = m_index.find(key);
+			if (iter != m_index.end()) {
+				m_items.erase(iter->second);
+				m_index.erase(iter);
+			}
+		}
+
+		void Clear() {
+			m_index.clear();
+			m_items.clear();
+		}
+
+		CacheStats Stats() const {
+			CacheStats stats = m_stats;
+			stats.size = m_index.size();
+			stats.capacity = m_capacity;
+			return stats;
+		}
+
+	private:
+		typedef std::list<std::pair<Key, Value>> ItemList;
+
+		void Trim() {
+			while (m_index.size() > m_capacity) {
+				m_index.erase(m_items.back().first);
+				m_items.pop_back();
+				m_stats.evictions++;
+			}
+		}
+
+		size_t m_capacity;
+		ItemList m_items;
+		std::unordered_map<Key, typename ItemList::iterator> m_index;
+		CacheStats m_stats;
+	};
+
+}
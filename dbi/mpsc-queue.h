@@ -0,0 +1,75 @@
+#pragma once
+
+#include <cstddef>
+#include <atomic>
+#include <utility>
+
+namespace DBI
+{
+
+	/*
+		Unbounded lock free queue for many producers and a single consumer.  Push()
+		is safe from any thread, Pop() and Empty() only from the consumer.  A
+		push that is still in progress can make Pop() briefly report empty.
+	*/
+	template<typename T>
+	class MPSCQueue
+	{
+	public:
+		MPSCQueue() {
+			Node *stub = new Node();
+			m_head.store(stub);
+			m_tail = stub;
+		}
+
+		~MPSCQueue() {
+			T value;
+			while (Pop(value)) {
+			}
+			delete m_tail;
+		}
+
+		void Push(T value) {
+			Node *node = new Node(std::move(value));
+			Node *prev = m_head.exchange(node);
+			prev->next.store(node);
+		}
+
+		bool Pop(T &value) {
+			Node *tail = m_tail;
+			Node *next = tail->next.load();
+			if (!next) {
+				return false;
+			}
+
+			//next becomes the new stub, its value is moved out
+			value = std::move(next->value);
+			m_tail = next;
+			delete tail;
+			return true;
+		}
+
+		bool Empty() const {
+			return m_tail->next.load() == nullptr;
+		}
+
+		MPSCQueue(const MPSCQueue&) = delete;
+		MPSCQueue &operator=(const MPSCQueue&) = delete;
+
+	private:
+		struct Node
+		{
+			Node() : next(nullptr) { }
+			Node(T &&value_) : next(nullptr), value(std::move(value_)) { }
+
+			std::atomic<Node*> next;
+			T value;
+		};
+
+		//producers append here
+		std::atomic<Node*> m_head;
+		//consumer only, always a stub whose value was already taken
+		Node *m_tail;
+	};
+
+}
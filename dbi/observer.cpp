@@ -0,0 +1,270 @@
+/*
+	Copyright(C) 2014 EQEmu
+
+	This program is free software; you can redistribute it and/or
+	modify it under the terms of the GNU General Public License
+	as published by the Free Software Foundation; either version 2
+	of the License, or (at your option) any later version.
+
+	This program is distributed in the hope that it will be useful,
+	but WITHOUT ANY WARRANTY; without even the implied warranty of
+	MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+	GNU General Public License for more details.
+
+	You should have received a copy of the GNU General Public License
+	along with this program; if not, write to the Free Software
+	Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+*/
+#include "observer.h"
+#include "rs.h"
+#include <stdio.h>
+#include <math.h>
+#include <algorithm>
+#include <stdexcept>
+
+const char *DBI::QueryEvent::PhaseName(Phase phase)
+{
+	switch (phase) {
+	case PhasePrepare:
+		return "prepare";
+	case PhaseBind:
+		return "bind";
+	case PhaseExecute:
+		return "execute";
+	case PhaseFetch:
+		return "fetch";
+	}
+
+	return "unknown";
+}
+
+DBI::QueryClock::time_point DBI::ReportQuery(QueryObserver &observer, QueryEvent::Phase phase, const std::string &sql,
+	QueryClock::time_point start, uint64_t rows, uint64_t bytes)
+{
+	QueryClock::time_point end = QueryClock::now();
+	QueryEvent event(phase, sql, start);
+	event.nanoseconds = (uint64_t)std::chrono::duration_cast<std::chrono::nanoseconds>(end - start).count();
+	event.rows = rows;
+	event.bytes = bytes;
+	observer.OnQuery(event);
+	return end;
+}
+
+DBI::QueryClock::time_point DBI::ReportQuery(QueryObserver &observer, QueryEvent::Phase phase, const std::string &sql,
+	QueryClock::time_point start, const ResultSet *rs)
+{
+	if (!rs) {
+		return ReportQuery(observer, phase, sql, start, 0, 0);
+	}
+
+	uint64_t rows = rs->FieldCount() > 0 ? rs->RowCount() : rs->AffectedRows();
+	return ReportQuery(observer, phase, sql, start, rows, rs->MemoryUsage());
+}
+
+void DBI::ReportQueryError(QueryObserver &observer, QueryEvent::Phase phase, const std::string &sql,
+	QueryClock::time_point start, int error_code)
+{
+	QueryEvent event(phase, sql, start);
+	event.nanoseconds = (uint64_t)std::chrono::duration_cast<std::chrono::nanoseconds>(QueryClock::now() - start).count();
+	event.error_code = error_code;
+
+	//the caller rethrows the same exception once this returns
+	try {
+		throw;
+	}
+	catch (std::exception &ex) {
+		event.error = ex.what();
+		observer.OnQuery(event);
+	}
+	catch (...) {
+		event.error = "unknown error";
+		observer.OnQuery(event);
+	}
+}
+
+void DBI::LatencyHistogram::Record(uint64_t value)
+{
+	size_t index = BucketIndex(value);
+	if (index >= m_buckets.size()) {
+		m_buckets.resize(index + 1, 0);
+	}
+	m_buckets[index]++;
+
+	if (m_count == 0 || value < m_min) {
+		m_min = value;
+	}
+	if (value > m_max) {
+		m_max = value;
+	}
+	m_count++;
+	m_sum += value;
+}
+
+void DBI::LatencyHistogram::Merge(const LatencyHistogram &other)
+{
+	if (other.m_count == 0) {
+		return;
+	}
+
+	if (other.m_buckets.size() > m_buckets.size()) {
+		m_buckets.resize(other.m_buckets.size(), 0);
+	}
+	for (size_t i = 0; i < other.m_buckets.size(); ++i) {
+		m_buckets[i] += other.m_buckets[i];
+	}
+
+	if (m_count == 0 || other.m_min < m_min) {
+		m_min = other.m_min;
+	}
+	if (other.m_max > m_max) {
+		m_max = other.m_max;
+	}
+	m_count += other.m_count;
+	m_sum += other.m_sum;
+}
+
+void DBI::LatencyHistogram::Reset()
+{
+	m_buckets.clear();
+	m_count = 0;
+	m_sum = 0;
+	m_min = 0;
+	m_max = 0;
+}
+
+uint64_t DBI::LatencyHistogram::Percentile(double percentile) const
+{
+	if (m_count == 0) {
+		return 0;
+	}
+
+	uint64_t target = (uint64_t)ceil(percentile / 100.0 * (double)m_count);
+	if (target < 1) {
+		target = 1;
+	}
+
+	uint64_t seen = 0;
+	for (size_t i = 0; i < m_buckets.size(); ++i) {
+		seen += m_buckets[i];
+		if (seen >= target) {
+			return std::max(m_min, std::min(BucketHighest(i), m_max));
+		}
+	}
+
+	return m_max;
+}
+
+size_t DBI::LatencyHistogram::BucketIndex(uint64_t value)
+{
+	if (value < SubBuckets) {
+		return (size_t)value;
+	}
+
+#if defined(__GNUC__)
+	unsigned int msb = 63 - __builtin_clzll(value);
+#else
+	unsigned int msb = SubBucketBits;
+	while ((value >> (msb + 1)) != 0) {
+		++msb;
+	}
+#endif
+
+	//the top SubBucketBits + 1 bits pick the bucket, everything below them is the imprecision
+	unsigned int shift = msb - SubBucketBits;
+	return (size_t)((shift + 1) * SubBuckets + ((value >> shift) - SubBuckets));
+}
+
+uint64_t DBI::LatencyHistogram::BucketHighest(size_t index)
+{
+	if (index < SubBuckets) {
+		return index;
+	}
+
+	uint64_t shift = index / SubBuckets - 1;
+	uint64_t lowest = (SubBuckets + index % SubBuckets) << shift;
+	return lowest + ((uint64_t)1 << shift) - 1;
+}
+
+void DBI::QueryStats::OnQuery(const QueryEvent &event)
+{
+	std::lock_guard<std::mutex> guard(m_lock);
+	const SQLFingerprint *fingerprint = m_fingerprints.Get(event.sql);
+	if (!fingerprint) {
+		fingerprint = &m_fingerprints.Put(event.sql, DBI::Fingerprint(event.sql));
+	}
+
+	auto iter = m_entries.find(fingerprint->text);
+	if (iter == m_entries.end()) {
+		std::string key = m_entries.size() >= m_max_fingerprints ? "(other)" : fingerprint->text;
+		iter = m_entries.find(key);
+		if (iter == m_entries.end()) {
+			iter = m_entries.insert(std::make_pair(key, QueryStatsEntry())).first;
+			iter->second.fingerprint = key;
+			iter->second.hash = FingerprintHash(key);
+		}
+	}
+
+	QueryStatsEntry &entry = iter->second;
+	entry.phases[event.phase].Record(event.nanoseconds);
+	if (!event.Ok()) {
+		entry.errors++;
+	}
+
+	if (event.phase == QueryEvent::PhaseExecute) {
+		entry.calls++;
+	}
+	entry.rows += event.rows;
+	entry.bytes += event.bytes;
+}
+
+std::vector<DBI::QueryStatsEntry> DBI::QueryStats::Snapshot() const
+{
+	std::vector<QueryStatsEntry> entries;
+	{
+		std::lock_guard<std::mutex> guard(m_lock);
+		entries.reserve(m_entries.size());
+		for (auto &entry : m_entries) {
+			entries.push_back(entry.second);
+		}
+	}
+
+	std::sort(entries.begin(), entries.end(), [](const QueryStatsEntry &a, const QueryStatsEntry &b) {
+		return a.phases[QueryEvent::PhaseExecute].Sum() > b.phases[QueryEvent::PhaseExecute].Sum();
+	});
+	return entries;
+}
+
+std::string DBI::QueryStats::Report() const
+{
+	std::vector<QueryStatsEntry> entries = Snapshot();
+
+	char line[256];
+	snprintf(line, sizeof(line), "%10s %8s %12s %10s %10s %10s %10s %12s  %s\n", "calls", "errors", "rows", "p50_us", "p95_us",
+		"p99_us", "max_us", "total_ms", "statement");
+	std::string report = line;
+
+	for (auto &entry : entries) {
+		const LatencyHistogram &execute = entry.phases[QueryEvent::PhaseExecute];
+		snprintf(line, sizeof(line), "%10llu %8llu %12llu %10.1f %10.1f %10.1f %10.1f %12.3f  ", (unsigned long long)entry.calls,
+			(unsigned long long)entry.errors, (unsigned long long)entry.rows, execute.Percentile(50.0) / 1000.0,
+			execute.Percentile(95.0) / 1000.0, execute.Percentile(99.0) / 1000.0, execute.Max() / 1000.0, execute.Sum() / 1000000.0);
+		report += line;
+		report += entry.fingerprint;
+		report += "\n";
+	}
+
+	return report;
+}
+
+void DBI::QueryStats::Reset()
+{
+	std::lock_guard<std::mutex> guard(m_lock);
+	m_entries.clear();
+	m_fingerprints.Clear();
+}
+
+size_t DBI::QueryStats::Size() const
+{
+	std::lock_guard<std::mutex> guard(m_lock);
+	return m_entries.size();
+}
@@ -0,0 +1,174 @@
+#pragma once
+
+#include <stdint.h>
+#include <cstddef>
+#include <string>
+#include <vector>
+#include <unordered_map>
+#include <mutex>
+#include <chrono>
+
+#include "fingerprint.h"
+#include "lru-cache.h"
+
+namespace DBI
+{
+
+	class ResultSet;
+
+	typedef std::chrono::steady_clock QueryClock;
+
+	//One phase of one statement, see QueryObserver.
+	struct QueryEvent
+	{
+		enum Phase
+		{
+			PhasePrepare = 0,
+			PhaseBind = 1,
+			PhaseExecute = 2,
+			PhaseFetch = 3
+		};
+
+		static const size_t PhaseCount = 4;
+		static const char *PhaseName(Phase phase);
+
+		QueryEvent(Phase phase_, const std::string &sql_, QueryClock::time_point start_)
+			: phase(phase_), sql(sql_), start(start_), nanoseconds(0), rows(0), bytes(0), error_code(0), error(nullptr) { }
+
+		bool Ok() const { return error == nullptr; }
+
+		Phase phase;
+		//SQL as given to Prepare() or Do()
+		const std::string &sql;
+		QueryClock::time_point start;
+		//time spent in the phase, for a cursor's fetch only the time inside Next() is counted
+		uint64_t nanoseconds;
+		//rows returned, or affected rows for statements that return none
+		uint64_t rows;
+		//ResultSet::MemoryUsage() after execute, cell bytes read for a cursor's fetch
+		uint64_t bytes;
+		//backend error code: SQLite extended result code, MySQL errno or the PostgreSQL SQLSTATE
+		//packed the way the server's ERRCODE_ macros are.  0 if unknown.
+		int error_code;
+		//null on success
+		const char *error;
+	};
+
+	/*
+		Set on a DatabaseHandle with SetObserver() to see every statement it runs.
+		Prepare() reports a prepare phase, Execute() and Do() report bind (when
+		there are params) and execute, Query() adds one fetch phase once the
+		cursor is exhausted or destroyed.  Buffered results are read as part of
+		execute, so their rows and bytes come with the execute phase.  Do()'s
+		prepare phase is its statement cache lookup.  OnQuery() runs on the thread
+		that ran the statement, right after the phase finished, and must not throw.
+		With no observer set the only cost is a null check per call.
+	*/
+	class QueryObserver
+	{
+	public:
+		virtual ~QueryObserver() { }
+
+		virtual void OnQuery(const QueryEvent &event) = 0;
+	};
+
+	//Hands observer a phase that started at start and finished now, returns now.
+	QueryClock::time_point ReportQuery(QueryObserver &observer, QueryEvent::Phase phase, const std::string &sql,
+		QueryClock::time_point start, uint64_t rows, uint64_t bytes);
+
+	//ReportQuery() with the rows and bytes of rs.
+	QueryClock::time_point ReportQuery(QueryObserver &observer, QueryEvent::Phase phase, const std::string &sql,
+		QueryClock::time_point start, const ResultSet *rs);
+
+	//Hands observer the exception being handled as a failed phase, only call from a catch block.
+	void ReportQueryError(QueryObserver &observer, QueryEvent::Phase phase, const std::string &sql,
+		QueryClock::time_point start, int error_code);
+
+	/*
+		Log linear latency histogram in the style of HdrHistogram: values below 32
+		get a bucket each, above that every power of two is split into 32 buckets
+		so any value is recorded within about 3%.  Buckets are only allocated up
+		to the largest value seen.
+	*/
+	class LatencyHistogram
+	{
+	public:
+		LatencyHistogram() : m_count(0), m_sum(0), m_min(0), m_max(0) { }
+
+		void Record(uint64_t value);
+		void Merge(const LatencyHistogram &other);
+		void Reset();
+
+		uint64_t Count() const { return m_count; }
+		uint64_t Sum() const { return m_sum; }
+		uint64_t Min() const { return m_min; }
+		uint64_t Max() const { return m_max; }
+		double Mean() const { return m_count > 0 ? (double)m_sum / (double)m_count : 0.0; }
+
+		//Smallest recorded value (to the bucket's precision) that percentile percent of values are at or below.
+		uint64_t Percentile(double percentile) const;
+
+	private:
+		static const unsigned int SubBucketBits = 5;
+		static const uint64_t SubBuckets = 1 << SubBucketBits;
+
+		static size_t BucketIndex(uint64_t value);
+		static uint64_t BucketHighest(size_t index);
+
+		std::vector<uint64_t> m_buckets;
+		uint64_t m_count;
+		uint64_t m_sum;
+		uint64_t m_min;
+		uint64_t m_max;
+	};
+
+	struct QueryStatsEntry
+	{
+		QueryStatsEntry() : hash(0), calls(0), errors(0), rows(0), bytes(0) { }
+
+		//see DBI::Fingerprint()
+		std::string fingerprint;
+		uint64_t hash;
+		//execute phases
+		uint64_t calls;
+		//failed phases of any kind
+		uint64_t errors;
+		uint64_t rows;
+		uint64_t bytes;
+		//nanoseconds per phase, indexed by QueryEvent::Phase
+		LatencyHistogram phases[QueryEvent::PhaseCount];
+	};
+
+	/*
+		Observer that aggregates counters and latency histograms per statement
+		fingerprint, thread safe so one can be shared by every handle of a pool.
+		Once max_fingerprints are tracked new ones are counted under "(other)".
+		Fingerprints are memoized per SQL text so a repeated statement is only
+		tokenized once.
+	*/
+	class QueryStats : public QueryObserver
+	{
+	public:
+		QueryStats(size_t max_fingerprints = 1000) : m_max_fingerprints(max_fingerprints), m_fingerprints(DefaultFingerprintCacheSize) { }
+
+		virtual void OnQuery(const QueryEvent &event);
+
+		//Copy of every entry, most total execute time first.
+		std::vector<QueryStatsEntry> Snapshot() const;
+
+		//Snapshot() as a text table, latencies in microseconds.
+		std::string Report() const;
+
+		void Reset();
+		size_t Size() const;
+
+	private:
+		static const size_t DefaultFingerprintCacheSize = 1024;
+
+		mutable std::mutex m_lock;
+		size_t m_max_fingerprints;
+		std::unordered_map<std::string, QueryStatsEntry> m_entries;
+		LRUCache<std::string, SQLFingerprint> m_fingerprints;
+	};
+
+}
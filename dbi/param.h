@@ -0,0 +1,84 @@
+#pragma once
+
+#include <stdint.h>
+#include <string.h>
+#include <cstddef>
+#include <string>
+
+namespace DBI
+{
+
+	/*
+		One bound value, built on the stack by the variadic Execute() and Do()
+		so a whole call's params reach the backend in one virtual call.  Takes
+		the same types BindArg() does and remembers which one it was.  Strings
+		are not copied, the value must outlive the call it is bound in.
+	*/
+	struct Param
+	{
+		enum Type
+		{
+			TypeNull = 0,
+			TypeBool = 1,
+			TypeInt8 = 2,
+			TypeUInt8 = 3,
+			TypeInt16 = 4,
+			TypeUInt16 = 5,
+			TypeInt32 = 6,
+			TypeUInt32 = 7,
+			TypeInt64 = 8,
+			TypeUInt64 = 9,
+			TypeFloat = 10,
+			TypeDouble = 11,
+			TypeString = 12
+		};
+
+		Param() : type(TypeNull), i64(0), length(0) { }
+		Param(bool v) : type(TypeBool), i64(v ? 1 : 0), length(0) { }
+		Param(int8_t v) : type(TypeInt8), i64(v), length(0) { }
+		Param(uint8_t v) : type(TypeUInt8), i64(v), length(0) { }
+		Param(int16_t v) : type(TypeInt16), i64(v), length(0) { }
+		Param(uint16_t v) : type(TypeUInt16), i64(v), length(0) { }
+		Param(int32_t v) : type(TypeInt32), i64(v), length(0) { }
+		Param(uint32_t v) : type(TypeUInt32), i64(v), length(0) { }
+		Param(int64_t v) : type(TypeInt64), i64(v), length(0) { }
+		Param(uint64_t v) : type(TypeUInt64), length(0) { u64 = v; }
+		Param(float v) : type(TypeFloat), length(0) { d = v; }
+		Param(double v) : type(TypeDouble), length(0) { d = v; }
+		Param(const std::string &v) : type(TypeString), length(v.length()) { data = v.data(); }
+		//a null pointer binds NULL
+		Param(const char *v) : type(v ? TypeString : TypeNull), length(v ? strlen(v) : 0) { data = v; }
+		Param(std::nullptr_t) : type(TypeNull), i64(0), length(0) { }
+
+		Type type;
+		union
+		{
+			//bool and every integer type but uint64_t
+			int64_t i64;
+			uint64_t u64;
+			//float and double
+			double d;
+			const char *data;
+		};
+		//bytes at data for strings
+		size_t length;
+	};
+
+	//Non-owning array of Params, index 0 is bound to the first placeholder.
+	class ParamBlock
+	{
+	public:
+		ParamBlock() : m_params(nullptr), m_size(0) { }
+		ParamBlock(const Param *params_, size_t size_) : m_params(params_), m_size(size_) { }
+
+		size_t Size() const { return m_size; }
+		const Param &operator[](size_t i) const { return m_params[i]; }
+		const Param *begin() const { return m_params; }
+		const Param *end() const { return m_params + m_size; }
+
+	private:
+		const Param *m_params;
+		size_t m_size;
+	};
+
+}
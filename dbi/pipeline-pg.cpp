@@ -0,0 +1,160 @@
+/*
+	Copyright(C) 2014 EQEmu
+
+	This program is free software; you can redistribute it and/or
+	modify it under the terms of the GNU General Public License
+	as published by the Free Software Foundation; either version 2
+	of the License, or (at your option) any later version.
+
+	This program is distributed in the hope that it will be useful,
+	but WITHOUT ANY WARRANTY; without even the implied warranty of
+	MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+	GNU General Public License for more details.
+
+	You should have received a copy of the GNU General Public License
+	along with this program; if not, write to the Free Software
+	Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+*/
+#include "pipeline-pg.h"
+#include "rs.h"
+#include <stdexcept>
+#include <libpq-fe.h>
+
+DBI::PGPipeline::PGPipeline(PGconn *conn_) : m_handle(conn_), m_pending(0), m_failed(false)
+{
+#ifdef LIBPQ_HAS_PIPELINING
+	if (!PQenterPipelineMode(m_handle)) {
+		std::string error = "Pipeline Error: ";
+		error += PQerrorMessage(m_handle);
+		throw std::runtime_error(error);
+	}
+#endif
+}
+
+DBI::PGPipeline::~PGPipeline() {
+	try {
+		Collect();
+	}
+	catch (std::exception&) {
+	}
+
+#ifdef LIBPQ_HAS_PIPELINING
+	PQexitPipelineMode(m_handle);
+#endif
+}
+
+void DBI::PGPipeline::Sync()
+{
+#ifdef LIBPQ_HAS_PIPELINING
+	if (!PQpipelineSync(m_handle)) {
+		std::string error = "Pipeline Error: ";
+		error += PQerrorMessage(m_handle);
+		throw std::runtime_error(error);
+	}
+	m_expected.push_back(true);
+#else
+	m_failed = false;
+#endif
+}
+
+std::vector<DBI::PGPipeline::Result> DBI::PGPipeline::Collect()
+{
+#ifdef LIBPQ_HAS_PIPELINING
+	if (!m_expected.empty() && !m_expected.back()) {
+		Sync();
+	}
+
+	while (!m_expected.empty()) {
+		bool sync = m_expected.front();
+		m_expected.pop_front();
+
+		PGresult *res = PQgetResult(m_handle);
+		if (!res) {
+			//connection is gone, nothing more will arrive
+			std::string error = PQerrorMessage(m_handle);
+			m_expected.push_front(sync);
+			for (; !m_expected.empty(); m_expected.pop_front()) {
+				if (!m_expected.front()) {
+					Result result;
+					result.error = error;
+					m_results.push_back(std::move(result));
+				}
+			}
+			break;
+		}
+
+		if (sync) {
+			PQclear(res);
+			continue;
+		}
+
+		AddResult(res);
+
+		//every statement's results end with a null
+		while ((res = PQgetResult(m_handle)) != nullptr) {
+			PQclear(res);
+		}
+	}
+#else
+	m_failed = false;
+#endif
+
+	m_pending = 0;
+	std::vector<Result> results;
+	results.swap(m_results);
+	return results;
+}
+
+DBI::PGStatementHandle &DBI::PGPipeline::Handle(StatementHandle &sth)
+{
+	PGStatementHandle *handle = dynamic_cast<PGStatementHandle*>(&sth);
+	if (!handle || handle->m_handle != m_handle) {
+		throw std::runtime_error("Pipeline Error: statement was not prepared on this connection.");
+	}
+
+	return *handle;
+}
+
+void DBI::PGPipeline::Send(PGStatementHandle &handle)
+{
+#ifdef LIBPQ_HAS_PIPELINING
+	if (!handle.SendPrepared(true)) {
+		std::string error = "Pipeline Error: ";
+		error += PQerrorMessage(m_handle);
+		throw std::runtime_error(error);
+	}
+	m_expected.push_back(false);
+#else
+	//same skipping the server would do inside a pipeline
+	if (m_failed) {
+		Result result;
+		result.aborted = true;
+		m_results.push_back(std::move(result));
+	}
+	else {
+		AddResult(handle.ExecPrepared());
+	}
+#endif
+	++m_pending;
+}
+
+void DBI::PGPipeline::AddResult(PGresult *res)
+{
+	Result result;
+	ExecStatusType status = res ? PQresultStatus(res) : PGRES_FATAL_ERROR;
+	if (status == PGRES_TUPLES_OK || status == PGRES_COMMAND_OK) {
+		result.result_set = PGStatementHandle::BuildResultSet(res);
+	}
+#ifdef LIBPQ_HAS_PIPELINING
+	else if (status == PGRES_PIPELINE_ABORTED) {
+		result.aborted = true;
+	}
+#endif
+	else {
+		result.error = res ? PQresultErrorMessage(res) : PQerrorMessage(m_handle);
+		m_failed = true;
+	}
+
+	PQclear(res);
+	m_results.push_back(std::move(result));
+}
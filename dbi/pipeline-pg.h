@@ -0,0 +1,94 @@
+#pragma once
+
+#include <stdint.h>
+#include <cstddef>
+#include <string>
+#include <memory>
+#include <vector>
+#include <deque>
+
+#include "sth-pg.h"
+
+namespace DBI
+{
+
+	/*
+		Queues executes of prepared statements on one connection without waiting
+		for each result, created through PGDatabaseHandle::Pipeline().  Sync()
+		marks an error boundary: once a statement fails every later statement up
+		to the next sync point is skipped by the server, statements after it run
+		as normal.  Nothing else may use the connection while the pipeline exists.
+
+		Needs libpq 14 or newer, older libpq executes each Queue() immediately
+		but keeps the same result and error semantics.
+	*/
+	class PGPipeline
+	{
+	public:
+		struct Result
+		{
+			Result() : aborted(false) { }
+			Result(Result &&other) : result_set(std::move(other.result_set)), error(std::move(other.error)), aborted(other.aborted) { }
+			Result &operator=(Result &&other) {
+				result_set = std::move(other.result_set);
+				error = std::move(other.error);
+				aborted = other.aborted;
+				return *this;
+			}
+
+			bool Ok() const { return result_set ? true : false; }
+
+			//null if the statement failed or was skipped
+			std::unique_ptr<ResultSet> result_set;
+			std::string error;
+			//skipped because an earlier statement in the same sync block failed
+			bool aborted;
+		};
+
+		virtual ~PGPipeline();
+
+		//Queues sth with args, sth must come from the same PGDatabaseHandle.
+		void Queue(StatementHandle &sth) {
+			Send(Handle(sth));
+		}
+
+		template<typename T, typename... Args>
+		void Queue(StatementHandle &sth, T value, Args... args)
+		{
+			Param params[] = { Param(value), Param(args)... };
+			PGStatementHandle &handle = Handle(sth);
+			handle.BindParamBlock(ParamBlock(params, sizeof...(Args) + 1));
+			Send(handle);
+		}
+
+		//Ends the current error block, statements queued after it run even if one before it failed.
+		void Sync();
+
+		//Statements queued whose results haven't been collected yet.
+		size_t Pending() const { return m_pending; }
+
+		//Syncs if needed and returns every outstanding result in queue order.
+		std::vector<Result> Collect();
+
+		PGPipeline(const PGPipeline&) = delete;
+		PGPipeline &operator=(const PGPipeline&) = delete;
+
+	protected:
+		PGPipeline(PGconn *conn_);
+
+		PGStatementHandle &Handle(StatementHandle &sth);
+		void Send(PGStatementHandle &handle);
+		void AddResult(PGresult *res);
+
+		PGconn *m_handle;
+		size_t m_pending;
+		//true for a sync point, false for a statement, in the order results will arrive
+		std::deque<bool> m_expected;
+		//results already read, only used when libpq can't pipeline
+		std::vector<Result> m_results;
+		bool m_failed;
+
+		friend class DBI::PGDatabaseHandle;
+	};
+
+}
@@ -0,0 +1,276 @@
+/*
+	Copyright(C) 2014 EQEmu
+
+	This program is free software; you can redistribute it and/or
+	modify it under the terms of the GNU General Public License
+	as published by the Free Software Foundation; either version 2
+	of the License, or (at your option) any later version.
+
+	This program is distributed in the hope that it will be useful,
+	but WITHOUT ANY WARRANTY; without even the implied warranty of
+	MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+	GNU General Public License for more details.
+
+	You should have received a copy of the GNU General Public License
+	along with this program; if not, write to the Free Software
+	Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+*/
+#include "pool.h"
+#include <assert.h>
+#include <stdexcept>
+
+void DBI::ConnectionPool::Lease::Release()
+{
+	if (m_pool && m_conn) {
+		m_pool->Return(std::move(m_conn), false);
+	}
+	m_pool = nullptr;
+}
+
+void DBI::ConnectionPool::Lease::Discard()
+{
+	if (m_pool && m_conn) {
+		m_pool->Return(std::move(m_conn), true);
+	}
+	m_pool = nullptr;
+}
+
+DBI::ConnectionPool::ConnectionPool(DatabaseFactory factory, std::string dbname, std::string host, std::string username,
+	std::string auth, const DatabaseAttributes &attr, Options options)
+	: m_factory(factory), m_dbname(dbname), m_host(host), m_username(username), m_auth(auth), m_attr(attr),
+	m_options(options), m_size(0), m_in_use(0), m_busy_time(0.0), m_open_time(0.0)
+{
+	if (m_options.max_size == 0) {
+		m_options.max_size = 1;
+	}
+
+	if (m_options.min_size > m_options.max_size) {
+		m_options.min_size = m_options.max_size;
+	}
+
+	m_usage_updated = Clock::now();
+	for (size_t i = 0; i < m_options.min_size; ++i) {
+		auto conn = CreateConnection();
+
+		std::lock_guard<std::mutex> guard(m_lock);
+		UpdateUsage(Clock::now());
+		m_size++;
+		m_stats.created++;
+		m_idle.push_back(std::move(conn));
+	}
+}
+
+DBI::ConnectionPool::~ConnectionPool()
+{
+	assert(m_in_use == 0);
+	m_idle.clear();
+}
+
+DBI::ConnectionPool::Lease DBI::ConnectionPool::Acquire()
+{
+	return Acquire(true, 0);
+}
+
+DBI::ConnectionPool::Lease DBI::ConnectionPool::Acquire(unsigned int timeout_ms)
+{
+	return Acquire(false, timeout_ms);
+}
+
+void DBI::ConnectionPool::Shrink()
+{
+	std::deque<std::unique_ptr<Connection>> closed;
+
+	std::lock_guard<std::mutex> guard(m_lock);
+	CollectIdle(Clock::now(), closed);
+}
+
+DBI::ConnectionPool::Stats DBI::ConnectionPool::GetStats() const
+{
+	std::lock_guard<std::mutex> guard(m_lock);
+	Stats stats = m_stats;
+	stats.size = m_size;
+	stats.idle = m_idle.size();
+	stats.in_use = m_in_use;
+
+	double elapsed = std::chrono::duration<double>(Clock::now() - m_usage_updated).count();
+	double busy = m_busy_time + elapsed * m_in_use;
+	double open = m_open_time + elapsed * m_size;
+	stats.utilization = open > 0.0 ? busy / open : 0.0;
+	return stats;
+}
+
+DBI::ConnectionPool::Lease DBI::ConnectionPool::Acquire(bool wait_forever, unsigned int timeout_ms)
+{
+	auto start = Clock::now();
+	auto deadline = start + std::chrono::milliseconds(timeout_ms);
+	bool waited = false;
+
+	for (;;) {
+		std::unique_ptr<Connection> conn;
+		bool create = false;
+
+		{
+			std::unique_lock<std::mutex> guard(m_lock);
+			for (;;) {
+				if (!m_idle.empty()) {
+					conn = std::move(m_idle.back());
+					m_idle.pop_back();
+					break;
+				}
+
+				if (m_size < m_options.max_size) {
+					create = true;
+					break;
+				}
+
+				if (!wait_forever && Clock::now() >= deadline) {
+					m_stats.timeouts++;
+					throw std::runtime_error("Timed out waiting for a pooled database connection.");
+				}
+
+				waited = true;
+				if (wait_forever) {
+					m_available.wait(guard);
+				}
+				else {
+					m_available.wait_until(guard, deadline);
+				}
+			}
+
+			//the slot is reserved before the lock is dropped so concurrent callers can't overshoot max_size
+			UpdateUsage(Clock::now());
+			m_in_use++;
+			if (create) {
+				m_size++;
+			}
+		}
+
+		bool usable = true;
+		if (create) {
+			try {
+				conn = CreateConnection();
+			}
+			catch (...) {
+				std::lock_guard<std::mutex> guard(m_lock);
+				UpdateUsage(Clock::now());
+				m_in_use--;
+				m_size--;
+				m_available.notify_one();
+				throw;
+			}
+		}
+		else {
+			usable = Validate(*conn, Clock::now());
+		}
+
+		auto now = Clock::now();
+		if (!usable) {
+			conn.reset();
+
+			std::lock_guard<std::mutex> guard(m_lock);
+			UpdateUsage(now);
+			m_in_use--;
+			m_size--;
+			m_stats.failed_validations++;
+			m_stats.destroyed++;
+			continue;
+		}
+
+		std::lock_guard<std::mutex> guard(m_lock);
+		uint64_t wait_us = static_cast<uint64_t>(std::chrono::duration_cast<std::chrono::microseconds>(now - start).count());
+		if (create) {
+			m_stats.created++;
+		}
+		if (waited) {
+			m_stats.waits++;
+		}
+		m_stats.acquisitions++;
+		m_stats.total_wait_us += wait_us;
+		if (wait_us > m_stats.max_wait_us) {
+			m_stats.max_wait_us = wait_us;
+		}
+		if (m_in_use > m_stats.peak_in_use) {
+			m_stats.peak_in_use = m_in_use;
+		}
+
+		return Lease(this, std::move(conn));
+	}
+}
+
+std::unique_ptr<DBI::ConnectionPool::Connection> DBI::ConnectionPool::CreateConnection()
+{
+	std::unique_ptr<DatabaseHandle> handle = m_factory();
+	if (!handle) {
+		throw std::runtime_error("Connection pool factory did not return a database handle.");
+	}
+
+	//Connect() takes the attributes by reference, give each connection its own copy
+	DatabaseAttributes attr = m_attr;
+	handle->Connect(m_dbname, m_host, m_username, m_auth, attr);
+
+	std::unique_ptr<Connection> conn(new Connection());
+	conn->handle = std::move(handle);
+	conn->last_used = Clock::now();
+	return conn;
+}
+
+bool DBI::ConnectionPool::Validate(Connection &conn, Clock::time_point now)
+{
+	if (m_options.validate_after_ms > 0 && now - conn.last_used < std::chrono::milliseconds(m_options.validate_after_ms)) {
+		return true;
+	}
+
+	try {
+		conn.handle->Ping();
+	}
+	catch (std::exception&) {
+		return false;
+	}
+
+	return true;
+}
+
+void DBI::ConnectionPool::Return(std::unique_ptr<Connection> conn, bool discard)
+{
+	auto now = Clock::now();
+	std::deque<std::unique_ptr<Connection>> closed;
+	conn->last_used = now;
+
+	{
+		std::lock_guard<std::mutex> guard(m_lock);
+		UpdateUsage(now);
+		m_in_use--;
+		if (discard) {
+			m_size--;
+			m_stats.destroyed++;
+		}
+		else {
+			m_idle.push_back(std::move(conn));
+		}
+
+		CollectIdle(now, closed);
+	}
+
+	//a discarded or trimmed connection is closed here, outside the lock
+	m_available.notify_one();
+}
+
+void DBI::ConnectionPool::CollectIdle(Clock::time_point now, std::deque<std::unique_ptr<Connection>> &closed)
+{
+	auto timeout = std::chrono::milliseconds(m_options.idle_timeout_ms);
+	while (m_size > m_options.min_size && !m_idle.empty() && now - m_idle.front()->last_used >= timeout) {
+		closed.push_back(std::move(m_idle.front()));
+		m_idle.pop_front();
+		UpdateUsage(now);
+		m_size--;
+		m_stats.destroyed++;
+	}
+}
+
+void DBI::ConnectionPool::UpdateUsage(Clock::time_point now)
+{
+	double elapsed = std::chrono::duration<double>(now - m_usage_updated).count();
+	m_busy_time += elapsed * m_in_use;
+	m_open_time += elapsed * m_size;
+	m_usage_updated = now;
+}
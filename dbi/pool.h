@@ -0,0 +1,156 @@
+#pragma once
+
+#include <stdint.h>
+#include <cstddef>
+#include <string>
+#include <memory>
+#include <deque>
+#include <functional>
+#include <mutex>
+#include <condition_variable>
+#include <chrono>
+
+#include "dbh.h"
+
+namespace DBI
+{
+
+	typedef std::function<std::unique_ptr<DatabaseHandle>()> DatabaseFactory;
+
+	/*
+		Thread safe set of connections to one database.  Connections are created by
+		the factory and connected with the stored credentials, handed out through
+		Lease objects and returned to the pool when the lease goes away.  The pool
+		must outlive every lease it hands out.
+	*/
+	class ConnectionPool
+	{
+	public:
+		typedef std::chrono::steady_clock Clock;
+
+		struct Options
+		{
+			Options() : min_size(1), max_size(8), idle_timeout_ms(60000), validate_after_ms(30000) { }
+			size_t min_size;
+			size_t max_size;
+			//idle connections above min_size are closed after this long
+			unsigned int idle_timeout_ms;
+			//idle connections are Ping()ed before reuse once idle this long, 0 always pings
+			unsigned int validate_after_ms;
+		};
+
+		struct Stats
+		{
+			Stats() : size(0), idle(0), in_use(0), peak_in_use(0), acquisitions(0), waits(0), timeouts(0),
+				created(0), destroyed(0), failed_validations(0), total_wait_us(0), max_wait_us(0), utilization(0.0) { }
+			size_t size;
+			size_t idle;
+			size_t in_use;
+			size_t peak_in_use;
+			uint64_t acquisitions;
+			uint64_t waits;
+			uint64_t timeouts;
+			uint64_t created;
+			uint64_t destroyed;
+			uint64_t failed_validations;
+			uint64_t total_wait_us;
+			uint64_t max_wait_us;
+			//fraction of open connection time spent leased out since the pool was created
+			double utilization;
+		};
+
+		class Lease
+		{
+		public:
+			Lease() : m_pool(nullptr) { }
+			Lease(Lease &&other) : m_pool(other.m_pool), m_conn(std::move(other.m_conn)) { other.m_pool = nullptr; }
+			~Lease() { Release(); }
+
+			Lease &operator=(Lease &&other) {
+				if (this != &other) {
+					Release();
+					m_pool = other.m_pool;
+					m_conn = std::move(other.m_conn);
+					other.m_pool = nullptr;
+				}
+				return *this;
+			}
+
+			DatabaseHandle *Get() const { return m_conn ? m_conn->handle.get() : nullptr; }
+			DatabaseHandle *operator->() const { return Get(); }
+			DatabaseHandle &operator*() const { return *Get(); }
+			explicit operator bool() const { return m_conn ? true : false; }
+
+			//Hands the connection back early.
+			void Release();
+
+			//Closes the connection instead of returning it, for handles left in a bad state.
+			void Discard();
+
+			Lease(const Lease&) = delete;
+			Lease &operator=(const Lease&) = delete;
+
+		private:
+			struct Connection
+			{
+				std::unique_ptr<DatabaseHandle> handle;
+				Clock::time_point last_used;
+			};
+
+			Lease(ConnectionPool *pool_, std::unique_ptr<Connection> conn_) : m_pool(pool_), m_conn(std::move(conn_)) { }
+
+			ConnectionPool *m_pool;
+			std::unique_ptr<Connection> m_conn;
+
+			friend class ConnectionPool;
+		};
+
+		ConnectionPool(DatabaseFactory factory, std::string dbname, std::string host, std::string username,
+			std::string auth, const DatabaseAttributes &attr, Options options = Options());
+		~ConnectionPool();
+
+		//Blocks until a connection is available.
+		Lease Acquire();
+
+		//Throws std::runtime_error if no connection frees up within timeout_ms.
+		Lease Acquire(unsigned int timeout_ms);
+
+		//Closes idle connections above min_size that have passed the idle timeout.
+		void Shrink();
+
+		Stats GetStats() const;
+
+		ConnectionPool(const ConnectionPool&) = delete;
+		ConnectionPool &operator=(const ConnectionPool&) = delete;
+
+	private:
+		typedef Lease::Connection Connection;
+
+		Lease Acquire(bool wait_forever, unsigned int timeout_ms);
+		std::unique_ptr<Connection> CreateConnection();
+		bool Validate(Connection &conn, Clock::time_point now);
+		void Return(std::unique_ptr<Connection> conn, bool discard);
+		void CollectIdle(Clock::time_point now, std::deque<std::unique_ptr<Connection>> &closed);
+		void UpdateUsage(Clock::time_point now);
+
+		DatabaseFactory m_factory;
+		std::string m_dbname;
+		std::string m_host;
+		std::string m_username;
+		std::string m_auth;
+		DatabaseAttributes m_attr;
+		Options m_options;
+
+		mutable std::mutex m_lock;
+		std::condition_variable m_available;
+		//most recently used connections are at the back
+		std::deque<std::unique_ptr<Connection>> m_idle;
+		size_t m_size;
+		size_t m_in_use;
+		Stats m_stats;
+		Clock::time_point m_usage_updated;
+		double m_busy_time;
+		double m_open_time;
+	};
+
+}
@@ -0,0 +1,380 @@
+/*
+	Copyright(C) 2014 EQEmu
+
+	This program is free software; you can redistribute it and/or
+	modify it under the terms of the GNU General Public License
+	as published by the Free Software Foundation; either version 2
+	of the License, or (at your option) any later version.
+
+	This program is distributed in the hope that it will be useful,
+	but WITHOUT ANY WARRANTY; without even the implied warranty of
+	MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+	GNU General Public License for more details.
+
+	You should have received a copy of the GNU General Public License
+	along with this program; if not, write to the Free Software
+	Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+*/
+#include "result-cache.h"
+#include "fingerprint.h"
+#include <iterator>
+#include <algorithm>
+
+namespace
+{
+	bool IsAny(const std::string &word, const char *const *list) {
+		for (; *list; ++list) {
+			if (word == *list) {
+				return true;
+			}
+		}
+		return false;
+	}
+
+	//first words of statements that only read
+	const char *const ReadWords[] = { "select", "with", "values", "table", "show", "describe", "desc", "explain", nullptr };
+	//first words of statements that change nothing a result could depend on
+	const char *const NoneWords[] = { "begin", "start", "commit", "end", "savepoint", "release", "set", "pragma", "analyze",
+		"vacuum", "checkpoint", "listen", "unlisten", "notify", "prepare", "deallocate", "discard", "reset", "unlock", nullptr };
+	//anywhere in a read they make it something not to cache
+	const char *const WriteWords[] = { "insert", "update", "delete", "replace", "merge", "upsert", "truncate", "into", "lock",
+		"nextval", "setval", nullptr };
+	//followed by the tables a statement touches
+	const char *const TableWords[] = { "into", "update", "table", "truncate", "delete", "from", "join", "straight_join", "using",
+		"copy", nullptr };
+	//may sit between one of those and the table
+	const char *const ModifierWords[] = { "or", "replace", "ignore", "abort", "fail", "rollback", "low_priority", "delayed",
+		"high_priority", "quick", "only", "if", "not", "exists", "table", "temporary", "temp", "unlogged", "lateral", nullptr };
+
+	enum TableState
+	{
+		StateNone,
+		//next name is a table
+		StateTable,
+		//next name replaces the schema just read
+		StateQualified,
+		//a table was read, an alias or , may follow
+		StateAfterTable,
+		StateAfterAs,
+		StateAfterAlias
+	};
+
+	//Lower cased name of a word or quoted identifier.
+	std::string Name(const std::string &sql, const DBI::SQLLexer &lexer, const DBI::SQLToken &token) {
+		if (token.type == DBI::SQLToken::TokenWord) {
+			return lexer.Word(token);
+		}
+
+		std::string name;
+		size_t end = token.offset + token.length;
+		for (size_t i = token.offset + 1; i < end; ++i) {
+			char c = sql[i];
+			if (c == sql[token.offset]) {
+				//a doubled quote or the closing one
+				++i;
+				if (i >= end) {
+					break;
+				}
+			}
+			name.push_back(c >= 'A' && c <= 'Z' ? c - 'A' + 'a' : c);
+		}
+		return name;
+	}
+
+	void AddUnique(std::vector<std::string> &names, const std::string &name) {
+		if (std::find(names.begin(), names.end(), name) == names.end()) {
+			names.push_back(name);
+		}
+	}
+}
+
+DBI::ResultCache::ResultCache(size_t max_bytes, unsigned int default_ttl_ms)
+	: m_max_bytes(max_bytes), m_default_ttl(default_ttl_ms), m_statements(DefaultStatementCacheSize), m_generation(0), m_all_generation(0)
+{
+	m_stats.max_bytes = max_bytes;
+}
+
+void DBI::ResultCache::SetTTL(const std::string &stmt, unsigned int ttl_ms)
+{
+	std::lock_guard<std::mutex> guard(m_lock);
+	m_ttls[stmt] = ttl_ms;
+}
+
+std::shared_ptr<const DBI::ResultSet> DBI::ResultCache::Get(const std::string &key)
+{
+	std::lock_guard<std::mutex> guard(m_lock);
+	auto iter = m_index.find(key);
+	if (iter == m_index.end()) {
+		m_stats.misses++;
+		return nullptr;
+	}
+
+	EntryList::iterator entry = iter->second;
+	if (entry->expires <= Clock::now()) {
+		m_stats.expirations++;
+		m_stats.misses++;
+		Erase(entry);
+		return nullptr;
+	}
+
+	if (Stale(*entry)) {
+		m_stats.misses++;
+		Erase(entry);
+		return nullptr;
+	}
+
+	m_stats.hits++;
+	m_entries.splice(m_entries.begin(), m_entries, entry);
+	return entry->result;
+}
+
+void DBI::ResultCache::Put(const std::string &stmt, const std::string &key, std::shared_ptr<const ResultSet> rs, uint64_t generation)
+{
+	if (!rs) {
+		return;
+	}
+
+	std::lock_guard<std::mutex> guard(m_lock);
+	auto ttl = m_ttls.find(stmt);
+	unsigned int ttl_ms = ttl == m_ttls.end() ? m_default_ttl : ttl->second;
+	if (ttl_ms == 0) {
+		return;
+	}
+
+	const Statement &statement = Lookup(stmt);
+	if (statement.kind != Statement::KindRead) {
+		return;
+	}
+
+	Entry entry;
+	entry.key = key;
+	entry.result = rs;
+	entry.generation = generation;
+	entry.expires = Clock::now() + std::chrono::milliseconds(ttl_ms);
+	entry.tables.reserve(statement.tables.size());
+	for (auto &table : statement.tables) {
+		entry.tables.push_back(&m_table_versions[table]);
+	}
+
+	//written to while it ran
+	if (Stale(entry)) {
+		return;
+	}
+
+	//the key is kept by the entry and the index
+	entry.bytes = sizeof(Entry) + key.size() * 2 + entry.tables.size() * sizeof(const uint64_t*) + rs->MemoryUsage();
+	if (entry.bytes > m_max_bytes) {
+		return;
+	}
+
+	auto iter = m_index.find(key);
+	if (iter != m_index.end()) {
+		Erase(iter->second);
+	}
+
+	while (!m_entries.empty() && m_stats.bytes + entry.bytes > m_max_bytes) {
+		m_stats.evictions++;
+		Erase(std::prev(m_entries.end()));
+	}
+
+	m_stats.bytes += entry.bytes;
+	m_entries.push_front(std::move(entry));
+	m_index[key] = m_entries.begin();
+	m_stats.size = m_index.size();
+}
+
+uint64_t DBI::ResultCache::Generation() const
+{
+	std::lock_guard<std::mutex> guard(m_lock);
+	return m_generation;
+}
+
+void DBI::ResultCache::Invalidate(const std::string &stmt)
+{
+	std::lock_guard<std::mutex> guard(m_lock);
+	const Statement &statement = Lookup(stmt);
+	if (statement.kind != Statement::KindWrite) {
+		return;
+	}
+
+	m_stats.invalidations++;
+	if (statement.tables.empty()) {
+		DropAll();
+		return;
+	}
+
+	//results of the tables are dropped as Get() finds them
+	++m_generation;
+	for (auto &table : statement.tables) {
+		m_table_versions[table] = m_generation;
+	}
+}
+
+void DBI::ResultCache::InvalidateTable(const std::string &table)
+{
+	std::string name = table;
+	std::transform(name.begin(), name.end(), name.begin(), [](char c) { return c >= 'A' && c <= 'Z' ? c - 'A' + 'a' : c; });
+
+	std::lock_guard<std::mutex> guard(m_lock);
+	m_stats.invalidations++;
+	m_table_versions[name] = ++m_generation;
+}
+
+void DBI::ResultCache::InvalidateAll()
+{
+	std::lock_guard<std::mutex> guard(m_lock);
+	m_stats.invalidations++;
+	DropAll();
+}
+
+DBI::ResultCacheStats DBI::ResultCache::Stats() const
+{
+	std::lock_guard<std::mutex> guard(m_lock);
+	return m_stats;
+}
+
+DBI::ResultCache::Statement DBI::ResultCache::Classify(const std::string &stmt)
+{
+	//reads keep every name they mention, extra ones only cost an early invalidation, writes keep
+	//just the tables they name after INTO, UPDATE, FROM and friends
+	Statement statement;
+	std::vector<std::string> names;
+	std::vector<std::string> targets;
+	std::string first;
+	std::string last;
+	bool writes = false;
+	TableState state = StateNone;
+
+	SQLLexer lexer(stmt);
+	SQLToken token;
+	while (lexer.Next(token)) {
+		if (token.type == SQLToken::TokenSpace || token.type == SQLToken::TokenComment) {
+			continue;
+		}
+
+		bool word = token.type == SQLToken::TokenWord;
+		bool name = word || token.type == SQLToken::TokenQuotedIdentifier;
+		char c = stmt[token.offset];
+		std::string text;
+		if (name) {
+			text = Name(stmt, lexer, token);
+			AddUnique(names, text);
+			if (first.empty()) {
+				first = text;
+			}
+			if (word && IsAny(text, WriteWords)) {
+				writes = true;
+			}
+		}
+
+		//ON DUPLICATE KEY UPDATE, DO UPDATE and FOR UPDATE are followed by columns
+		if (word && IsAny(text, TableWords) && (text != "update" || (last != "key" && last != "do" && last != "for"))) {
+			state = StateTable;
+		}
+		else if (state == StateTable) {
+			if (word && IsAny(text, ModifierWords)) {
+			}
+			else if (name) {
+				targets.push_back(text);
+				state = StateAfterTable;
+			}
+			else {
+				state = StateNone;
+			}
+		}
+		else if (state == StateQualified) {
+			if (name) {
+				targets.back() = text;
+				state = StateAfterTable;
+			}
+			else {
+				state = StateNone;
+			}
+		}
+		else if (state == StateAfterTable) {
+			if (token.type == SQLToken::TokenPunctuation && c == '.') {
+				state = StateQualified;
+			}
+			else if (token.type == SQLToken::TokenPunctuation && c == ',') {
+				state = StateTable;
+			}
+			else if (word && text == "as") {
+				state = StateAfterAs;
+			}
+			else if (name) {
+				state = StateAfterAlias;
+			}
+			else {
+				state = StateNone;
+			}
+		}
+		else if (state == StateAfterAs) {
+			state = name ? StateAfterAlias : StateNone;
+		}
+		else if (state == StateAfterAlias) {
+			state = token.type == SQLToken::TokenPunctuation && c == ',' ? StateTable : StateNone;
+		}
+
+		last = word ? text : std::string();
+	}
+
+	if (IsAny(first, ReadWords) && !writes) {
+		statement.kind = Statement::KindRead;
+		statement.tables.swap(names);
+	}
+	else if (IsAny(first, NoneWords)) {
+		statement.kind = Statement::KindNone;
+	}
+	else {
+		//no tables found means every result is dropped
+		statement.kind = Statement::KindWrite;
+		for (auto &target : targets) {
+			AddUnique(statement.tables, target);
+		}
+	}
+
+	return statement;
+}
+
+const DBI::ResultCache::Statement &DBI::ResultCache::Lookup(const std::string &stmt)
+{
+	const Statement *statement = m_statements.Get(stmt);
+	if (!statement) {
+		statement = &m_statements.Put(stmt, Classify(stmt));
+	}
+
+	return *statement;
+}
+
+bool DBI::ResultCache::Stale(const Entry &entry) const
+{
+	if (entry.generation < m_all_generation) {
+		return true;
+	}
+
+	for (const uint64_t *version : entry.tables) {
+		if (*version > entry.generation) {
+			return true;
+		}
+	}
+
+	return false;
+}
+
+void DBI::ResultCache::Erase(EntryList::iterator iter)
+{
+	m_stats.bytes -= iter->bytes;
+	m_index.erase(iter->key);
+	m_entries.erase(iter);
+	m_stats.size = m_index.size();
+}
+
+void DBI::ResultCache::DropAll()
+{
+	//also rejects results still being read, see Put()
+	m_all_generation = ++m_generation;
+	m_entries.clear();
+	m_index.clear();
+	m_stats.bytes = 0;
+	m_stats.size = 0;
+}
@@ -0,0 +1,195 @@
+#pragma once
+
+#include <stdint.h>
+#include <string.h>
+#include <cstddef>
+#include <string>
+#include <vector>
+#include <list>
+#include <memory>
+#include <mutex>
+#include <chrono>
+#include <unordered_map>
+
+#include "rs.h"
+#include "lru-cache.h"
+
+namespace DBI
+{
+
+	struct ResultCacheStats
+	{
+		ResultCacheStats() : hits(0), misses(0), evictions(0), expirations(0), invalidations(0), size(0), bytes(0), max_bytes(0) { }
+		uint64_t hits;
+		uint64_t misses;
+		//entries dropped to stay within max_bytes
+		uint64_t evictions;
+		//entries found past their TTL
+		uint64_t expirations;
+		//statements that dropped results, see ResultCache::Invalidate()
+		uint64_t invalidations;
+		size_t size;
+		size_t bytes;
+		size_t max_bytes;
+	};
+
+	/*
+		Read through cache of whole result sets, shared by every handle it is set
+		on with DatabaseHandle::SetResultCache().  DoCached() and ExecuteCached()
+		look results up by the exact SQL text and the bound values, a miss runs
+		the statement and keeps the result until its TTL runs out, it is evicted
+		to stay within max_bytes or a statement run through one of those handles
+		writes to a table it read from.  Tables are found with SQLLexer, anything
+		it can't tell the tables of (DDL, CALL, ROLLBACK, ...) drops every result.
+		Writes made any other way, from other connections, COPY or a pipeline,
+		are only seen once the TTL runs out unless InvalidateTable() is called.
+		Results are shared and must not be modified.  Thread safe.
+	*/
+	class ResultCache
+	{
+	public:
+		typedef std::chrono::steady_clock Clock;
+
+		ResultCache(size_t max_bytes = DefaultMaxBytes, unsigned int default_ttl_ms = DefaultTTL);
+
+		//TTL for results of stmt, 0 leaves stmt uncached.
+		void SetTTL(const std::string &stmt, unsigned int ttl_ms);
+
+		//Cached result for key or null, see Key().
+		std::shared_ptr<const ResultSet> Get(const std::string &key);
+
+		//Stores rs for stmt under key unless stmt isn't a cacheable read or a table it reads was
+		//written after generation was taken from Generation().
+		void Put(const std::string &stmt, const std::string &key, std::shared_ptr<const ResultSet> rs, uint64_t generation);
+
+		//Taken before running a statement whose result is passed to Put().
+		uint64_t Generation() const;
+
+		//Drops results of every table stmt writes to, nothing for reads and transaction control.
+		void Invalidate(const std::string &stmt);
+		void InvalidateTable(const std::string &table);
+		void InvalidateAll();
+
+		ResultCacheStats Stats() const;
+
+		//stmt followed by a tagged encoding of each value, so values that bind differently never collide.
+		template<typename... Args>
+		static std::string Key(const std::string &stmt, Args... args)
+		{
+			std::string key;
+			key.reserve(stmt.size() + 1 + sizeof...(Args) * 9);
+			key = stmt;
+			key.push_back('\0');
+			AppendKeys(key, args...);
+			return key;
+		}
+
+		static const size_t DefaultMaxBytes = 64 * 1024 * 1024;
+		static const unsigned int DefaultTTL = 60000;
+
+		ResultCache(const ResultCache&) = delete;
+		ResultCache &operator=(const ResultCache&) = delete;
+
+	private:
+		//What a statement does to the cache, worked out once per SQL text.
+		struct Statement
+		{
+			enum Kind
+			{
+				//select and the like, cacheable
+				KindRead = 0,
+				//transaction control and settings, changes nothing
+				KindNone = 1,
+				//drops results of tables, or all of them when none were found
+				KindWrite = 2
+			};
+
+			Statement() : kind(KindWrite) { }
+
+			Kind kind;
+			//lower cased, without schema or quotes
+			std::vector<std::string> tables;
+		};
+
+		struct Entry
+		{
+			std::string key;
+			std::shared_ptr<const ResultSet> result;
+			//versions of the tables read, the map never erases so these stay valid
+			std::vector<const uint64_t*> tables;
+			uint64_t generation;
+			Clock::time_point expires;
+			size_t bytes;
+		};
+
+		typedef std::list<Entry> EntryList;
+
+		static const size_t DefaultStatementCacheSize = 1024;
+
+		static Statement Classify(const std::string &stmt);
+		const Statement &Lookup(const std::string &stmt);
+		bool Stale(const Entry &entry) const;
+		void Erase(EntryList::iterator iter);
+		void DropAll();
+
+		static void AppendKeys(std::string &) { }
+
+		template<typename T, typename... Args>
+		static void AppendKeys(std::string &key, T value, Args... args)
+		{
+			AppendKey(key, value);
+			AppendKeys(key, args...);
+		}
+
+		static void AppendRaw(std::string &key, char tag, const void *data, size_t length) {
+			key.push_back(tag);
+			key.append(static_cast<const char*>(data), length);
+		}
+
+		static void AppendKey(std::string &key, bool v) { key.push_back(v ? 'T' : 'F'); }
+		static void AppendKey(std::string &key, int8_t v) { AppendKey(key, (int64_t)v); }
+		static void AppendKey(std::string &key, uint8_t v) { AppendKey(key, (uint64_t)v); }
+		static void AppendKey(std::string &key, int16_t v) { AppendKey(key, (int64_t)v); }
+		static void AppendKey(std::string &key, uint16_t v) { AppendKey(key, (uint64_t)v); }
+		static void AppendKey(std::string &key, int32_t v) { AppendKey(key, (int64_t)v); }
+		static void AppendKey(std::string &key, uint32_t v) { AppendKey(key, (uint64_t)v); }
+		static void AppendKey(std::string &key, int64_t v) { AppendRaw(key, 'i', &v, sizeof(v)); }
+		static void AppendKey(std::string &key, uint64_t v) { AppendRaw(key, 'u', &v, sizeof(v)); }
+		static void AppendKey(std::string &key, float v) { AppendKey(key, (double)v); }
+		static void AppendKey(std::string &key, double v) { AppendRaw(key, 'd', &v, sizeof(v)); }
+		static void AppendKey(std::string &key, std::nullptr_t) { key.push_back('n'); }
+
+		static void AppendKey(std::string &key, const std::string &v) {
+			uint64_t length = v.size();
+			AppendRaw(key, 's', &length, sizeof(length));
+			key.append(v);
+		}
+
+		static void AppendKey(std::string &key, const char *v) {
+			if (!v) {
+				key.push_back('n');
+				return;
+			}
+
+			uint64_t length = strlen(v);
+			AppendRaw(key, 's', &length, sizeof(length));
+			key.append(v, (size_t)length);
+		}
+
+		mutable std::mutex m_lock;
+		size_t m_max_bytes;
+		unsigned int m_default_ttl;
+		std::unordered_map<std::string, unsigned int> m_ttls;
+		LRUCache<std::string, Statement> m_statements;
+		//most recently used first
+		EntryList m_entries;
+		std::unordered_map<std::string, EntryList::iterator> m_index;
+		//generation each table was last written at
+		std::unordered_map<std::string, uint64_t> m_table_versions;
+		uint64_t m_generation;
+		//generation every result was last dropped at
+		uint64_t m_all_generation;
+		ResultCacheStats m_stats;
+	};
+
+}
@@ -0,0 +1,372 @@
+/*
+	Copyright(C) 2014 EQEmu
+
+	This program is free software; you can redistribute it and/or
+	modify it under the terms of the GNU General Public License
+	as published by the Free Software Foundation; either version 2
+	of the License, or (at your option) any later version.
+
+	This program is distributed in the hope that it will be useful,
+	but WITHOUT ANY WARRANTY; without even the implied warranty of
+	MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+	GNU General Public License for more details.
+
+	You should have received a copy of the GNU General Public License
+	along with this program; if not, write to the Free Software
+	Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+*/
+#include "rs.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <assert.h>
+#include <errno.h>
+#include <limits>
+#include <stdexcept>
+
+namespace
+{
+	const DBI::ResultSet::SharedFields &NoFields() {
+		static const DBI::ResultSet::SharedFields fields = std::make_shared<const std::vector<std::string>>();
+		return fields;
+	}
+}
+
+DBI::ResultSet::ResultSet() : fields(NoFields()), row_count(0), current_column(0), affected_rows(0)
+{
+	//offset 0 is always an empty string so null and empty cells have something to point at
+	data.push_back(0);
+}
+
+DBI::ResultSet::ResultSet(std::vector<std::string> n_fields, size_t affected_rows_)
+	: fields(std::make_shared<const std::vector<std::string>>(std::move(n_fields))), columns(fields->size()), row_count(0),
+	current_column(0), affected_rows(affected_rows_)
+{
+	data.push_back(0);
+}
+
+DBI::ResultSet::ResultSet(SharedFields n_fields, size_t affected_rows_)
+	: fields(n_fields), columns(n_fields->size()), row_count(0), current_column(0), affected_rows(affected_rows_)
+{
+	data.push_back(0);
+}
+
+DBI::ResultSet::ResultSet(std::vector<std::string> n_fields, std::list<Row> n_rows, size_t affected_rows_)
+	: fields(std::make_shared<const std::vector<std::string>>(std::move(n_fields))), columns(fields->size()), row_count(0),
+	current_column(0), affected_rows(affected_rows_)
+{
+	data.push_back(0);
+	Reserve(n_rows.size(), 0);
+
+	for (auto &row : n_rows) {
+		for (auto &field : *fields) {
+			auto iter = row.find(field);
+			if (iter == row.end() || iter->second.is_null) {
+				AddNullField(iter != row.end() && iter->second.error);
+			}
+			else {
+				AddField(iter->second.value.c_str(), iter->second.value.length(), iter->second.error);
+			}
+		}
+		FinishRow();
+	}
+}
+
+template<typename T>
+T DBI::ResultSet::GetNative(size_t row, size_t col) const
+{
+	//cells are packed byte aligned in data
+	T v;
+	memcpy(&v, GetData(row, col), sizeof(v));
+	return v;
+}
+
+int DBI::ResultSet::FieldIndex(const std::string &name) const
+{
+	for (size_t i = 0; i < fields->size(); ++i) {
+		if ((*fields)[i] == name) {
+			return static_cast<int>(i);
+		}
+	}
+
+	return -1;
+}
+
+std::string DBI::ResultSet::GetValue(size_t row, size_t col) const
+{
+	char text[32];
+
+	switch (GetType(row, col)) {
+	case FieldTypeInt64: {
+		int64_t v = GetNative<int64_t>(row, col);
+		snprintf(text, sizeof(text), "%lld", (long long)v);
+		return text;
+	}
+	case FieldTypeUInt64: {
+		uint64_t v = GetNative<uint64_t>(row, col);
+		snprintf(text, sizeof(text), "%llu", (unsigned long long)v);
+		return text;
+	}
+	case FieldTypeDouble: {
+		double v = GetNative<double>(row, col);
+		if (columns[col].flags[row] & FlagFloat) {
+			//shortest text that reads back as the float, 125.9 and not 125.90000152587891
+			float f = static_cast<float>(v);
+			for (int precision = 6; precision <= 9; ++precision) {
+				snprintf(text, sizeof(text), "%.*g", precision, f);
+				if (strtof(text, nullptr) == f) {
+					break;
+				}
+			}
+			return text;
+		}
+
+		//shortest of the two precisions that reads back as the same value
+		snprintf(text, sizeof(text), "%.15g", v);
+		if (strtod(text, nullptr) != v) {
+			snprintf(text, sizeof(text), "%.17g", v);
+		}
+		return text;
+	}
+	default:
+		return std::string(GetData(row, col), GetLength(row, col));
+	}
+}
+
+DBI::ResultSet::FieldData DBI::ResultSet::GetField(size_t row, size_t col) const
+{
+	return FieldData(IsNull(row, col), IsError(row, col), GetValue(row, col));
+}
+
+int32_t DBI::ResultSet::GetInt32(size_t row, size_t col) const
+{
+	int64_t v = GetInt64(row, col);
+	if (v < std::numeric_limits<int32_t>::min() || v > std::numeric_limits<int32_t>::max()) {
+		ThrowConversion(row, col, "int32");
+	}
+
+	return static_cast<int32_t>(v);
+}
+
+int64_t DBI::ResultSet::GetInt64(size_t row, size_t col) const
+{
+	if (IsNull(row, col)) {
+		return 0;
+	}
+
+	switch (GetType(row, col)) {
+	case FieldTypeInt64:
+		return GetNative<int64_t>(row, col);
+	case FieldTypeUInt64: {
+		uint64_t v = GetNative<uint64_t>(row, col);
+		if (v > static_cast<uint64_t>(std::numeric_limits<int64_t>::max())) {
+			ThrowConversion(row, col, "int64");
+		}
+		return static_cast<int64_t>(v);
+	}
+	case FieldTypeDouble: {
+		double v = GetNative<double>(row, col);
+		if (v != v || v < -9223372036854775808.0 || v >= 9223372036854775808.0) {
+			ThrowConversion(row, col, "int64");
+		}
+		return static_cast<int64_t>(v);
+	}
+	default:
+		break;
+	}
+
+	const char *text = GetData(row, col);
+	char *end = nullptr;
+	errno = 0;
+	long long v = strtoll(text, &end, 10);
+	if (GetLength(row, col) == 0 || errno != 0 || end != text + GetLength(row, col)) {
+		ThrowConversion(row, col, "int64");
+	}
+
+	return static_cast<int64_t>(v);
+}
+
+uint64_t DBI::ResultSet::GetUInt64(size_t row, size_t col) const
+{
+	if (IsNull(row, col)) {
+		return 0;
+	}
+
+	switch (GetType(row, col)) {
+	case FieldTypeInt64: {
+		int64_t v = GetNative<int64_t>(row, col);
+		if (v < 0) {
+			ThrowConversion(row, col, "uint64");
+		}
+		return static_cast<uint64_t>(v);
+	}
+	case FieldTypeUInt64:
+		return GetNative<uint64_t>(row, col);
+	case FieldTypeDouble: {
+		double v = GetNative<double>(row, col);
+		if (v != v || v < 0.0 || v >= 18446744073709551616.0) {
+			ThrowConversion(row, col, "uint64");
+		}
+		return static_cast<uint64_t>(v);
+	}
+	default:
+		break;
+	}
+
+	//strtoull() quietly wraps negative numbers
+	const char *text = GetData(row, col);
+	char *end = nullptr;
+	errno = 0;
+	unsigned long long v = strtoull(text, &end, 10);
+	if (GetLength(row, col) == 0 || text[0] == '-' || errno != 0 || end != text + GetLength(row, col)) {
+		ThrowConversion(row, col, "uint64");
+	}
+
+	return static_cast<uint64_t>(v);
+}
+
+double DBI::ResultSet::GetDouble(size_t row, size_t col) const
+{
+	if (IsNull(row, col)) {
+		return 0.0;
+	}
+
+	switch (GetType(row, col)) {
+	case FieldTypeInt64:
+		return static_cast<double>(GetNative<int64_t>(row, col));
+	case FieldTypeUInt64:
+		return static_cast<double>(GetNative<uint64_t>(row, col));
+	case FieldTypeDouble:
+		return GetNative<double>(row, col);
+	default:
+		break;
+	}
+
+	const char *text = GetData(row, col);
+	char *end = nullptr;
+	double v = strtod(text, &end);
+	if (GetLength(row, col) == 0 || end != text + GetLength(row, col)) {
+		ThrowConversion(row, col, "double");
+	}
+
+	return v;
+}
+
+DBI::StringView DBI::ResultSet::GetStringView(size_t row, size_t col) const
+{
+	if (GetType(row, col) != FieldTypeText) {
+		ThrowConversion(row, col, "text");
+	}
+
+	return StringView(GetData(row, col), GetLength(row, col));
+}
+
+std::list<DBI::ResultSet::Row> DBI::ResultSet::Rows() const
+{
+	std::list<Row> rows;
+	for (size_t r = 0; r < row_count; ++r) {
+		Row row;
+		for (size_t f = 0; f < fields->size(); ++f) {
+			row[(*fields)[f]] = GetField(r, f);
+		}
+		rows.push_back(row);
+	}
+
+	return rows;
+}
+
+size_t DBI::ResultSet::MemoryUsage() const
+{
+	size_t bytes = sizeof(*this) + fields->capacity() * sizeof(std::string) + columns.capacity() * sizeof(Column) + data.capacity();
+	for (auto &field : *fields) {
+		bytes += field.capacity();
+	}
+
+	for (auto &column : columns) {
+		bytes += column.offsets.capacity() * sizeof(size_t) + column.lengths.capacity() * sizeof(size_t) + column.flags.capacity();
+	}
+
+	return bytes;
+}
+
+void DBI::ResultSet::Reserve(size_t rows, size_t bytes)
+{
+	for (auto &column : columns) {
+		column.offsets.reserve(rows);
+		column.lengths.reserve(rows);
+		column.flags.reserve(rows);
+	}
+
+	data.reserve(data.size() + bytes);
+}
+
+void DBI::ResultSet::AddField(const char *value, size_t length, bool error)
+{
+	AddCell(value, length, error ? FlagError : 0);
+}
+
+void DBI::ResultSet::AddInt64Field(int64_t value, bool error)
+{
+	AddCell((const char*)&value, sizeof(value), (FieldTypeInt64 << TypeShift) | (error ? FlagError : 0));
+}
+
+void DBI::ResultSet::AddUInt64Field(uint64_t value, bool error)
+{
+	AddCell((const char*)&value, sizeof(value), (FieldTypeUInt64 << TypeShift) | (error ? FlagError : 0));
+}
+
+void DBI::ResultSet::AddDoubleField(double value, bool error)
+{
+	AddCell((const char*)&value, sizeof(value), (FieldTypeDouble << TypeShift) | (error ? FlagError : 0));
+}
+
+void DBI::ResultSet::AddFloatField(float value, bool error)
+{
+	//widening is exact, the text form is only worked out if GetValue() asks for it
+	double widened = value;
+	AddCell((const char*)&widened, sizeof(widened), (FieldTypeDouble << TypeShift) | FlagFloat | (error ? FlagError : 0));
+}
+
+void DBI::ResultSet::AddNullField(bool error)
+{
+	AddCell(nullptr, 0, FlagNull | (error ? FlagError : 0));
+}
+
+void DBI::ResultSet::FinishRow()
+{
+	assert(current_column == columns.size());
+	current_column = 0;
+	++row_count;
+}
+
+void DBI::ResultSet::AddCell(const char *value, size_t length, uint8_t flags)
+{
+	assert(current_column < columns.size());
+	auto &column = columns[current_column++];
+
+	if (length == 0) {
+		column.offsets.push_back(0);
+	}
+	else {
+		//cells are kept null terminated so GetData() can be handed to C string functions
+		size_t offset = data.size();
+		data.resize(offset + length + 1);
+		memcpy(&data[offset], value, length);
+		data[offset + length] = 0;
+		column.offsets.push_back(offset);
+	}
+
+	column.lengths.push_back(length);
+	column.flags.push_back(flags);
+}
+
+void DBI::ResultSet::ThrowConversion(size_t row, size_t col, const char *type) const
+{
+	std::string err = "Can't read field ";
+	err += (*fields)[col];
+	err += " of row ";
+	err += std::to_string(row);
+	err += " as ";
+	err += type;
+	throw std::runtime_error(err);
+}
@@ -1,14 +1,39 @@
 #pragma once
 
+#include <stdint.h>
+#include <cstddef>
+#include <string>
+#include <vector>
+#include <list>
+#include <map>
+#include <memory>
+
 namespace DBI
 {
 
+	//Non-owning view of a cell's bytes, valid as long as the ResultSet is.
+	struct StringView
+	{
+		StringView() : data(""), size(0) { }
+		StringView(const char *data_, size_t size_) : data(data_), size(size_) { }
+		std::string ToString() const { return std::string(data, size); }
+		bool empty() const { return size == 0; }
+		const char *data;
+		size_t size;
+	};
+
+	/*
+		Results are stored column-wise: field names are kept once in fields and
+		shared with the statement and other sets of the same columns, every
+		cell's bytes live in a single contiguous data buffer and each column keeps
+		parallel offset/length/flag arrays indexed by row.
+	*/
 	class ResultSet
 	{
 	public:
 		struct FieldData
 		{
-			FieldData() 
+			FieldData()
 			: is_null(false), error(false) { }
 			FieldData(bool is_null_, bool error_, std::string value_)
 			: is_null(is_null_), error(error_), value(value_) { }
@@ -19,28 +44,101 @@ namespace DBI
 
 		typedef std::map<std::string, FieldData> Row;
 
-		ResultSet() : affected_rows(0)
+		//How a cell's bytes are stored, native values are kept as 8 raw bytes.
+		enum FieldType
 		{
-		}
+			FieldTypeText = 0,
+			FieldTypeInt64 = 1,
+			FieldTypeUInt64 = 2,
+			FieldTypeDouble = 3
+		};
 
-		ResultSet(std::vector<std::string> n_fields, std::list<Row> n_rows, size_t affected_rows_) 
-		{
-			fields = n_fields;
-			rows = n_rows;
-			affected_rows = affected_rows_;
-		}
+		ResultSet();
+		typedef std::shared_ptr<const std::vector<std::string>> SharedFields;
+
+		ResultSet(std::vector<std::string> n_fields, size_t affected_rows_);
+		//Shares n_fields instead of copying them, they must not change while any set holds them.
+		ResultSet(SharedFields n_fields, size_t affected_rows_);
+		ResultSet(std::vector<std::string> n_fields, std::list<Row> n_rows, size_t affected_rows_);
 		virtual ~ResultSet() { }
-	
-		const std::vector<std::string>& Fields() const { return fields; }
-		const std::string FieldByID(unsigned int id) { return fields[id]; }
-		const std::list<Row>& Rows() const { return rows; }
-		size_t RowCount() const { return rows.size(); }
+
+		const std::vector<std::string>& Fields() const { return *fields; }
+		const std::string FieldByID(unsigned int id) { return (*fields)[id]; }
+		int FieldIndex(const std::string &name) const;
+		size_t FieldCount() const { return fields->size(); }
+		size_t RowCount() const { return row_count; }
 		size_t AffectedRows() const { return affected_rows; }
+
+		//Bytes held by the set including unused capacity and the shared field names, for sizing caches and benchmarks.
+		size_t MemoryUsage() const;
+
+		bool IsNull(size_t row, size_t col) const { return (columns[col].flags[row] & FlagNull) != 0; }
+		bool IsError(size_t row, size_t col) const { return (columns[col].flags[row] & FlagError) != 0; }
+		FieldType GetType(size_t row, size_t col) const { return static_cast<FieldType>(columns[col].flags[row] >> TypeShift); }
+
+		//Raw cell bytes, only text for FieldTypeText cells.
+		const char *GetData(size_t row, size_t col) const { return &data[0] + columns[col].offsets[row]; }
+		size_t GetLength(size_t row, size_t col) const { return columns[col].lengths[row]; }
+
+		//Cell as text, native values are formatted.
+		std::string GetValue(size_t row, size_t col) const;
+		FieldData GetField(size_t row, size_t col) const;
+
+		//Typed access, native cells are returned as is and text is parsed.  NULL reads
+		//as 0, text that doesn't parse or a value out of range throws std::runtime_error.
+		int32_t GetInt32(size_t row, size_t col) const;
+		int64_t GetInt64(size_t row, size_t col) const;
+		uint64_t GetUInt64(size_t row, size_t col) const;
+		double GetDouble(size_t row, size_t col) const;
+
+		//Cell bytes without a copy, throws for native cells which have no text form.
+		StringView GetStringView(size_t row, size_t col) const;
+		StringView GetBlob(size_t row, size_t col) const { return GetStringView(row, col); }
+
+		//Builds the old name keyed row list, slow; only meant for existing callers.
+		std::list<Row> Rows() const;
+
+		//Used by the statement handles to fill the set one row at a time.
+		void Reserve(size_t rows, size_t bytes);
+		void AddField(const char *value, size_t length, bool error = false);
+		void AddInt64Field(int64_t value, bool error = false);
+		void AddUInt64Field(uint64_t value, bool error = false);
+		void AddDoubleField(double value, bool error = false);
+		//A FieldTypeDouble cell holding value widened, GetValue() formats it at float precision so 125.9f stays 125.9.
+		void AddFloatField(float value, bool error = false);
+		void AddNullField(bool error = false);
+		void FinishRow();
+		void SetAffectedRows(size_t affected_rows_) { affected_rows = affected_rows_; }
+
 	protected:
-		std::vector<std::string> fields;
-		std::list<Row> rows;
+		//low bits are flags, the FieldType sits above TypeShift
+		enum FieldFlags
+		{
+			FlagNull = 1,
+			FlagError = 2,
+			//a FieldTypeDouble cell that was a float
+			FlagFloat = 4,
+			TypeShift = 3
+		};
+
+		struct Column
+		{
+			std::vector<size_t> offsets;
+			std::vector<size_t> lengths;
+			std::vector<uint8_t> flags;
+		};
+
+		void AddCell(const char *value, size_t length, uint8_t flags);
+		template<typename T>
+		T GetNative(size_t row, size_t col) const;
+		void ThrowConversion(size_t row, size_t col, const char *type) const;
+
+		SharedFields fields;
+		std::vector<Column> columns;
+		std::vector<char> data;
+		size_t row_count;
+		size_t current_column;
 		size_t affected_rows;
 	};
 
 }
-
@@ -1,4 +1,6 @@
 #include "sth-mysql.h"
+#include "rs.h"
+#include <algorithm>
 
 #ifndef SOCKET
 #define SOCKET int
@@ -8,18 +10,71 @@
 #include <errmsg.h>
 #undef SOCKET
 
+#ifdef _WIN32
+#include <winsock2.h>
+#else
+#include <sys/select.h>
+#endif
+#include <chrono>
+
+#ifdef MYSQL_WAIT_READ
+/*
+	Execute driven through MariaDB Connector/C's non blocking *_start()
+	and *_cont() calls, Socket() is the connection's socket.  Other client
+	libraries use the threaded default instead.
+*/
+class DBI::MySQLAsyncResult : public DBI::AsyncResult
+{
+public:
+	MySQLAsyncResult(MySQLStatementHandle *statement_, int status_, int err_);
+	virtual ~MySQLAsyncResult();
+
+	virtual int Socket() const;
+
+protected:
+	virtual bool Advance();
+	virtual void WaitForProgress();
+	void SetStatus(int status);
+	//MYSQL_WAIT_* events that happened, waits up to timeout_ms for one
+	int ReadyEvents(int timeout_ms);
+
+	MySQLStatementHandle *m_statement;
+	//MYSQL_WAIT_* events the client library waits on, 0 once the current call finished
+	int m_status;
+	int m_err;
+	//events seen by WaitForProgress() and not handed over yet
+	int m_ready;
+	bool m_storing;
+	std::chrono::steady_clock::time_point m_deadline;
+};
+#endif
+
 DBI::MySQLStatementHandle::MySQLStatementHandle(MYSQL *handle_, MYSQL_STMT *stmt_)
 {
 	m_handle = handle_;
 	m_stmt = stmt_;
+	m_batch_affected = 0;
+	m_batch_transaction = false;
+
+	//every parameter gets its storage once here, binding never allocates after this
+	unsigned long params = mysql_stmt_param_count(m_stmt);
+	m_bind_params.resize(params);
+	m_bind_buffers.resize(params);
+	ClearBindParams();
+
+	my_bool update_max_length = 1;
+	mysql_stmt_attr_set(m_stmt, STMT_ATTR_UPDATE_MAX_LENGTH, &update_max_length);
 }
 
 DBI::MySQLStatementHandle::~MySQLStatementHandle() {
 	if (m_stmt) {
 		mysql_stmt_close(m_stmt);
 	}
+}
 
-	ClearBindParams();
+int DBI::MySQLStatementHandle::ErrorCode() const
+{
+	return m_stmt ? (int)mysql_stmt_errno(m_stmt) : 0;
 }
 
 void DBI::MySQLStatementHandle::BindArg(bool v, int i)
@@ -34,206 +89,504 @@ void DBI::MySQLStatementHandle::BindArg(bool v, int i)
 
 void DBI::MySQLStatementHandle::BindArg(int8_t v, int i)
 {
-	InitBindParam(i - 1);
-
-	auto &bind = m_bind_params[i - 1];
-	memset(&bind, 0, sizeof(bind));
+	auto &bind = InitBindParam(i - 1);
+	auto &buffer = m_bind_buffers[i - 1];
 
+	buffer.scalar.i8 = v;
 	bind.buffer_type = MYSQL_TYPE_TINY;
-	auto p = new int8_t(v);
-	bind.buffer = p;
+	bind.buffer = &buffer.scalar.i8;
 	bind.is_unsigned = 0;
-	bind.is_null = nullptr;
-	bind.length = 0;
 }
 
 void DBI::MySQLStatementHandle::BindArg(uint8_t v, int i)
 {
-	InitBindParam(i - 1);
-
-	auto &bind = m_bind_params[i - 1];
-	memset(&bind, 0, sizeof(bind));
+	auto &bind = InitBindParam(i - 1);
+	auto &buffer = m_bind_buffers[i - 1];
 
+	buffer.scalar.u8 = v;
 	bind.buffer_type = MYSQL_TYPE_TINY;
-	auto p = new uint8_t(v);
-	bind.buffer = p;
+	bind.buffer = &buffer.scalar.u8;
 	bind.is_unsigned = 1;
-	bind.is_null = nullptr;
-	bind.length = 0;
 }
 
 void DBI::MySQLStatementHandle::BindArg(int16_t v, int i)
 {
-	InitBindParam(i - 1);
-
-	auto &bind = m_bind_params[i - 1];
-	memset(&bind, 0, sizeof(bind));
+	auto &bind = InitBindParam(i - 1);
+	auto &buffer = m_bind_buffers[i - 1];
 
+	buffer.scalar.i16 = v;
 	bind.buffer_type = MYSQL_TYPE_SHORT;
-	auto p = new int16_t(v);
-	bind.buffer = p;
+	bind.buffer = &buffer.scalar.i16;
 	bind.is_unsigned = 0;
-	bind.is_null = nullptr;
-	bind.length = 0;
 }
 
 void DBI::MySQLStatementHandle::BindArg(uint16_t v, int i)
 {
-	InitBindParam(i - 1);
-
-	auto &bind = m_bind_params[i - 1];
-	memset(&bind, 0, sizeof(bind));
+	auto &bind = InitBindParam(i - 1);
+	auto &buffer = m_bind_buffers[i - 1];
 
+	buffer.scalar.u16 = v;
 	bind.buffer_type = MYSQL_TYPE_SHORT;
-	auto p = new uint16_t(v);
-	bind.buffer = p;
+	bind.buffer = &buffer.scalar.u16;
 	bind.is_unsigned = 1;
-	bind.is_null = nullptr;
-	bind.length = 0;
 }
 
 void DBI::MySQLStatementHandle::BindArg(int32_t v, int i)
 {
-	InitBindParam(i - 1);
-
-	auto &bind = m_bind_params[i - 1];
-	memset(&bind, 0, sizeof(bind));
+	auto &bind = InitBindParam(i - 1);
+	auto &buffer = m_bind_buffers[i - 1];
 
+	buffer.scalar.i32 = v;
 	bind.buffer_type = MYSQL_TYPE_LONG;
-	auto p = new int32_t(v);
-	bind.buffer = p;
+	bind.buffer = &buffer.scalar.i32;
 	bind.is_unsigned = 0;
-	bind.is_null = nullptr;
-	bind.length = 0;
 }
 
 void DBI::MySQLStatementHandle::BindArg(uint32_t v, int i)
 {
-	InitBindParam(i - 1);
-
-	auto &bind = m_bind_params[i - 1];
-	memset(&bind, 0, sizeof(bind));
+	auto &bind = InitBindParam(i - 1);
+	auto &buffer = m_bind_buffers[i - 1];
 
+	buffer.scalar.u32 = v;
 	bind.buffer_type = MYSQL_TYPE_LONG;
-	auto p = new uint32_t(v);
-	bind.buffer = p;
+	bind.buffer = &buffer.scalar.u32;
 	bind.is_unsigned = 1;
-	bind.is_null = nullptr;
-	bind.length = 0;
 }
 
 void DBI::MySQLStatementHandle::BindArg(int64_t v, int i)
 {
-	InitBindParam(i - 1);
-
-	auto &bind = m_bind_params[i - 1];
-	memset(&bind, 0, sizeof(bind));
+	auto &bind = InitBindParam(i - 1);
+	auto &buffer = m_bind_buffers[i - 1];
 
+	buffer.scalar.i64 = v;
 	bind.buffer_type = MYSQL_TYPE_LONGLONG;
-	auto p = new int64_t(v);
-	bind.buffer = p;
+	bind.buffer = &buffer.scalar.i64;
 	bind.is_unsigned = 0;
-	bind.is_null = nullptr;
-	bind.length = 0;
 }
 
 void DBI::MySQLStatementHandle::BindArg(uint64_t v, int i)
 {
-	InitBindParam(i - 1);
-
-	auto &bind = m_bind_params[i - 1];
-	memset(&bind, 0, sizeof(bind));
+	auto &bind = InitBindParam(i - 1);
+	auto &buffer = m_bind_buffers[i - 1];
 
+	buffer.scalar.u64 = v;
 	bind.buffer_type = MYSQL_TYPE_LONGLONG;
-	auto p = new uint64_t(v);
-	bind.buffer = p;
+	bind.buffer = &buffer.scalar.u64;
 	bind.is_unsigned = 1;
-	bind.is_null = nullptr;
-	bind.length = 0;
 }
 
 void DBI::MySQLStatementHandle::BindArg(float v, int i)
 {
-	InitBindParam(i - 1);
-
-	auto &bind = m_bind_params[i - 1];
-	memset(&bind, 0, sizeof(bind));
+	auto &bind = InitBindParam(i - 1);
+	auto &buffer = m_bind_buffers[i - 1];
 
+	buffer.scalar.f = v;
 	bind.buffer_type = MYSQL_TYPE_FLOAT;
-	auto p = new float(v);
-	bind.buffer = p;
+	bind.buffer = &buffer.scalar.f;
 	bind.is_unsigned = 0;
-	bind.is_null = nullptr;
-	bind.length = 0;
 }
 
 void DBI::MySQLStatementHandle::BindArg(double v, int i)
 {
-	InitBindParam(i - 1);
-
-	auto &bind = m_bind_params[i - 1];
-	memset(&bind, 0, sizeof(bind));
+	auto &bind = InitBindParam(i - 1);
+	auto &buffer = m_bind_buffers[i - 1];
 
+	buffer.scalar.d = v;
 	bind.buffer_type = MYSQL_TYPE_DOUBLE;
-	auto p = new double(v);
-	bind.buffer = p;
+	bind.buffer = &buffer.scalar.d;
 	bind.is_unsigned = 0;
-	bind.is_null = nullptr;
-	bind.length = 0;
 }
 
 void DBI::MySQLStatementHandle::BindArg(const std::string &v, int i)
+{
+	BindString(v.data(), v.length(), i);
+}
+
+void DBI::MySQLStatementHandle::BindArg(const char *v, int i)
+{
+	BindString(v, strlen(v), i);
+}
+
+void DBI::MySQLStatementHandle::BindArg(std::nullptr_t v, int i)
 {
 	InitBindParam(i - 1);
+}
 
-	auto &bind = m_bind_params[i - 1];
-	memset(&bind, 0, sizeof(bind));
+void DBI::MySQLStatementHandle::BindString(const char *v, size_t length, int i)
+{
+	auto &bind = InitBindParam(i - 1);
+	auto &buffer = m_bind_buffers[i - 1];
 
+	buffer.data.assign(v, v + length);
 	bind.buffer_type = MYSQL_TYPE_STRING;
+	bind.buffer = buffer.data.data();
+	bind.buffer_length = static_cast<unsigned long>(length);
+}
 
-	auto p = new char[v.length()];
-	memcpy(p, v.c_str(), v.length());
-	bind.buffer = p;
-	bind.is_unsigned = 0;
-	bind.is_null = nullptr;
-	bind.length = 0;
-	bind.buffer_length = static_cast<unsigned long>(v.length());
+void DBI::MySQLStatementHandle::BindParamBlock(const ParamBlock &params)
+{
+	//qualified calls so none of these go through the vtable
+	int i = 1;
+	for (const Param &param : params) {
+		switch (param.type) {
+		case Param::TypeNull:
+			MySQLStatementHandle::BindArg(nullptr, i);
+			break;
+		case Param::TypeBool:
+			MySQLStatementHandle::BindArg(param.i64 != 0, i);
+			break;
+		case Param::TypeInt8:
+			MySQLStatementHandle::BindArg(static_cast<int8_t>(param.i64), i);
+			break;
+		case Param::TypeUInt8:
+			MySQLStatementHandle::BindArg(static_cast<uint8_t>(param.i64), i);
+			break;
+		case Param::TypeInt16:
+			MySQLStatementHandle::BindArg(static_cast<int16_t>(param.i64), i);
+			break;
+		case Param::TypeUInt16:
+			MySQLStatementHandle::BindArg(static_cast<uint16_t>(param.i64), i);
+			break;
+		case Param::TypeInt32:
+			MySQLStatementHandle::BindArg(static_cast<int32_t>(param.i64), i);
+			break;
+		case Param::TypeUInt32:
+			MySQLStatementHandle::BindArg(static_cast<uint32_t>(param.i64), i);
+			break;
+		case Param::TypeInt64:
+			MySQLStatementHandle::BindArg(param.i64, i);
+			break;
+		case Param::TypeUInt64:
+			MySQLStatementHandle::BindArg(param.u64, i);
+			break;
+		case Param::TypeFloat:
+			MySQLStatementHandle::BindArg(static_cast<float>(param.d), i);
+			break;
+		case Param::TypeDouble:
+			MySQLStatementHandle::BindArg(param.d, i);
+			break;
+		case Param::TypeString:
+			BindString(param.data, param.length, i);
+			break;
+		}
+		++i;
+	}
 }
 
-void DBI::MySQLStatementHandle::BindArg(const char *v, int i)
+namespace DBI
 {
-	InitBindParam(i - 1);
+	//Owns the output buffers a statement's result columns are fetched into.
+	class MySQLResultBinder
+	{
+	public:
+		enum BindMode
+		{
+			//integer and floating point columns are fetched natively and strings are sized from
+			//max_length, needs mysql_stmt_store_result() with STMT_ATTR_UPDATE_MAX_LENGTH first
+			BindBuffered,
+			//every column is fetched as text into small buffers that grow on truncation
+			BindStreaming
+		};
+
+		enum ColumnKind
+		{
+			ColumnString,
+			ColumnSigned,
+			ColumnUnsigned,
+			ColumnFloat,
+			ColumnDouble
+		};
+
+		//Returns false if the statement has no result set.
+		bool Bind(MYSQL_STMT *stmt, BindMode mode) {
+			MYSQL_RES *res = mysql_stmt_result_metadata(stmt);
+			if (!res) {
+				return false;
+			}
 
-	auto &bind = m_bind_params[i - 1];
-	memset(&bind, 0, sizeof(bind));
+			uint32_t fields = mysql_num_fields(res);
+			binds.resize(fields);
+			kinds.resize(fields);
+			buffers.resize(fields);
+			is_null.resize(fields);
+			error.resize(fields);
+			lengths.resize(fields);
+			if (fields != 0) {
+				memset(&binds[0], 0, sizeof(MYSQL_BIND) * fields);
+			}
 
-	bind.buffer_type = MYSQL_TYPE_STRING;
+			MYSQL_FIELD *f = nullptr;
+			uint32_t i = 0;
+			while ((f = mysql_fetch_field(res)) != nullptr && i < fields) {
+				field_names.push_back(std::string(f->name));
 
-	auto v_length = strlen(v);
-	auto p = new char[v_length];
-	memcpy(p, v, v_length);
-	bind.buffer = p;
-	bind.is_unsigned = 0;
-	bind.is_null = nullptr;
-	bind.length = 0;
-	bind.buffer_length = static_cast<unsigned long>(v_length);
+				auto &bind = binds[i];
+				kinds[i] = mode == BindBuffered ? KindOf(f) : ColumnString;
+				switch (kinds[i]) {
+				case ColumnSigned:
+				case ColumnUnsigned:
+					buffers[i].resize(sizeof(int64_t));
+					bind.buffer_type = MYSQL_TYPE_LONGLONG;
+					bind.is_unsigned = kinds[i] == ColumnUnsigned ? 1 : 0;
+					break;
+				case ColumnFloat:
+					buffers[i].resize(sizeof(float));
+					bind.buffer_type = MYSQL_TYPE_FLOAT;
+					break;
+				case ColumnDouble:
+					buffers[i].resize(sizeof(double));
+					bind.buffer_type = MYSQL_TYPE_DOUBLE;
+					break;
+				default: {
+					//f->length is the declared width, 4GB for LONGTEXT/LONGBLOB, so it's never used directly
+					unsigned long length = mode == BindBuffered ? f->max_length : std::min(f->length, 256UL);
+					buffers[i].resize(length > 0 ? length : 1);
+					bind.buffer_type = MYSQL_TYPE_STRING;
+					break;
+				}
+				}
+
+				bind.buffer = &buffers[i][0];
+				bind.buffer_length = static_cast<unsigned long>(buffers[i].size());
+				bind.is_null = &is_null[i];
+				bind.error = &error[i];
+				bind.length = &lengths[i];
+				++i;
+			}
+			mysql_free_result(res);
+
+			if (fields != 0 && mysql_stmt_bind_result(stmt, &binds[0])) {
+				std::string err = "Statement bind result failure: ";
+				err += mysql_stmt_error(stmt);
+				throw std::runtime_error(err);
+			}
+
+			return true;
+		}
+
+		//Called after mysql_stmt_fetch() returns MYSQL_DATA_TRUNCATED, grows the
+		//short buffers, refetches those columns and keeps the bigger buffers bound.
+		void FetchTruncated(MYSQL_STMT *stmt) {
+			bool rebind = false;
+			for (size_t i = 0; i < binds.size(); ++i) {
+				if (kinds[i] != ColumnString || !error[i] || is_null[i] || lengths[i] <= binds[i].buffer_length) {
+					continue;
+				}
+
+				buffers[i].resize(lengths[i]);
+				binds[i].buffer = &buffers[i][0];
+				binds[i].buffer_length = lengths[i];
+				if (mysql_stmt_fetch_column(stmt, &binds[i], (unsigned int)i, 0)) {
+					std::string err = "Statement fetch column failure: ";
+					err += mysql_stmt_error(stmt);
+					throw std::runtime_error(err);
+				}
+				rebind = true;
+			}
+
+			if (rebind) {
+				mysql_stmt_bind_result(stmt, &binds[0]);
+			}
+		}
+
+		bool IsNull(size_t i) const { return is_null[i] ? true : false; }
+		bool IsError(size_t i) const { return error[i] ? true : false; }
+		const char *Data(size_t i) const { return &buffers[i][0]; }
+		unsigned long Length(size_t i) const { return std::min(lengths[i], binds[i].buffer_length); }
+
+		void AddRow(ResultSet &rs) const {
+			for (size_t i = 0; i < binds.size(); ++i) {
+				if (IsNull(i)) {
+					rs.AddNullField(IsError(i));
+					continue;
+				}
+
+				switch (kinds[i]) {
+				case ColumnSigned: {
+					int64_t v;
+					memcpy(&v, Data(i), sizeof(v));
+					rs.AddInt64Field(v, IsError(i));
+					break;
+				}
+				case ColumnUnsigned: {
+					uint64_t v;
+					memcpy(&v, Data(i), sizeof(v));
+					rs.AddUInt64Field(v, IsError(i));
+					break;
+				}
+				case ColumnFloat: {
+					float v;
+					memcpy(&v, Data(i), sizeof(v));
+					rs.AddFloatField(v, IsError(i));
+					break;
+				}
+				case ColumnDouble: {
+					double v;
+					memcpy(&v, Data(i), sizeof(v));
+					rs.AddDoubleField(v, IsError(i));
+					break;
+				}
+				default:
+					rs.AddField(Data(i), Length(i), IsError(i));
+					break;
+				}
+			}
+			rs.FinishRow();
+		}
+
+		std::vector<std::string> field_names;
+		std::vector<MYSQL_BIND> binds;
+		std::vector<ColumnKind> kinds;
+		std::vector<std::vector<char>> buffers;
+		std::vector<my_bool> is_null;
+		std::vector<my_bool> error;
+		std::vector<unsigned long> lengths;
+
+	private:
+		static ColumnKind KindOf(const MYSQL_FIELD *f) {
+			switch (f->type) {
+			case MYSQL_TYPE_TINY:
+			case MYSQL_TYPE_SHORT:
+			case MYSQL_TYPE_INT24:
+			case MYSQL_TYPE_LONG:
+			case MYSQL_TYPE_LONGLONG:
+			case MYSQL_TYPE_YEAR:
+				return (f->flags & UNSIGNED_FLAG) ? ColumnUnsigned : ColumnSigned;
+			case MYSQL_TYPE_FLOAT:
+				return ColumnFloat;
+			case MYSQL_TYPE_DOUBLE:
+				return ColumnDouble;
+			default:
+				//DECIMAL, BIT, temporal and string types keep their text form
+				return ColumnString;
+			}
+		}
+	};
 }
 
-void DBI::MySQLStatementHandle::BindArg(std::nullptr_t v, int i)
+std::unique_ptr<DBI::ResultSet> DBI::MySQLStatementHandle::InternalExecute()
 {
-	InitBindParam(i - 1);
+	BindAndExecute();
 
-	auto &bind = m_bind_params[i - 1];
-	memset(&bind, 0, sizeof(bind));
+	//buffering first fills in max_length so string columns can be bound at their real size
+	if (mysql_stmt_store_result(m_stmt)) {
+		std::string err = "Statement store result failure: ";
+		err += mysql_stmt_error(m_stmt);
+		throw std::runtime_error(err);
+	}
 
-	bind.buffer_type = MYSQL_TYPE_NULL;
-	bind.buffer = nullptr;
-	bind.is_unsigned = 0;
-	bind.is_null = nullptr;
-	bind.length = 0;
+	return FetchStored();
 }
 
-std::unique_ptr<DBI::ResultSet> DBI::MySQLStatementHandle::InternalExecute()
+std::unique_ptr<DBI::ResultSet> DBI::MySQLStatementHandle::FetchStored()
+{
+	MySQLResultBinder binder;
+	bool has_rows = binder.Bind(m_stmt, MySQLResultBinder::BindBuffered);
+
+	std::unique_ptr<ResultSet> rs(new ResultSet(std::move(binder.field_names), 0));
+	rs->Reserve(static_cast<size_t>(mysql_stmt_num_rows(m_stmt)), 0);
+
+	int rc = MYSQL_NO_DATA;
+	if (has_rows) {
+		while ((rc = mysql_stmt_fetch(m_stmt)) == 0 || rc == MYSQL_DATA_TRUNCATED) {
+			if (rc == MYSQL_DATA_TRUNCATED) {
+				binder.FetchTruncated(m_stmt);
+			}
+			binder.AddRow(*rs);
+		}
+	}
+
+	//same as MySQLCursor::Next(), a failed fetch must not pass for the end of the rows
+	if (rc != MYSQL_NO_DATA) {
+		std::string err = "Statement fetch failure: ";
+		err += mysql_stmt_error(m_stmt);
+		mysql_stmt_free_result(m_stmt);
+		throw std::runtime_error(err);
+	}
+
+	rs->SetAffectedRows(static_cast<unsigned long>(mysql_stmt_affected_rows(m_stmt)));
+	mysql_stmt_free_result(m_stmt);
+	return rs;
+}
+
+std::unique_ptr<DBI::AsyncResult> DBI::MySQLStatementHandle::InternalExecuteAsync()
+{
+#ifdef MYSQL_WAIT_READ
+	BindParams();
+
+	int err = 0;
+	int status = mysql_stmt_execute_start(&err, m_stmt);
+	return std::unique_ptr<AsyncResult>(new MySQLAsyncResult(this, status, err));
+#else
+	return StatementHandle::InternalExecuteAsync();
+#endif
+}
+
+std::unique_ptr<DBI::Cursor> DBI::MySQLStatementHandle::InternalQuery()
+{
+	BindAndExecute();
+
+	//rows are left on the wire and pulled one at a time by the cursor
+	std::unique_ptr<MySQLResultBinder> binder(new MySQLResultBinder());
+	binder->Bind(m_stmt, MySQLResultBinder::BindStreaming);
+	return std::unique_ptr<Cursor>(new MySQLCursor(m_stmt, std::move(binder)));
+}
+
+void DBI::MySQLStatementHandle::BeginBatch(size_t)
+{
+	m_batch_affected = 0;
+	m_batch_transaction = false;
+
+	//same transaction handling as MySQLDatabaseHandle::Begin(), left alone if the caller already has one
+	if (m_handle->server_status & SERVER_STATUS_AUTOCOMMIT) {
+		if (mysql_autocommit(m_handle, 0)) {
+			std::string err = "Error starting batch: ";
+			err += mysql_error(m_handle);
+			throw std::runtime_error(err);
+		}
+		m_batch_transaction = true;
+	}
+}
+
+void DBI::MySQLStatementHandle::AddBatchRow()
+{
+	BindAndExecute();
+	m_batch_affected += static_cast<size_t>(mysql_stmt_affected_rows(m_stmt));
+
+	if (mysql_stmt_field_count(m_stmt) > 0) {
+		mysql_stmt_free_result(m_stmt);
+		mysql_stmt_reset(m_stmt);
+	}
+}
+
+size_t DBI::MySQLStatementHandle::FinishBatch()
+{
+	if (m_batch_transaction) {
+		if (mysql_commit(m_handle)) {
+			std::string err = "Error committing batch: ";
+			err += mysql_error(m_handle);
+			throw std::runtime_error(err);
+		}
+
+		mysql_autocommit(m_handle, 1);
+		m_batch_transaction = false;
+	}
+
+	return m_batch_affected;
+}
+
+void DBI::MySQLStatementHandle::AbortBatch()
+{
+	ClearBindParams();
+
+	if (m_batch_transaction) {
+		mysql_rollback(m_handle);
+		mysql_autocommit(m_handle, 1);
+		m_batch_transaction = false;
+	}
+}
+
+void DBI::MySQLStatementHandle::BindParams()
 {
 	if (m_bind_params.size() > 0) {
 		if (mysql_stmt_bind_param(m_stmt, &m_bind_params[0])) {
@@ -243,6 +596,11 @@ std::unique_ptr<DBI::ResultSet> DBI::MySQLStatementHandle::InternalExecute()
 			throw std::runtime_error(err);
 		}
 	}
+}
+
+void DBI::MySQLStatementHandle::BindAndExecute()
+{
+	BindParams();
 
 	if (mysql_stmt_execute(m_stmt)) {
 		ClearBindParams();
@@ -251,103 +609,222 @@ std::unique_ptr<DBI::ResultSet> DBI::MySQLStatementHandle::InternalExecute()
 		throw std::runtime_error(err);
 	}
 
-	MYSQL_RES *res = mysql_stmt_result_metadata(m_stmt);
-	std::vector<std::unique_ptr<char>> buffers;
-	std::unique_ptr<MYSQL_BIND> results(nullptr);
-	std::unique_ptr<my_bool> is_null(nullptr);
-	std::unique_ptr<my_bool> err(nullptr);
-	std::unique_ptr<unsigned long> len(nullptr);
-	std::vector<std::string> field_names;
-	uint32_t fields = 0;
+	ClearBindParams();
+}
 
-	if (res) {
-		fields = mysql_num_fields(res);
-		if (fields != 0) {
-			buffers.resize(fields);
-			results.reset(new MYSQL_BIND[fields]);
-			is_null.reset(new my_bool[fields]);
-			err.reset(new my_bool[fields]);
-			len.reset(new unsigned long[fields]);
-			memset(results.get(), 0, sizeof(MYSQL_BIND) * fields);
-			memset(is_null.get(), 0, sizeof(my_bool) * fields);
-			memset(err.get(), 0, sizeof(my_bool) * fields);
-			memset(len.get(), 0, sizeof(unsigned long) * fields);
+void DBI::MySQLStatementHandle::ClearBindParams()
+{
+	//string buffers keep their capacity so the next execute can reuse them
+	for (auto &bind : m_bind_params) {
+		memset(&bind, 0, sizeof(bind));
+		bind.buffer_type = MYSQL_TYPE_NULL;
+	}
+}
 
-			MYSQL_FIELD *f = nullptr;
-			uint32_t i = 0;
-			while ((f = mysql_fetch_field(res)) != nullptr) {
-				field_names.push_back(std::string(f->name));
+MYSQL_BIND &DBI::MySQLStatementHandle::InitBindParam(int i)
+{
+	if (i < 0 || static_cast<size_t>(i) >= m_bind_params.size()) {
+		throw std::runtime_error("Bind failure: parameter index out of range.");
+	}
 
-				buffers[i].reset(new char[f->length]);
-				results.get()[i].buffer_type = MYSQL_TYPE_STRING;
-				results.get()[i].buffer = buffers[i].get();
-				results.get()[i].buffer_length = f->length;
-				results.get()[i].is_null = &is_null.get()[i];
-				results.get()[i].error = &err.get()[i];
-				results.get()[i].length = &len.get()[i];
-				++i;
-			}
+	auto &bind = m_bind_params[i];
+	memset(&bind, 0, sizeof(bind));
+	bind.buffer_type = MYSQL_TYPE_NULL;
+	return bind;
+}
 
-			mysql_stmt_bind_result(m_stmt, results.get());
-		}
-		mysql_free_result(res);
+DBI::MySQLCursor::MySQLCursor(MYSQL_STMT *stmt_, std::unique_ptr<MySQLResultBinder> binder_)
+	: m_stmt(stmt_), m_binder(std::move(binder_)), m_done(false)
+{
+	m_fields = m_binder->field_names;
+}
+
+DBI::MySQLCursor::~MySQLCursor()
+{
+	Finish();
+}
+
+bool DBI::MySQLCursor::Next()
+{
+	if (m_done) {
+		return false;
 	}
 
-	if (mysql_stmt_store_result(m_stmt)) {
-		ClearBindParams();
-		return nullptr;
+	int rc = mysql_stmt_fetch(m_stmt);
+	if (rc == 0) {
+		return true;
 	}
 
-	std::list<DBI::ResultSet::Row> rows;
-	while (!mysql_stmt_fetch(m_stmt)) {
-		DBI::ResultSet::Row row;
+	if (rc == MYSQL_DATA_TRUNCATED) {
+		m_binder->FetchTruncated(m_stmt);
+		return true;
+	}
 
-		for (uint32_t i = 0; i < fields; ++i) {
-			std::string val;
-			if (len.get()[i] > 0) {
-				val.assign(buffers[i].get(), len.get()[i]);
-			}
+	if (rc == MYSQL_NO_DATA) {
+		Finish();
+		return false;
+	}
 
-			row[field_names[i]] = DBI::ResultSet::FieldData(is_null.get()[i] ? true : false, err.get()[i] ? true : false, val);
-		}
-		rows.push_back(row);
+	std::string err = "Statement fetch failure: ";
+	err += mysql_stmt_error(m_stmt);
+	Finish();
+	throw std::runtime_error(err);
+}
+
+bool DBI::MySQLCursor::IsNull(size_t col) const
+{
+	return m_binder->IsNull(col);
+}
+
+const char *DBI::MySQLCursor::GetData(size_t col) const
+{
+	return m_binder->Data(col);
+}
+
+size_t DBI::MySQLCursor::GetLength(size_t col) const
+{
+	return m_binder->Length(col);
+}
+
+void DBI::MySQLCursor::Finish()
+{
+	if (!m_done) {
+		mysql_stmt_free_result(m_stmt);
+		m_done = true;
 	}
+}
 
-	ClearBindParams();
-	ResultSet *rs = new ResultSet(field_names, rows, static_cast<unsigned long>(mysql_stmt_affected_rows(m_stmt)));
-	return std::unique_ptr<ResultSet>(rs);
+#ifdef MYSQL_WAIT_READ
+DBI::MySQLAsyncResult::MySQLAsyncResult(MySQLStatementHandle *statement_, int status_, int err_) : m_statement(statement_), m_status(0),
+	m_err(err_), m_ready(0), m_storing(false)
+{
+	SetStatus(status_);
 }
 
-void DBI::MySQLStatementHandle::ClearBindParams()
+DBI::MySQLAsyncResult::~MySQLAsyncResult() {
+	//the connection can't be used until the call in flight finishes
+	try {
+		Wait();
+	}
+	catch (std::exception&) {
+	}
+}
+
+int DBI::MySQLAsyncResult::Socket() const
 {
-	for (auto &bind : m_bind_params) {
-		if (bind.buffer_type == MYSQL_TYPE_STRING) {
-			delete[] bind.buffer;
-			continue;
+	return static_cast<int>(mysql_get_socket(m_statement->m_handle));
+}
+
+bool DBI::MySQLAsyncResult::Advance()
+{
+	MYSQL_STMT *stmt = m_statement->m_stmt;
+	for (;;) {
+		if (m_status) {
+			int ready = m_ready ? m_ready : ReadyEvents(0);
+			m_ready = 0;
+			if (!ready) {
+				return false;
+			}
+
+			SetStatus(m_storing ? mysql_stmt_store_result_cont(&m_err, stmt, ready) : mysql_stmt_execute_cont(&m_err, stmt, ready));
+			if (m_status) {
+				return false;
+			}
 		}
 
-		if (bind.buffer_type == MYSQL_TYPE_NULL) {
+		if (!m_storing) {
+			m_statement->ClearBindParams();
+			if (m_err) {
+				Fail(std::string("Statement execute failure: ") + mysql_stmt_error(stmt));
+				return true;
+			}
+
+			m_storing = true;
+			SetStatus(mysql_stmt_store_result_start(&m_err, stmt));
 			continue;
 		}
 
-		delete bind.buffer;
+		if (m_err) {
+			Fail(std::string("Statement store result failure: ") + mysql_stmt_error(stmt));
+			return true;
+		}
+
+		//rows are already buffered client side so this doesn't block
+		try {
+			Complete(m_statement->FetchStored());
+		}
+		catch (std::exception &ex) {
+			Fail(ex.what());
+		}
+		return true;
 	}
+}
+
+void DBI::MySQLAsyncResult::WaitForProgress()
+{
+	if (m_status) {
+		m_ready = ReadyEvents(-1);
+	}
+}
 
-	m_bind_params.clear();
+void DBI::MySQLAsyncResult::SetStatus(int status)
+{
+	m_status = status;
+	if (m_status & MYSQL_WAIT_TIMEOUT) {
+		m_deadline = std::chrono::steady_clock::now() + std::chrono::milliseconds(mysql_get_timeout_value_ms(m_statement->m_handle));
+	}
 }
 
-void DBI::MySQLStatementHandle::InitBindParam(int i)
+int DBI::MySQLAsyncResult::ReadyEvents(int timeout_ms)
 {
-	if (i >= m_bind_params.size()) {
-		m_bind_params.resize(i + 1);
+	int fd = Socket();
+	if (m_status & MYSQL_WAIT_TIMEOUT) {
+		auto remaining = std::chrono::duration_cast<std::chrono::milliseconds>(m_deadline - std::chrono::steady_clock::now()).count();
+		if (remaining <= 0) {
+			return MYSQL_WAIT_TIMEOUT;
+		}
+
+		if (timeout_ms < 0 || remaining < timeout_ms) {
+			timeout_ms = static_cast<int>(remaining);
+		}
+	}
+
+	fd_set read_set;
+	fd_set write_set;
+	fd_set except_set;
+	FD_ZERO(&read_set);
+	FD_ZERO(&write_set);
+	FD_ZERO(&except_set);
+	if (m_status & MYSQL_WAIT_READ) {
+		FD_SET(fd, &read_set);
+	}
+	if (m_status & MYSQL_WAIT_WRITE) {
+		FD_SET(fd, &write_set);
+	}
+	if (m_status & MYSQL_WAIT_EXCEPT) {
+		FD_SET(fd, &except_set);
 	}
-	else {
-		auto &bind = m_bind_params[i];
 
-		if (bind.buffer_type == MYSQL_TYPE_STRING) {
-			delete[] bind.buffer;
-		} else if (bind.buffer_type != MYSQL_TYPE_NULL) {
-			delete bind.buffer;
+	timeval timeout;
+	timeout.tv_sec = timeout_ms / 1000;
+	timeout.tv_usec = (timeout_ms % 1000) * 1000;
+	if (select(fd + 1, &read_set, &write_set, &except_set, timeout_ms < 0 ? nullptr : &timeout) <= 0) {
+		if ((m_status & MYSQL_WAIT_TIMEOUT) && std::chrono::steady_clock::now() >= m_deadline) {
+			return MYSQL_WAIT_TIMEOUT;
 		}
+		return 0;
+	}
+
+	int ready = 0;
+	if (FD_ISSET(fd, &read_set)) {
+		ready |= MYSQL_WAIT_READ;
 	}
+	if (FD_ISSET(fd, &write_set)) {
+		ready |= MYSQL_WAIT_WRITE;
+	}
+	if (FD_ISSET(fd, &except_set)) {
+		ready |= MYSQL_WAIT_EXCEPT;
+	}
+	return ready;
 }
+#endif
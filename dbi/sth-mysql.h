@@ -5,12 +5,16 @@
 namespace DBI
 {
 	class ResultSet;
+	class MySQLResultBinder;
+	class MySQLAsyncResult;
 
 	class MySQLStatementHandle : public StatementHandle
 	{
 	public:
 		virtual ~MySQLStatementHandle();
 
+		virtual int ErrorCode() const;
+
 	protected:
 		virtual void BindArg(bool v, int i);
 		virtual void BindArg(int8_t v, int i);
@@ -26,18 +30,71 @@ namespace DBI
 		virtual void BindArg(const std::string &v, int i);
 		virtual void BindArg(const char *v, int i);
 		virtual void BindArg(std::nullptr_t v, int i);
+		virtual void BindParamBlock(const ParamBlock &params);
+		void BindString(const char *v, size_t length, int i);
 		virtual std::unique_ptr<ResultSet> InternalExecute();
+		virtual std::unique_ptr<Cursor> InternalQuery();
+		//MariaDB Connector/C's non blocking API when built against it, a worker thread otherwise.
+		virtual std::unique_ptr<AsyncResult> InternalExecuteAsync();
+		virtual void BeginBatch(size_t rows);
+		virtual void AddBatchRow();
+		virtual size_t FinishBatch();
+		virtual void AbortBatch();
+		void BindParams();
+		void BindAndExecute();
+		//Reads the result of an execute that already finished and stored its rows.
+		std::unique_ptr<ResultSet> FetchStored();
 		void ClearBindParams();
-		void InitBindParam(int i);
+		MYSQL_BIND &InitBindParam(int i);
 
 		MySQLStatementHandle(MYSQL *handle_, MYSQL_STMT *stmt_);
 
+		struct BindBuffer
+		{
+			union
+			{
+				int8_t i8;
+				uint8_t u8;
+				int16_t i16;
+				uint16_t u16;
+				int32_t i32;
+				uint32_t u32;
+				int64_t i64;
+				uint64_t u64;
+				float f;
+				double d;
+			} scalar;
+			std::vector<char> data;
+		};
+
 		MYSQL *m_handle;
 		MYSQL_STMT *m_stmt;
 		std::vector<MYSQL_BIND> m_bind_params;
+		std::vector<BindBuffer> m_bind_buffers;
+		size_t m_batch_affected;
+		bool m_batch_transaction;
 
 		friend class DBI::MySQLDatabaseHandle;
+		friend class DBI::MySQLAsyncResult;
 	};
 
-}
+	class MySQLCursor : public Cursor
+	{
+	public:
+		MySQLCursor(MYSQL_STMT *stmt_, std::unique_ptr<MySQLResultBinder> binder_);
+		virtual ~MySQLCursor();
+
+		virtual bool Next();
+		virtual bool IsNull(size_t col) const;
+		virtual const char *GetData(size_t col) const;
+		virtual size_t GetLength(size_t col) const;
 
+	protected:
+		void Finish();
+
+		MYSQL_STMT *m_stmt;
+		std::unique_ptr<MySQLResultBinder> m_binder;
+		bool m_done;
+	};
+
+}
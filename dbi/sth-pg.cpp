@@ -18,17 +18,135 @@
 #include "sth-pg.h"
 #include "rs.h"
 #include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
 #include <string.h>
 #include <memory>
 #include <libpq-fe.h>
+#include "oid-pg.h"
 
-#define BYTEAOID 17
+//pipelined batches are synced and drained this often so neither side's socket buffer fills up
+#define BATCH_SYNC_ROWS 256
 
-DBI::PGStatementHandle::PGStatementHandle(PGconn *conn_, std::string name_) : m_handle(conn_), m_name(name_) {
+DBI::PGPreparedStatement::~PGPreparedStatement() {
+	auto owner = registry.lock();
+	if (owner) {
+		owner->Release(*this);
+	}
+}
+
+std::shared_ptr<DBI::PGPreparedStatement> DBI::PGStatementRegistry::Prepare(const std::string &query, int params)
+{
+	DeallocateReleased();
+
+	auto iter = m_statements.find(query);
+	if (iter != m_statements.end()) {
+		auto statement = iter->second.lock();
+		if (statement) {
+			return statement;
+		}
+	}
+
+	std::shared_ptr<PGPreparedStatement> statement(new PGPreparedStatement());
+	statement->name = "dbi_stmt_" + std::to_string(++m_statement_id);
+	statement->query = query;
+	statement->params = params;
+	PrepareOnServer(*statement);
+
+	statement->registry = shared_from_this();
+	m_statements[query] = statement;
+	return statement;
+}
+
+void DBI::PGStatementRegistry::Reprepare()
+{
+	//released statements died with the old session too
+	m_released.clear();
+
+	for (auto &entry : m_statements) {
+		auto statement = entry.second.lock();
+		if (statement) {
+			PrepareOnServer(*statement);
+		}
+	}
+}
+
+void DBI::PGStatementRegistry::PrepareOnServer(const PGPreparedStatement &statement)
+{
+	PGresult *res = PQprepare(m_handle, statement.name.c_str(), statement.query.c_str(), statement.params, nullptr);
+	if (PQresultStatus(res) == PGRES_TUPLES_OK || PQresultStatus(res) == PGRES_COMMAND_OK) {
+		PQclear(res);
+		return;
+	}
+
+	std::string error = "Prepare Error: ";
+	error += PQresultErrorMessage(res);
+	PQclear(res);
+	throw std::runtime_error(error);
+}
+
+void DBI::PGStatementRegistry::Release(PGPreparedStatement &statement)
+{
+	auto iter = m_statements.find(statement.query);
+	if (iter != m_statements.end() && iter->second.expired()) {
+		m_statements.erase(iter);
+	}
+
+	m_released.push_back(statement.name);
+	DeallocateReleased();
+}
+
+void DBI::PGStatementRegistry::DeallocateReleased()
+{
+	if (m_released.empty() || !Idle()) {
+		return;
+	}
+
+	std::string query;
+	for (auto &name : m_released) {
+		query += "DEALLOCATE " + name + ";";
+	}
+	m_released.clear();
+	PQclear(PQexec(m_handle, query.c_str()));
+}
+
+bool DBI::PGStatementRegistry::Idle() const
+{
+	//ACTIVE covers async queries and COPY in flight, a failed DEALLOCATE would also abort a caller's open transaction
+	if (PQtransactionStatus(m_handle) != PQTRANS_IDLE) {
+		return false;
+	}
+
+#ifdef LIBPQ_HAS_PIPELINING
+	if (PQpipelineStatus(m_handle) != PQ_PIPELINE_OFF) {
+		return false;
+	}
+#endif
+	return true;
+}
+
+DBI::PGStatementHandle::PGStatementHandle(PGconn *conn_, std::string name_, std::shared_ptr<PGPreparedStatement> prepared_)
+	: m_handle(conn_), m_name(name_), m_prepared(prepared_), m_fetch_rows(0), m_binary(false), m_binary_results(false),
+	m_batch_affected(0), m_batch_pending(0), m_batch_transaction(false), m_error_code(0) {
 }
 
 DBI::PGStatementHandle::~PGStatementHandle() {
+	ClearBindParams();
+}
 
+int DBI::PGStatementHandle::SQLStateCode(const PGresult *res)
+{
+	const char *state = res ? PQresultErrorField(res, PG_DIAG_SQLSTATE) : nullptr;
+	if (!state || strlen(state) != 5) {
+		return 0;
+	}
+
+	//MAKE_SQLSTATE: six bits per character, first character lowest
+	int code = 0;
+	for (int i = 0; i < 5; ++i) {
+		code |= ((state[i] - '0') & 0x3F) << (6 * i);
+	}
+	return code;
 }
 
 void DBI::PGStatementHandle::BindArg(bool v, int i)
@@ -43,6 +161,10 @@ void DBI::PGStatementHandle::BindArg(bool v, int i)
 
 void DBI::PGStatementHandle::BindArg(int8_t v, int i)
 {
+	if (BindBinaryInteger(v, i)) {
+		return;
+	}
+
 	InitBindParam(i - 1);
 
 	char val[64] = { 0 };
@@ -56,6 +178,10 @@ void DBI::PGStatementHandle::BindArg(int8_t v, int i)
 
 void DBI::PGStatementHandle::BindArg(uint8_t v, int i)
 {
+	if (BindBinaryInteger(v, i)) {
+		return;
+	}
+
 	InitBindParam(i - 1);
 
 	char val[64] = { 0 };
@@ -69,6 +195,10 @@ void DBI::PGStatementHandle::BindArg(uint8_t v, int i)
 
 void DBI::PGStatementHandle::BindArg(int16_t v, int i)
 {
+	if (BindBinaryInteger(v, i)) {
+		return;
+	}
+
 	InitBindParam(i - 1);
 
 	char val[64] = { 0 };
@@ -82,6 +212,10 @@ void DBI::PGStatementHandle::BindArg(int16_t v, int i)
 
 void DBI::PGStatementHandle::BindArg(uint16_t v, int i)
 {
+	if (BindBinaryInteger(v, i)) {
+		return;
+	}
+
 	InitBindParam(i - 1);
 
 	char val[64] = { 0 };
@@ -95,6 +229,10 @@ void DBI::PGStatementHandle::BindArg(uint16_t v, int i)
 
 void DBI::PGStatementHandle::BindArg(int32_t v, int i)
 {
+	if (BindBinaryInteger(v, i)) {
+		return;
+	}
+
 	InitBindParam(i - 1);
 
 	char val[64] = { 0 };
@@ -108,6 +246,10 @@ void DBI::PGStatementHandle::BindArg(int32_t v, int i)
 
 void DBI::PGStatementHandle::BindArg(uint32_t v, int i)
 {
+	if (BindBinaryInteger(v, i)) {
+		return;
+	}
+
 	InitBindParam(i - 1);
 
 	char val[64] = { 0 };
@@ -121,6 +263,10 @@ void DBI::PGStatementHandle::BindArg(uint32_t v, int i)
 
 void DBI::PGStatementHandle::BindArg(int64_t v, int i)
 {
+	if (BindBinaryInteger(v, i)) {
+		return;
+	}
+
 	InitBindParam(i - 1);
 
 	char val[64] = { 0 };
@@ -134,6 +280,10 @@ void DBI::PGStatementHandle::BindArg(int64_t v, int i)
 
 void DBI::PGStatementHandle::BindArg(uint64_t v, int i)
 {
+	if (v <= INT64_MAX && BindBinaryInteger(static_cast<int64_t>(v), i)) {
+		return;
+	}
+
 	InitBindParam(i - 1);
 
 	char val[64] = { 0 };
@@ -147,6 +297,10 @@ void DBI::PGStatementHandle::BindArg(uint64_t v, int i)
 
 void DBI::PGStatementHandle::BindArg(float v, int i)
 {
+	if (BindBinaryDouble(v, i)) {
+		return;
+	}
+
 	InitBindParam(i - 1);
 
 	char val[64] = { 0 };
@@ -160,6 +314,10 @@ void DBI::PGStatementHandle::BindArg(float v, int i)
 
 void DBI::PGStatementHandle::BindArg(double v, int i)
 {
+	if (BindBinaryDouble(v, i)) {
+		return;
+	}
+
 	InitBindParam(i - 1);
 
 	char val[64] = { 0 };
@@ -173,11 +331,30 @@ void DBI::PGStatementHandle::BindArg(double v, int i)
 
 void DBI::PGStatementHandle::BindArg(const std::string &v, int i)
 {
+	BindString(v.data(), v.length(), i);
+}
+
+void DBI::PGStatementHandle::BindArg(const char *v, int i)
+{
+	BindString(v, strlen(v), i);
+}
+
+void DBI::PGStatementHandle::BindArg(std::nullptr_t v, int i)
+{
+	InitBindParam(i - 1);
+}
+
+void DBI::PGStatementHandle::BindString(const char *v, size_t length, int i)
+{
+	if (BindBinaryBytes(v, length, i)) {
+		return;
+	}
+
 	InitBindParam(i - 1);
 
-	if (v.length() != strlen(v.c_str())) {
+	if (memchr(v, 0, length) != nullptr) {
 		size_t dest_len = 0;
-		auto converted = PQescapeByteaConn(m_handle, (unsigned char*)&v[0], v.length(), &dest_len);
+		auto converted = PQescapeByteaConn(m_handle, (const unsigned char*)v, length, &dest_len);
 		auto &bind = m_bind_params[i - 1];
 		bind = new char[dest_len + 1];
 		memcpy(bind, converted, dest_len);
@@ -187,105 +364,871 @@ void DBI::PGStatementHandle::BindArg(const std::string &v, int i)
 	}
 	else {
 		auto &bind = m_bind_params[i - 1];
-		bind = new char[v.length() + 1];
-		memcpy(bind, v.c_str(), v.length());
-		bind[v.length()] = 0;
+		bind = new char[length + 1];
+		memcpy(bind, v, length);
+		bind[length] = 0;
 	}
 }
 
-void DBI::PGStatementHandle::BindArg(const char *v, int i)
+void DBI::PGStatementHandle::BindParamBlock(const ParamBlock &params)
 {
-	InitBindParam(i - 1);
-	auto len = strlen(v);
+	//qualified calls so none of these go through the vtable
+	int i = 1;
+	for (const Param &param : params) {
+		switch (param.type) {
+		case Param::TypeNull:
+			PGStatementHandle::BindArg(nullptr, i);
+			break;
+		case Param::TypeBool:
+			PGStatementHandle::BindArg(param.i64 != 0, i);
+			break;
+		case Param::TypeInt8:
+			PGStatementHandle::BindArg(static_cast<int8_t>(param.i64), i);
+			break;
+		case Param::TypeUInt8:
+			PGStatementHandle::BindArg(static_cast<uint8_t>(param.i64), i);
+			break;
+		case Param::TypeInt16:
+			PGStatementHandle::BindArg(static_cast<int16_t>(param.i64), i);
+			break;
+		case Param::TypeUInt16:
+			PGStatementHandle::BindArg(static_cast<uint16_t>(param.i64), i);
+			break;
+		case Param::TypeInt32:
+			PGStatementHandle::BindArg(static_cast<int32_t>(param.i64), i);
+			break;
+		case Param::TypeUInt32:
+			PGStatementHandle::BindArg(static_cast<uint32_t>(param.i64), i);
+			break;
+		case Param::TypeInt64:
+			PGStatementHandle::BindArg(param.i64, i);
+			break;
+		case Param::TypeUInt64:
+			PGStatementHandle::BindArg(param.u64, i);
+			break;
+		case Param::TypeFloat:
+			PGStatementHandle::BindArg(static_cast<float>(param.d), i);
+			break;
+		case Param::TypeDouble:
+			PGStatementHandle::BindArg(param.d, i);
+			break;
+		case Param::TypeString:
+			BindString(param.data, param.length, i);
+			break;
+		}
+		++i;
+	}
+}
+
+std::unique_ptr<DBI::ResultSet> DBI::PGStatementHandle::InternalExecute()
+{
+	m_error_code = 0;
+	if (m_fetch_rows > 0) {
+		return StreamExecute();
+	}
+
+	PGresult *res = ExecPrepared();
+
+	if (res) {
+		if(PQresultStatus(res) == PGRES_TUPLES_OK || PQresultStatus(res) == PGRES_COMMAND_OK) {
+			auto rs = BuildResultSet(res);
+			PQclear(res);
+			return rs;
+		}
+
+		m_error_code = SQLStateCode(res);
+		PQclear(res);
+	}
+
+	std::string error = "Internal Execute Error: ";
+	error += PQerrorMessage(m_handle);
+	throw std::runtime_error(error);
+}
+
+std::unique_ptr<DBI::Cursor> DBI::PGStatementHandle::InternalQuery()
+{
+	if (!SendPrepared()) {
+		std::string error = "Internal Query Error: ";
+		error += PQerrorMessage(m_handle);
+		throw std::runtime_error(error);
+	}
+
+	//rows are handed to us a few at a time instead of buffering the whole set
+	SetRowMode(m_handle, m_fetch_rows > 0 ? m_fetch_rows : 1);
+	return std::unique_ptr<DBI::Cursor>(new PGCursor(m_handle));
+}
+
+std::unique_ptr<DBI::AsyncResult> DBI::PGStatementHandle::InternalExecuteAsync()
+{
+	if (PQsetnonblocking(m_handle, 1) != 0 || !SendPrepared(true)) {
+		std::string error = "Internal Execute Error: ";
+		error += PQerrorMessage(m_handle);
+		PQsetnonblocking(m_handle, 0);
+		throw std::runtime_error(error);
+	}
+
+	if (m_fetch_rows > 0) {
+		SetRowMode(m_handle, m_fetch_rows);
+	}
+	return std::unique_ptr<DBI::AsyncResult>(new PGAsyncResult(m_handle));
+}
+
+std::unique_ptr<DBI::ResultSet> DBI::PGStatementHandle::BuildResultSet(PGresult *res)
+{
+	size_t affected_rows = (size_t)atoi(PQcmdTuples(res));
+	std::unique_ptr<DBI::ResultSet> rs(new DBI::ResultSet(FieldNames(res), affected_rows));
+	rs->Reserve((size_t)PQntuples(res), 0);
+	AppendRows(*rs, res);
+	return rs;
+}
+
+std::vector<std::string> DBI::PGStatementHandle::FieldNames(PGresult *res)
+{
+	std::vector<std::string> field_names;
+	int field_c = PQnfields(res);
+	for(int i = 0; i < field_c; ++i) {
+		field_names.push_back(PQfname(res, i));
+	}
+
+	return field_names;
+}
+
+void DBI::PGStatementHandle::AppendRows(ResultSet &rs, PGresult *res)
+{
+	int field_c = PQnfields(res);
+	int row_c = PQntuples(res);
+	for(int r = 0; r < row_c; ++r) {
+		for(int f = 0; f < field_c; ++f) {
+			if(PQgetisnull(res, r, f)) {
+				rs.AddNullField();
+			} else if(PQfformat(res, f) == 1) {
+				AddBinaryField(rs, PQftype(res, f), PQgetvalue(res, r, f), (size_t)PQgetlength(res, r, f));
+			} else {
+				Oid t = PQftype(res, f);
+				if(t == BYTEAOID) {
+					size_t len = 0;
+					unsigned char *pure = PQunescapeBytea((const unsigned char*)PQgetvalue(res, r, f), &len);
+					rs.AddField((const char*)pure, len);
+					PQfreemem(pure);
+				} else {
+					rs.AddField(PQgetvalue(res, r, f), (size_t)PQgetlength(res, r, f));
+				}
+			}
+		}
+		rs.FinishRow();
+	}
+}
+
+std::unique_ptr<DBI::ResultSet> DBI::PGStatementHandle::StreamExecute()
+{
+	if (!SendPrepared(true)) {
+		std::string error = "Internal Execute Error: ";
+		error += PQerrorMessage(m_handle);
+		throw std::runtime_error(error);
+	}
+
+	//rows are moved into the ResultSet chunk by chunk so libpq never holds the whole set as well
+	SetRowMode(m_handle, m_fetch_rows);
+
+	std::unique_ptr<DBI::ResultSet> rs;
+	std::string error;
+	PGresult *res = nullptr;
+	while ((res = PQgetResult(m_handle)) != nullptr) {
+		if (IsRowResult(res) || PQresultStatus(res) == PGRES_TUPLES_OK || PQresultStatus(res) == PGRES_COMMAND_OK) {
+			if (!rs) {
+				rs.reset(new DBI::ResultSet(FieldNames(res), 0));
+			}
+
+			AppendRows(*rs, res);
+			if (!IsRowResult(res)) {
+				rs->SetAffectedRows((size_t)atoi(PQcmdTuples(res)));
+			}
+		}
+		else if (error.empty()) {
+			error = PQresultErrorMessage(res);
+			m_error_code = SQLStateCode(res);
+		}
+		PQclear(res);
+	}
+
+	if (!error.empty() || !rs) {
+		throw std::runtime_error("Internal Execute Error: " + (error.empty() ? std::string(PQerrorMessage(m_handle)) : error));
+	}
+
+	return rs;
+}
+
+void DBI::PGStatementHandle::SetRowMode(PGconn *conn, int rows)
+{
+#ifdef LIBPQ_HAS_CHUNK_MODE
+	if (rows > 1) {
+		PQsetChunkedRowsMode(conn, rows);
+		return;
+	}
+#else
+	//libpq older than 17 only has single row mode
+	(void)rows;
+#endif
+	PQsetSingleRowMode(conn);
+}
+
+bool DBI::PGStatementHandle::IsRowResult(const PGresult *res)
+{
+	auto status = PQresultStatus(res);
+#ifdef LIBPQ_HAS_CHUNK_MODE
+	if (status == PGRES_TUPLES_CHUNK) {
+		return true;
+	}
+#endif
+	return status == PGRES_SINGLE_TUPLE;
+}
+
+void DBI::PGStatementHandle::AddBinaryField(ResultSet &rs, unsigned int type, const char *v, size_t len)
+{
+	uint64_t bits = 0;
+	for (size_t b = 0; b < len && b < 8; ++b) {
+		bits = (bits << 8) | static_cast<unsigned char>(v[b]);
+	}
+
+	switch (type) {
+	case INT2OID:
+		rs.AddInt64Field(static_cast<int16_t>(bits));
+		break;
+	case INT4OID:
+		rs.AddInt64Field(static_cast<int32_t>(bits));
+		break;
+	case INT8OID:
+		rs.AddInt64Field(static_cast<int64_t>(bits));
+		break;
+	case OIDOID:
+		rs.AddUInt64Field(bits);
+		break;
+	case FLOAT4OID: {
+		uint32_t bits32 = static_cast<uint32_t>(bits);
+		float f;
+		memcpy(&f, &bits32, sizeof(f));
+		rs.AddFloatField(f);
+		break;
+	}
+	case FLOAT8OID: {
+		double d;
+		memcpy(&d, &bits, sizeof(d));
+		rs.AddDoubleField(d);
+		break;
+	}
+	case BOOLOID:
+		//same text the server would have sent
+		rs.AddField(bits ? "t" : "f", 1);
+		break;
+	default:
+		//bytea arrives raw and text types are their bytes
+		rs.AddField(v, len);
+		break;
+	}
+}
+
+PGresult *DBI::PGStatementHandle::ExecPrepared()
+{
+	int params = (int)m_bind_params.size();
+	return PQexecPrepared(m_handle, m_name.c_str(), params, params > 0 ? &m_bind_params[0] : nullptr,
+		params > 0 ? &m_param_lengths[0] : nullptr, params > 0 ? &m_param_formats[0] : nullptr, m_binary_results ? 1 : 0);
+}
+
+int DBI::PGStatementHandle::SendPrepared(bool binary_results)
+{
+	int params = (int)m_bind_params.size();
+	return PQsendQueryPrepared(m_handle, m_name.c_str(), params, params > 0 ? &m_bind_params[0] : nullptr,
+		params > 0 ? &m_param_lengths[0] : nullptr, params > 0 ? &m_param_formats[0] : nullptr,
+		binary_results && m_binary_results ? 1 : 0);
+}
+
+void DBI::PGStatementHandle::Describe()
+{
+	if (m_prepared && m_prepared->described) {
+		m_param_types = m_prepared->param_types;
+		m_binary_results = m_prepared->binary_results;
+	}
+	else {
+		PGresult *res = PQdescribePrepared(m_handle, m_name.c_str());
+		if (PQresultStatus(res) != PGRES_COMMAND_OK) {
+			std::string error = "Describe Error: ";
+			error += PQresultErrorMessage(res);
+			PQclear(res);
+			throw std::runtime_error(error);
+		}
+
+		m_param_types.clear();
+		for (int i = 0; i < PQnparams(res); ++i) {
+			m_param_types.push_back(PQparamtype(res, i));
+		}
+
+		//the result format is all or nothing so binary is only asked for when every column can be decoded
+		m_binary_results = true;
+		for (int i = 0; i < PQnfields(res); ++i) {
+			if (!IsBinaryResultType(PQftype(res, i))) {
+				m_binary_results = false;
+				break;
+			}
+		}
+		PQclear(res);
+
+		if (m_prepared) {
+			m_prepared->described = true;
+			m_prepared->param_types = m_param_types;
+			m_prepared->binary_results = m_binary_results;
+		}
+	}
+
+	ClearBindParams();
+	m_binary = true;
+	m_param_scalars.assign(m_param_types.size(), 0);
+	m_bind_params.assign(m_param_types.size(), nullptr);
+	m_param_lengths.assign(m_param_types.size(), 0);
+	m_param_formats.assign(m_param_types.size(), 0);
+}
+
+bool DBI::PGStatementHandle::IsBinaryResultType(unsigned int type)
+{
+	switch (type) {
+	case BOOLOID:
+	case BYTEAOID:
+	case CHAROID:
+	case NAMEOID:
+	case INT8OID:
+	case INT2OID:
+	case INT4OID:
+	case TEXTOID:
+	case OIDOID:
+	case FLOAT4OID:
+	case FLOAT8OID:
+	case BPCHAROID:
+	case VARCHAROID:
+		return true;
+	default:
+		return false;
+	}
+}
+
+bool DBI::PGStatementHandle::BindBinaryInteger(int64_t v, int i)
+{
+	if (!m_binary || static_cast<size_t>(i - 1) >= m_param_types.size()) {
+		return false;
+	}
 
+	int length = 0;
+	switch (m_param_types[i - 1]) {
+	case INT2OID:
+		if (v < INT16_MIN || v > INT16_MAX) {
+			return false;
+		}
+		length = 2;
+		break;
+	case INT4OID:
+		if (v < INT32_MIN || v > INT32_MAX) {
+			return false;
+		}
+		length = 4;
+		break;
+	case INT8OID:
+		length = 8;
+		break;
+	case BOOLOID:
+		v = v != 0 ? 1 : 0;
+		length = 1;
+		break;
+	case FLOAT4OID:
+	case FLOAT8OID:
+		return BindBinaryDouble(static_cast<double>(v), i);
+	default:
+		return false;
+	}
+
+	BindBinaryScalar(static_cast<uint64_t>(v), length, i);
+	return true;
+}
+
+bool DBI::PGStatementHandle::BindBinaryDouble(double v, int i)
+{
+	if (!m_binary || static_cast<size_t>(i - 1) >= m_param_types.size()) {
+		return false;
+	}
+
+	switch (m_param_types[i - 1]) {
+	case FLOAT4OID: {
+		float f = static_cast<float>(v);
+		uint32_t bits;
+		memcpy(&bits, &f, sizeof(bits));
+		BindBinaryScalar(bits, 4, i);
+		return true;
+	}
+	case FLOAT8OID: {
+		uint64_t bits;
+		memcpy(&bits, &v, sizeof(bits));
+		BindBinaryScalar(bits, 8, i);
+		return true;
+	}
+	default:
+		return false;
+	}
+}
+
+bool DBI::PGStatementHandle::BindBinaryBytes(const char *v, size_t len, int i)
+{
+	//text keeps going as text, its binary form is the same bytes anyway
+	if (!m_binary || static_cast<size_t>(i - 1) >= m_param_types.size() || m_param_types[i - 1] != BYTEAOID) {
+		return false;
+	}
+
+	InitBindParam(i - 1);
 	auto &bind = m_bind_params[i - 1];
 	bind = new char[len + 1];
 	memcpy(bind, v, len);
 	bind[len] = 0;
+	m_param_lengths[i - 1] = static_cast<int>(len);
+	m_param_formats[i - 1] = 1;
+	return true;
 }
 
-void DBI::PGStatementHandle::BindArg(std::nullptr_t v, int i)
+void DBI::PGStatementHandle::BindBinaryScalar(uint64_t v, int length, int i)
 {
 	InitBindParam(i - 1);
+
+	//network byte order into the param's own slot, nothing is allocated
+	char *out = reinterpret_cast<char*>(&m_param_scalars[i - 1]);
+	for (int b = 0; b < length; ++b) {
+		out[b] = static_cast<char>((v >> ((length - 1 - b) * 8)) & 0xFF);
+	}
+
+	m_bind_params[i - 1] = out;
+	m_param_lengths[i - 1] = length;
+	m_param_formats[i - 1] = 1;
 }
 
-std::unique_ptr<DBI::ResultSet> DBI::PGStatementHandle::InternalExecute()
+void DBI::PGStatementHandle::BeginBatch(size_t)
+{
+	m_batch_affected = 0;
+	m_batch_pending = 0;
+	m_batch_transaction = PQtransactionStatus(m_handle) == PQTRANS_IDLE;
+
+#ifdef LIBPQ_HAS_PIPELINING
+	//rows are sent back to back without waiting on the server for each result
+	if (!PQenterPipelineMode(m_handle)) {
+		std::string error = "Batch Error: ";
+		error += PQerrorMessage(m_handle);
+		throw std::runtime_error(error);
+	}
+
+	if (m_batch_transaction) {
+		try {
+			SendBatchCommand("BEGIN");
+		}
+		catch (...) {
+			PQexitPipelineMode(m_handle);
+			m_batch_transaction = false;
+			throw;
+		}
+	}
+#else
+	if (m_batch_transaction) {
+		ExecBatchCommand("BEGIN");
+	}
+#endif
+}
+
+void DBI::PGStatementHandle::AddBatchRow()
 {
-	PGresult *res;
-	if (m_bind_params.size() > 0) {
-		res = PQexecPrepared(m_handle, m_name.c_str(), (int)m_bind_params.size(), &m_bind_params[0], nullptr, nullptr, 0);
+#ifdef LIBPQ_HAS_PIPELINING
+	if (!SendPrepared()) {
+		std::string error = "Batch Error: ";
+		error += PQerrorMessage(m_handle);
+		throw std::runtime_error(error);
 	}
-	else {
-		res = PQexecPrepared(m_handle, m_name.c_str(), (int)m_bind_params.size(), nullptr, nullptr, nullptr, 0);
+
+	if (++m_batch_pending >= BATCH_SYNC_ROWS) {
+		SyncBatch();
+	}
+#else
+	AddBatchResult(ExecPrepared());
+#endif
+}
+
+size_t DBI::PGStatementHandle::FinishBatch()
+{
+#ifdef LIBPQ_HAS_PIPELINING
+	if (m_batch_transaction) {
+		SendBatchCommand("COMMIT");
 	}
 
-	if (res) {
-		if(PQresultStatus(res) == PGRES_TUPLES_OK || PQresultStatus(res) == PGRES_COMMAND_OK) {
-			std::vector<std::string> field_names;
-			std::list<DBI::ResultSet::Row> rows;
-			int field_c = PQnfields(res);
-			int row_c = PQntuples(res);
-			for(int i = 0; i < field_c; ++i) {
-				field_names.push_back(PQfname(res, i));
-			}
-		
-			for(int r = 0; r < row_c; ++r) {
-				DBI::ResultSet::Row row;
-				for(int f = 0; f < field_c; ++f) {
-					DBI::ResultSet::FieldData fd;
-					fd.error = false;
-					if(PQgetisnull(res, r, f)) {
-						fd.is_null = true;
-					} else {
-						fd.is_null = false;
-						Oid t = PQftype(res, f);
-						if(t == BYTEAOID) {
-							size_t len = 0;
-							unsigned char *pure = PQunescapeBytea((const unsigned char*)PQgetvalue(res, r, f), &len);
-							fd.value.assign((const char*)pure, len);
-							PQfreemem(pure);
-						} else {
-							fd.value.assign(PQgetvalue(res, r, f), (size_t)PQgetlength(res, r, f));
-						}
-					}
-		
-					row[PQfname(res, f)] = fd;
-				}
-				rows.push_back(row);
+	SyncBatch();
+	PQexitPipelineMode(m_handle);
+#else
+	if (m_batch_transaction) {
+		ExecBatchCommand("COMMIT");
+	}
+#endif
+
+	m_batch_transaction = false;
+	return m_batch_affected;
+}
+
+void DBI::PGStatementHandle::AbortBatch()
+{
+#ifdef LIBPQ_HAS_PIPELINING
+	if (PQpipelineStatus(m_handle) != PQ_PIPELINE_OFF) {
+		try {
+			SyncBatch();
+		}
+		catch (std::exception&) {
+		}
+		PQexitPipelineMode(m_handle);
+	}
+#endif
+
+	if (m_batch_transaction && PQtransactionStatus(m_handle) != PQTRANS_IDLE) {
+		PQclear(PQexec(m_handle, "ROLLBACK"));
+	}
+	m_batch_transaction = false;
+}
+
+void DBI::PGStatementHandle::SendBatchCommand(const char *command)
+{
+#ifdef LIBPQ_HAS_PIPELINING
+	//pipelines only allow the extended protocol so PQsendQuery() is out
+	if (!PQsendQueryParams(m_handle, command, 0, nullptr, nullptr, nullptr, nullptr, 0)) {
+		std::string error = "Batch Error: ";
+		error += PQerrorMessage(m_handle);
+		throw std::runtime_error(error);
+	}
+	++m_batch_pending;
+#endif
+}
+
+void DBI::PGStatementHandle::SyncBatch()
+{
+#ifdef LIBPQ_HAS_PIPELINING
+	if (!PQpipelineSync(m_handle)) {
+		std::string error = "Batch Error: ";
+		error += PQerrorMessage(m_handle);
+		throw std::runtime_error(error);
+	}
+
+	//every query yields its result then nullptr, the sync point ends the run
+	std::string error;
+	int empty = 0;
+	for (;;) {
+		PGresult *res = PQgetResult(m_handle);
+		if (!res) {
+			if (++empty > 1 && PQstatus(m_handle) == CONNECTION_BAD) {
+				error = PQerrorMessage(m_handle);
+				break;
 			}
-		
-			size_t affected_rows = (size_t)atoi(PQcmdTuples(res));
-			std::unique_ptr<DBI::ResultSet> rs(new DBI::ResultSet(field_names, rows, affected_rows));
-		
+			continue;
+		}
+		empty = 0;
+
+		ExecStatusType status = PQresultStatus(res);
+		if (status == PGRES_PIPELINE_SYNC) {
 			PQclear(res);
-			return rs;
+			break;
 		}
 
+		if (status == PGRES_COMMAND_OK || status == PGRES_TUPLES_OK) {
+			m_batch_affected += (size_t)atoi(PQcmdTuples(res));
+		}
+		else if (status != PGRES_PIPELINE_ABORTED && error.empty()) {
+			//only the first failure is interesting, the rest of the run is aborted because of it
+			error = PQresultErrorMessage(res);
+		}
 		PQclear(res);
 	}
 
-	std::string error = "Internal Execute Error: ";
+	m_batch_pending = 0;
+	if (!error.empty()) {
+		throw std::runtime_error("Batch Error: " + error);
+	}
+#endif
+}
+
+void DBI::PGStatementHandle::ExecBatchCommand(const char *command)
+{
+	AddBatchResult(PQexec(m_handle, command));
+}
+
+void DBI::PGStatementHandle::AddBatchResult(PGresult *res)
+{
+	if (res && (PQresultStatus(res) == PGRES_COMMAND_OK || PQresultStatus(res) == PGRES_TUPLES_OK)) {
+		m_batch_affected += (size_t)atoi(PQcmdTuples(res));
+		PQclear(res);
+		return;
+	}
+
+	PQclear(res);
+	std::string error = "Batch Error: ";
 	error += PQerrorMessage(m_handle);
 	throw std::runtime_error(error);
 }
 
 void DBI::PGStatementHandle::ClearBindParams()
 {
-	for (auto &param : m_bind_params) {
-		delete[] param;
+	for (size_t i = 0; i < m_bind_params.size(); ++i) {
+		FreeBindParam(i);
 	}
 
 	m_bind_params.clear();
+	m_param_lengths.clear();
+	m_param_formats.clear();
 }
 
 void DBI::PGStatementHandle::InitBindParam(int i)
 {
 	if (i >= m_bind_params.size()) {
 		m_bind_params.resize(i + 1);
+		m_param_lengths.resize(i + 1);
+		m_param_formats.resize(i + 1);
 	}
 	else {
-		auto &bind = m_bind_params[i];
-		delete[] bind;
-		bind = nullptr;
+		FreeBindParam(i);
+		m_bind_params[i] = nullptr;
+		m_param_lengths[i] = 0;
+		m_param_formats[i] = 0;
+	}
+}
+
+void DBI::PGStatementHandle::FreeBindParam(size_t i)
+{
+	//binary scalars point into m_param_scalars instead of owning a buffer
+	char *bind = m_bind_params[i];
+	if (i < m_param_scalars.size() && bind == reinterpret_cast<char*>(&m_param_scalars[i])) {
+		return;
+	}
+
+	delete[] bind;
+}
+
+
+DBI::PGCursor::PGCursor(PGconn *conn_) : m_handle(conn_), m_result(nullptr), m_pending(nullptr), m_row(0), m_done(false) {
+	m_pending = ReadResult();
+	if (m_pending) {
+		int field_c = PQnfields(m_pending);
+		for (int i = 0; i < field_c; ++i) {
+			m_fields.push_back(PQfname(m_pending, i));
+			m_bytea.push_back(PQftype(m_pending, i) == BYTEAOID);
+		}
 	}
+
+	m_unescaped_valid.resize(m_fields.size(), false);
+	m_unescaped.resize(m_fields.size());
+}
+
+DBI::PGCursor::~PGCursor() {
+	Finish();
+}
+
+bool DBI::PGCursor::Next()
+{
+	if (m_done) {
+		return false;
+	}
+
+	m_unescaped_valid.assign(m_fields.size(), false);
+	if (m_result && ++m_row < PQntuples(m_result)) {
+		return true;
+	}
+
+	if (m_result) {
+		PQclear(m_result);
+		m_result = nullptr;
+	}
+
+	PGresult *res = m_pending ? m_pending : ReadResult();
+	m_pending = nullptr;
+
+	//the set ends with a zero row PGRES_TUPLES_OK result followed by nullptr
+	while (res && !(PGStatementHandle::IsRowResult(res) && PQntuples(res) > 0)) {
+		PQclear(res);
+		res = ReadResult();
+	}
+
+	if (!res) {
+		m_done = true;
+		return false;
+	}
+
+	m_result = res;
+	m_row = 0;
+	return true;
+}
+
+bool DBI::PGCursor::IsNull(size_t col) const
+{
+	return PQgetisnull(m_result, m_row, (int)col) ? true : false;
+}
+
+const char *DBI::PGCursor::GetData(size_t col) const
+{
+	if (m_bytea[col]) {
+		return Unescaped(col).c_str();
+	}
+
+	return PQgetvalue(m_result, m_row, (int)col);
+}
+
+size_t DBI::PGCursor::GetLength(size_t col) const
+{
+	if (m_bytea[col]) {
+		return Unescaped(col).length();
+	}
+
+	return (size_t)PQgetlength(m_result, m_row, (int)col);
+}
+
+PGresult *DBI::PGCursor::ReadResult()
+{
+	PGresult *res = PQgetResult(m_handle);
+	if (!res) {
+		return nullptr;
+	}
+
+	auto status = PQresultStatus(res);
+	if (PGStatementHandle::IsRowResult(res) || status == PGRES_TUPLES_OK || status == PGRES_COMMAND_OK) {
+		return res;
+	}
+
+	std::string error = "Internal Query Error: ";
+	error += PQresultErrorMessage(res);
+	PQclear(res);
+	Finish();
+	throw std::runtime_error(error);
+}
+
+void DBI::PGCursor::Finish()
+{
+	if (m_result) {
+		PQclear(m_result);
+		m_result = nullptr;
+	}
+
+	if (m_pending) {
+		PQclear(m_pending);
+		m_pending = nullptr;
+	}
+
+	if (!m_done) {
+		//the connection can't be used again until every result has been read off it
+		PGresult *res = nullptr;
+		while ((res = PQgetResult(m_handle)) != nullptr) {
+			PQclear(res);
+		}
+		m_done = true;
+	}
+}
+
+const std::string &DBI::PGCursor::Unescaped(size_t col) const
+{
+	if (!m_unescaped_valid[col]) {
+		size_t len = 0;
+		unsigned char *pure = PQunescapeBytea((const unsigned char*)PQgetvalue(m_result, m_row, (int)col), &len);
+		if (pure) {
+			m_unescaped[col].assign((const char*)pure, len);
+			PQfreemem(pure);
+		}
+		else {
+			m_unescaped[col].clear();
+		}
+		m_unescaped_valid[col] = true;
+	}
+
+	return m_unescaped[col];
+}
+
+DBI::PGAsyncResult::PGAsyncResult(PGconn *conn_) : m_handle(conn_), m_flushing(true)
+{
+}
+
+DBI::PGAsyncResult::~PGAsyncResult() {
+	if (!m_done) {
+		//the connection has to be drained before anything else can use it
+		PQsetnonblocking(m_handle, 0);
+		PGresult *res = nullptr;
+		while ((res = PQgetResult(m_handle)) != nullptr) {
+			PQclear(res);
+		}
+	}
+}
+
+int DBI::PGAsyncResult::Socket() const
+{
+	return PQsocket(m_handle);
+}
+
+bool DBI::PGAsyncResult::Advance()
+{
+	if (m_flushing) {
+		int flushed = PQflush(m_handle);
+		if (flushed < 0) {
+			m_execute_error = PQerrorMessage(m_handle);
+			return Finish();
+		}
+
+		if (flushed > 0) {
+			//the server may be blocked writing to us, reading unblocks it
+			if (!PQconsumeInput(m_handle)) {
+				m_execute_error = PQerrorMessage(m_handle);
+				return Finish();
+			}
+			return false;
+		}
+		m_flushing = false;
+	}
+
+	if (!PQconsumeInput(m_handle)) {
+		m_execute_error = PQerrorMessage(m_handle);
+		return Finish();
+	}
+
+	while (!PQisBusy(m_handle)) {
+		PGresult *res = PQgetResult(m_handle);
+		if (!res) {
+			return Finish();
+		}
+		AddResult(res);
+	}
+
+	return false;
+}
+
+void DBI::PGAsyncResult::WaitForProgress()
+{
+	WaitForSocket(Socket(), m_flushing, -1);
+}
+
+void DBI::PGAsyncResult::AddResult(PGresult *res)
+{
+	if (PGStatementHandle::IsRowResult(res) || PQresultStatus(res) == PGRES_TUPLES_OK || PQresultStatus(res) == PGRES_COMMAND_OK) {
+		if (!m_rs) {
+			m_rs.reset(new DBI::ResultSet(PGStatementHandle::FieldNames(res), 0));
+		}
+
+		PGStatementHandle::AppendRows(*m_rs, res);
+		if (!PGStatementHandle::IsRowResult(res)) {
+			m_rs->SetAffectedRows((size_t)atoi(PQcmdTuples(res)));
+		}
+	}
+	else if (m_execute_error.empty()) {
+		m_execute_error = PQresultErrorMessage(res);
+	}
+	PQclear(res);
+}
+
+bool DBI::PGAsyncResult::Finish()
+{
+	PQsetnonblocking(m_handle, 0);
+	if (!m_execute_error.empty() || !m_rs) {
+		Fail("Internal Execute Error: " + (m_execute_error.empty() ? std::string(PQerrorMessage(m_handle)) : m_execute_error));
+	}
+	else {
+		Complete(std::move(m_rs));
+	}
+
+	return true;
 }
@@ -2,20 +2,88 @@
 
 #include "dbh-pg.h"
 #include <vector>
+#include <unordered_map>
 
 struct pg_conn;
 typedef struct pg_conn PGconn;
 
+struct pg_result;
+typedef struct pg_result PGresult;
+
 namespace DBI
 {
 
 	class ResultSet;
+	class PGPipeline;
+	class PGStatementRegistry;
+	class PGCursor;
+	class PGAsyncResult;
+
+	//One server side prepared statement, shared by every handle prepared with the same SQL.
+	struct PGPreparedStatement
+	{
+		PGPreparedStatement() : params(0), described(false), binary_results(false) { }
+		~PGPreparedStatement();
+
+		std::string name;
+		std::string query;
+		int params;
+		//cached Describe() output so handles sharing the statement skip the round trip
+		bool described;
+		std::vector<unsigned int> param_types;
+		bool binary_results;
+		std::weak_ptr<PGStatementRegistry> registry;
+	};
+
+	/*
+		Per connection set of prepared statements keyed by their SQL.  Statements
+		get generated names, are shared while any handle holds them and are
+		DEALLOCATEd once the last one goes away.  The last handle can go away
+		while the connection is busy with a pipeline, an async query or a
+		transaction, so released names are queued and sent once it is idle.
+	*/
+	class PGStatementRegistry : public std::enable_shared_from_this<PGStatementRegistry>
+	{
+	public:
+		PGStatementRegistry(PGconn *conn_) : m_handle(conn_), m_statement_id(0) { }
+
+		//Returns the live statement for query or prepares a new one.
+		std::shared_ptr<PGPreparedStatement> Prepare(const std::string &query, int params);
+
+		//Prepares every live statement again, for after the connection was reset.
+		void Reprepare();
+
+		//Sends the queued DEALLOCATEs if the connection is idle, otherwise leaves them queued.
+		void DeallocateReleased();
+
+		size_t Size() const { return m_statements.size(); }
+		//Released statements still waiting to be DEALLOCATEd.
+		size_t Released() const { return m_released.size(); }
+
+	private:
+		void PrepareOnServer(const PGPreparedStatement &statement);
+		void Release(PGPreparedStatement &statement);
+		bool Idle() const;
+
+		PGconn *m_handle;
+		unsigned long m_statement_id;
+		std::unordered_map<std::string, std::weak_ptr<PGPreparedStatement>> m_statements;
+		std::vector<std::string> m_released;
+
+		friend struct DBI::PGPreparedStatement;
+	};
 
 	class PGStatementHandle : public StatementHandle
 	{
 	public:
 		virtual ~PGStatementHandle();
 
+		//SQLSTATE of the last failed execute, see SQLStateCode().
+		virtual int ErrorCode() const { return m_error_code; }
+
+		//SQLSTATE of res packed like the server's ERRCODE_ macros, 0 if it has none.
+		static int SQLStateCode(const PGresult *res);
+
 	protected:
 		virtual void BindArg(bool v, int i);
 		virtual void BindArg(int8_t v, int i);
@@ -31,17 +99,117 @@ namespace DBI
 		virtual void BindArg(const std::string &v, int i);
 		virtual void BindArg(const char *v, int i);
 		virtual void BindArg(std::nullptr_t v, int i);
+		virtual void BindParamBlock(const ParamBlock &params);
+		void BindString(const char *v, size_t length, int i);
 		virtual std::unique_ptr<ResultSet> InternalExecute();
+		virtual std::unique_ptr<Cursor> InternalQuery();
+		virtual std::unique_ptr<AsyncResult> InternalExecuteAsync();
+		virtual void BeginBatch(size_t rows);
+		virtual void AddBatchRow();
+		virtual size_t FinishBatch();
+		virtual void AbortBatch();
 		void ClearBindParams();
 		void InitBindParam(int i);
+		void FreeBindParam(size_t i);
+		PGresult *ExecPrepared();
+		//Sends the statement with the bound params without waiting for the result.
+		int SendPrepared(bool binary_results = false);
+		//Looks up the param and result types so binds and results can use the binary format.
+		void Describe();
+		bool BindBinaryInteger(int64_t v, int i);
+		bool BindBinaryDouble(double v, int i);
+		bool BindBinaryBytes(const char *v, size_t len, int i);
+		void BindBinaryScalar(uint64_t v, int length, int i);
+		static bool IsBinaryResultType(unsigned int type);
+		std::unique_ptr<ResultSet> StreamExecute();
+		static std::unique_ptr<ResultSet> BuildResultSet(PGresult *res);
+		static std::vector<std::string> FieldNames(PGresult *res);
+		static void AppendRows(ResultSet &rs, PGresult *res);
+		//Chunked rows mode where libpq has it (17+), single row mode otherwise.
+		static void SetRowMode(PGconn *conn, int rows);
+		static bool IsRowResult(const PGresult *res);
+		static void AddBinaryField(ResultSet &rs, unsigned int type, const char *v, size_t len);
+		void SendBatchCommand(const char *command);
+		void SyncBatch();
+		void ExecBatchCommand(const char *command);
+		void AddBatchResult(PGresult *res);
 
-		PGStatementHandle(PGconn *conn_, std::string name_);
+		PGStatementHandle(PGconn *conn_, std::string name_, std::shared_ptr<PGPreparedStatement> prepared_ = nullptr);
 
 		PGconn *m_handle;
 		std::string m_name;
+		//null for statements the caller named
+		std::shared_ptr<PGPreparedStatement> m_prepared;
+		//rows per chunk when streaming, 0 has Execute() buffer the whole result in libpq
+		int m_fetch_rows;
 		std::vector<char*> m_bind_params;
+		std::vector<int> m_param_lengths;
+		std::vector<int> m_param_formats;
+		//binary mode only, filled in by Describe()
+		bool m_binary;
+		bool m_binary_results;
+		std::vector<unsigned int> m_param_types;
+		std::vector<uint64_t> m_param_scalars;
+		size_t m_batch_affected;
+		size_t m_batch_pending;
+		bool m_batch_transaction;
+		int m_error_code;
 
 		friend class DBI::PGDatabaseHandle;
+		friend class DBI::PGPipeline;
+		friend class DBI::PGCursor;
+		friend class DBI::PGAsyncResult;
+	};
+
+	class PGCursor : public Cursor
+	{
+	public:
+		PGCursor(PGconn *conn_);
+		virtual ~PGCursor();
+
+		virtual bool Next();
+		virtual bool IsNull(size_t col) const;
+		virtual const char *GetData(size_t col) const;
+		virtual size_t GetLength(size_t col) const;
+
+	protected:
+		PGresult *ReadResult();
+		void Finish();
+		const std::string &Unescaped(size_t col) const;
+
+		PGconn *m_handle;
+		PGresult *m_result;
+		PGresult *m_pending;
+		//row within m_result, chunked results carry more than one
+		int m_row;
+		bool m_done;
+		std::vector<bool> m_bytea;
+		mutable std::vector<bool> m_unescaped_valid;
+		mutable std::vector<std::string> m_unescaped;
 	};
-}
 
+	/*
+		Result of a query sent with the connection in non blocking mode, Socket()
+		is the connection's socket.  Blocking mode is restored once it finishes.
+	*/
+	class PGAsyncResult : public AsyncResult
+	{
+	public:
+		PGAsyncResult(PGconn *conn_);
+		virtual ~PGAsyncResult();
+
+		virtual int Socket() const;
+
+	protected:
+		virtual bool Advance();
+		virtual void WaitForProgress();
+		void AddResult(PGresult *res);
+		bool Finish();
+
+		PGconn *m_handle;
+		//still writing the query out, libpq buffers it when the socket is full
+		bool m_flushing;
+		std::unique_ptr<ResultSet> m_rs;
+		std::string m_execute_error;
+	};
+}
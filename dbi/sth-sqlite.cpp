@@ -23,7 +23,8 @@
 #include <memory>
 #include "sqlite3.h"
 
-DBI::SQLiteStatementHandle::SQLiteStatementHandle(sqlite3 *handle_, sqlite3_stmt *stmt_) : m_handle(handle_), m_stmt(stmt_) {
+DBI::SQLiteStatementHandle::SQLiteStatementHandle(sqlite3 *handle_, sqlite3_stmt *stmt_)
+	: m_handle(handle_), m_stmt(stmt_), m_batch_affected(0), m_batch_transaction(false) {
 }
 
 DBI::SQLiteStatementHandle::~SQLiteStatementHandle() {
@@ -32,6 +33,10 @@ DBI::SQLiteStatementHandle::~SQLiteStatementHandle() {
 	}
 }
 
+int DBI::SQLiteStatementHandle::ErrorCode() const {
+	return sqlite3_extended_errcode(m_handle);
+}
+
 void DBI::SQLiteStatementHandle::BindArg(bool v, int i)
 {
 	int8_t t = 0;
@@ -159,40 +164,73 @@ void DBI::SQLiteStatementHandle::BindArg(std::nullptr_t v, int i)
 	}
 }
 
-std::unique_ptr<DBI::ResultSet> DBI::SQLiteStatementHandle::InternalExecute()
+void DBI::SQLiteStatementHandle::BindParamBlock(const ParamBlock &params)
 {
-	int rc = 0;
-	std::vector<std::string> field_names;
-	std::list<DBI::ResultSet::Row> rows;
-	bool field_names_found = false;
-	int fields = 0;
+	int i = 1;
+	for (const Param &param : params) {
+		int rc = SQLITE_OK;
+		switch (param.type) {
+		case Param::TypeNull:
+			rc = sqlite3_bind_null(m_stmt, i);
+			break;
+		case Param::TypeUInt64:
+			rc = sqlite3_bind_int64(m_stmt, i, (int64_t)param.u64);
+			break;
+		case Param::TypeFloat:
+		case Param::TypeDouble:
+			rc = sqlite3_bind_double(m_stmt, i, param.d);
+			break;
+		case Param::TypeString:
+			rc = sqlite3_bind_text(m_stmt, i, param.data, (int)param.length, SQLITE_TRANSIENT);
+			break;
+		default:
+			//bool and the other integers are widened when packed
+			rc = sqlite3_bind_int64(m_stmt, i, param.i64);
+			break;
+		}
 
-	while ((rc = sqlite3_step(m_stmt)) == SQLITE_ROW) {
-		if (!field_names_found) {
-			fields = sqlite3_column_count(m_stmt);
-			for (int f = 0; f < fields; ++f) {
-				field_names.push_back(sqlite3_column_name(m_stmt, f));
-			}
-			field_names_found = true;
+		if (rc != SQLITE_OK) {
+			std::string err = "Bind failure: ";
+			err += sqlite3_errmsg(m_handle);
+			throw std::runtime_error(err);
 		}
+		++i;
+	}
+}
 
-		DBI::ResultSet::Row row;
+std::unique_ptr<DBI::ResultSet> DBI::SQLiteStatementHandle::InternalExecute()
+{
+	int rc = 0;
+	int fields = sqlite3_column_count(m_stmt);
+	std::unique_ptr<DBI::ResultSet> rs(new DBI::ResultSet(FieldNames(), 0));
+	while ((rc = sqlite3_step(m_stmt)) == SQLITE_ROW) {
 		for (int f = 0; f < fields; ++f) {
-			DBI::ResultSet::FieldData fd;
-			fd.error = false;
-
-			const unsigned char *v = sqlite3_column_text(m_stmt, f);
-			int len = sqlite3_column_bytes(m_stmt, f);
-			if (v) {
-				fd.is_null = false;
-				fd.value.assign((const char*)v, len);
+			//reading each cell as its storage class avoids SQLite converting numbers to text
+			switch (sqlite3_column_type(m_stmt, f)) {
+			case SQLITE_INTEGER:
+				rs->AddInt64Field(sqlite3_column_int64(m_stmt, f));
+				break;
+			case SQLITE_FLOAT:
+				rs->AddDoubleField(sqlite3_column_double(m_stmt, f));
+				break;
+			case SQLITE_BLOB: {
+				const void *v = sqlite3_column_blob(m_stmt, f);
+				int len = sqlite3_column_bytes(m_stmt, f);
+				rs->AddField(v ? (const char*)v : "", (size_t)len);
+				break;
+			}
+			case SQLITE_TEXT: {
+				const unsigned char *v = sqlite3_column_text(m_stmt, f);
+				int len = sqlite3_column_bytes(m_stmt, f);
+				rs->AddField(v ? (const char*)v : "", (size_t)len);
+				break;
 			}
-			else {
-				fd.is_null = true;
+			default:
+				rs->AddNullField();
+				break;
 			}
-			row[field_names[f]] = fd;
 		}
-		rows.push_back(row);
+		rs->FinishRow();
 	}
 
 	if (rc != SQLITE_DONE) {
@@ -204,9 +242,152 @@ std::unique_ptr<DBI::ResultSet> DBI::SQLiteStatementHandle::InternalExecute()
 		throw std::runtime_error(err);
 	}
 
-	size_t affected_rows = (size_t)sqlite3_changes(m_handle);
-	std::unique_ptr<DBI::ResultSet> rs(new DBI::ResultSet(field_names, rows, affected_rows));
+	rs->SetAffectedRows((size_t)sqlite3_changes(m_handle));
 	sqlite3_reset(m_stmt);
 	sqlite3_clear_bindings(m_stmt);
 	return rs;
+}
+
+const std::shared_ptr<const std::vector<std::string>> &DBI::SQLiteStatementHandle::FieldNames()
+{
+	int fields = sqlite3_column_count(m_stmt);
+	bool changed = !m_field_names || m_column_name_ptrs.size() != (size_t)fields;
+	for (int f = 0; f < fields && !changed; ++f) {
+		changed = sqlite3_column_name(m_stmt, f) != m_column_name_ptrs[f];
+	}
+
+	if (changed) {
+		//sets already returned keep the old names
+		std::vector<std::string> names;
+		m_column_name_ptrs.clear();
+		for (int f = 0; f < fields; ++f) {
+			const char *name = sqlite3_column_name(m_stmt, f);
+			m_column_name_ptrs.push_back(name);
+			names.push_back(name ? name : "");
+		}
+		m_field_names = std::make_shared<const std::vector<std::string>>(std::move(names));
+	}
+
+	return m_field_names;
+}
+
+std::unique_ptr<DBI::Cursor> DBI::SQLiteStatementHandle::InternalQuery()
+{
+	return std::unique_ptr<DBI::Cursor>(new SQLiteCursor(m_handle, m_stmt));
+}
+
+void DBI::SQLiteStatementHandle::BeginBatch(size_t)
+{
+	m_batch_affected = 0;
+	m_batch_transaction = false;
+
+	//one journal sync for the whole batch instead of one per row
+	if (sqlite3_get_autocommit(m_handle)) {
+		if (sqlite3_exec(m_handle, "BEGIN", nullptr, nullptr, nullptr) != SQLITE_OK) {
+			std::string err = "Error starting batch: ";
+			err += sqlite3_errmsg(m_handle);
+			throw std::runtime_error(err);
+		}
+		m_batch_transaction = true;
+	}
+}
+
+void DBI::SQLiteStatementHandle::AddBatchRow()
+{
+	int rc = 0;
+	while ((rc = sqlite3_step(m_stmt)) == SQLITE_ROW) {
+	}
+
+	if (rc != SQLITE_DONE) {
+		std::string err = "Error executing prepared statement: ";
+		err += sqlite3_errmsg(m_handle);
+		throw std::runtime_error(err);
+	}
+
+	m_batch_affected += (size_t)sqlite3_changes(m_handle);
+	sqlite3_reset(m_stmt);
+	sqlite3_clear_bindings(m_stmt);
+}
+
+size_t DBI::SQLiteStatementHandle::FinishBatch()
+{
+	if (m_batch_transaction) {
+		if (sqlite3_exec(m_handle, "COMMIT", nullptr, nullptr, nullptr) != SQLITE_OK) {
+			std::string err = "Error committing batch: ";
+			err += sqlite3_errmsg(m_handle);
+			throw std::runtime_error(err);
+		}
+		m_batch_transaction = false;
+	}
+
+	return m_batch_affected;
+}
+
+void DBI::SQLiteStatementHandle::AbortBatch()
+{
+	sqlite3_reset(m_stmt);
+	sqlite3_clear_bindings(m_stmt);
+
+	if (m_batch_transaction) {
+		sqlite3_exec(m_handle, "ROLLBACK", nullptr, nullptr, nullptr);
+		m_batch_transaction = false;
+	}
+}
+
+DBI::SQLiteCursor::SQLiteCursor(sqlite3 *handle_, sqlite3_stmt *stmt_) : m_handle(handle_), m_stmt(stmt_), m_done(false) {
+	int fields = sqlite3_column_count(m_stmt);
+	for (int f = 0; f < fields; ++f) {
+		m_fields.push_back(sqlite3_column_name(m_stmt, f));
+	}
+}
+
+DBI::SQLiteCursor::~SQLiteCursor() {
+	Finish();
+}
+
+bool DBI::SQLiteCursor::Next()
+{
+	if (m_done) {
+		return false;
+	}
+
+	int rc = sqlite3_step(m_stmt);
+	if (rc == SQLITE_ROW) {
+		return true;
+	}
+
+	if (rc != SQLITE_DONE) {
+		std::string err = "Error executing prepared statement: ";
+		err += sqlite3_errmsg(m_handle);
+		Finish();
+		throw std::runtime_error(err);
+	}
+
+	Finish();
+	return false;
+}
+
+bool DBI::SQLiteCursor::IsNull(size_t col) const
+{
+	return sqlite3_column_type(m_stmt, (int)col) == SQLITE_NULL;
+}
+
+const char *DBI::SQLiteCursor::GetData(size_t col) const
+{
+	const unsigned char *v = sqlite3_column_text(m_stmt, (int)col);
+	return v ? (const char*)v : "";
+}
+
+size_t DBI::SQLiteCursor::GetLength(size_t col) const
+{
+	return (size_t)sqlite3_column_bytes(m_stmt, (int)col);
+}
+
+void DBI::SQLiteCursor::Finish()
+{
+	if (!m_done) {
+		sqlite3_reset(m_stmt);
+		sqlite3_clear_bindings(m_stmt);
+		m_done = true;
+	}
 }
\ No newline at end of file
@@ -1,6 +1,7 @@
 #pragma once
 
 #include "dbh-sqlite.h"
+#include <vector>
 
 struct sqlite3;
 struct sqlite3_stmt;
@@ -14,6 +15,8 @@ namespace DBI
 	{
 	public:
 		virtual ~SQLiteStatementHandle();
+
+		virtual int ErrorCode() const;
 	
 	protected:
 		virtual void BindArg(bool v, int i);
@@ -30,15 +33,47 @@ namespace DBI
 		virtual void BindArg(const std::string &v, int i);
 		virtual void BindArg(const char *v, int i);
 		virtual void BindArg(std::nullptr_t v, int i);
+		virtual void BindParamBlock(const ParamBlock &params);
 		virtual std::unique_ptr<ResultSet> InternalExecute();
+		virtual std::unique_ptr<Cursor> InternalQuery();
+		virtual void BeginBatch(size_t rows);
+		virtual void AddBatchRow();
+		virtual size_t FinishBatch();
+		virtual void AbortBatch();
+		//Shared with every ResultSet built while the columns stay the same.
+		const std::shared_ptr<const std::vector<std::string>> &FieldNames();
 
 		SQLiteStatementHandle(sqlite3 *handle_, sqlite3_stmt *stmt_);
 
 		sqlite3 *m_handle;
 		sqlite3_stmt *m_stmt;
+		size_t m_batch_affected;
+		bool m_batch_transaction;
+		//sqlite3_column_name() pointers the cached names were built from, they change if SQLite re-prepares
+		std::vector<const char*> m_column_name_ptrs;
+		std::shared_ptr<const std::vector<std::string>> m_field_names;
 
 		friend class DBI::SQLiteDatabaseHandle;
 	};
 
+	class SQLiteCursor : public Cursor
+	{
+	public:
+		SQLiteCursor(sqlite3 *handle_, sqlite3_stmt *stmt_);
+		virtual ~SQLiteCursor();
+
+		virtual bool Next();
+		virtual bool IsNull(size_t col) const;
+		virtual const char *GetData(size_t col) const;
+		virtual size_t GetLength(size_t col) const;
+
+	protected:
+		void Finish();
+
+		sqlite3 *m_handle;
+		sqlite3_stmt *m_stmt;
+		bool m_done;
+	};
+
 }
 
@@ -18,6 +18,269 @@
 #include "sth.h"
 #include "rs.h"
 
+namespace
+{
+	//Cursor handed out by an observed Query(), reports the fetch phase once when done.
+	class ObservedCursor : public DBI::Cursor
+	{
+	public:
+		ObservedCursor(std::unique_ptr<DBI::Cursor> cursor_, std::shared_ptr<DBI::QueryObserver> observer_, const std::string &sql_)
+			: m_cursor(std::move(cursor_)), m_observer(observer_), m_sql(sql_), m_nanoseconds(0), m_rows(0), m_bytes(0), m_reported(false)
+		{
+			m_fields = m_cursor->Fields();
+		}
+
+		virtual ~ObservedCursor() {
+			Report(nullptr);
+		}
+
+		virtual bool Next() {
+			DBI::QueryClock::time_point start = DBI::QueryClock::now();
+			if (m_rows == 0) {
+				m_start = start;
+			}
+
+			bool more = false;
+			try {
+				more = m_cursor->Next();
+			}
+			catch (std::exception &ex) {
+				m_nanoseconds += Since(start);
+				Report(ex.what());
+				throw;
+			}
+
+			if (more) {
+				m_rows++;
+				for (size_t i = 0; i < m_fields.size(); ++i) {
+					m_bytes += m_cursor->GetLength(i);
+				}
+			}
+			m_nanoseconds += Since(start);
+
+			if (!more) {
+				Report(nullptr);
+			}
+			return more;
+		}
+
+		virtual bool IsNull(size_t col) const { return m_cursor->IsNull(col); }
+		virtual const char *GetData(size_t col) const { return m_cursor->GetData(col); }
+		virtual size_t GetLength(size_t col) const { return m_cursor->GetLength(col); }
+
+	private:
+		static uint64_t Since(DBI::QueryClock::time_point start) {
+			return (uint64_t)std::chrono::duration_cast<std::chrono::nanoseconds>(DBI::QueryClock::now() - start).count();
+		}
+
+		void Report(const char *error) {
+			if (m_reported) {
+				return;
+			}
+
+			m_reported = true;
+			DBI::QueryEvent event(DBI::QueryEvent::PhaseFetch, m_sql, m_start);
+			event.nanoseconds = m_nanoseconds;
+			event.rows = m_rows;
+			event.bytes = m_bytes;
+			event.error = error;
+			m_observer->OnQuery(event);
+		}
+
+		std::unique_ptr<DBI::Cursor> m_cursor;
+		std::shared_ptr<DBI::QueryObserver> m_observer;
+		std::string m_sql;
+		DBI::QueryClock::time_point m_start;
+		uint64_t m_nanoseconds;
+		uint64_t m_rows;
+		uint64_t m_bytes;
+		bool m_reported;
+	};
+}
+
+void DBI::StatementHandle::BindParamBlock(const ParamBlock &params)
+{
+	int i = 1;
+	for (const Param &param : params) {
+		switch (param.type) {
+		case Param::TypeNull:
+			BindArg(nullptr, i);
+			break;
+		case Param::TypeBool:
+			BindArg(param.i64 != 0, i);
+			break;
+		case Param::TypeInt8:
+			BindArg(static_cast<int8_t>(param.i64), i);
+			break;
+		case Param::TypeUInt8:
+			BindArg(static_cast<uint8_t>(param.i64), i);
+			break;
+		case Param::TypeInt16:
+			BindArg(static_cast<int16_t>(param.i64), i);
+			break;
+		case Param::TypeUInt16:
+			BindArg(static_cast<uint16_t>(param.i64), i);
+			break;
+		case Param::TypeInt32:
+			BindArg(static_cast<int32_t>(param.i64), i);
+			break;
+		case Param::TypeUInt32:
+			BindArg(static_cast<uint32_t>(param.i64), i);
+			break;
+		case Param::TypeInt64:
+			BindArg(param.i64, i);
+			break;
+		case Param::TypeUInt64:
+			BindArg(param.u64, i);
+			break;
+		case Param::TypeFloat:
+			BindArg(static_cast<float>(param.d), i);
+			break;
+		case Param::TypeDouble:
+			BindArg(param.d, i);
+			break;
+		case Param::TypeString:
+			BindArg(std::string(param.data, param.length), i);
+			break;
+		}
+		++i;
+	}
+}
+
+std::unique_ptr<DBI::ResultSet> DBI::StatementHandle::HookedExecute(const ParamBlock *params)
+{
+	std::shared_ptr<ResultCache> cache = m_result_cache;
+	std::unique_ptr<ResultSet> rs;
+	if (m_observer) {
+		rs = ObservedExecute(params);
+	}
+	else {
+		if (params) {
+			BindParamBlock(*params);
+		}
+		rs = InternalExecute();
+	}
+
+	if (cache) {
+		cache->Invalidate(m_sql);
+	}
+	return rs;
+}
+
+std::unique_ptr<DBI::AsyncResult> DBI::StatementHandle::HookedExecuteAsync(const ParamBlock *params)
+{
+	std::shared_ptr<ResultCache> cache = m_result_cache;
+	std::unique_ptr<AsyncResult> result;
+	if (m_observer) {
+		result = ObservedExecuteAsync(params);
+	}
+	else {
+		if (params) {
+			BindParamBlock(*params);
+		}
+		result = InternalExecuteAsync();
+	}
+
+	if (cache) {
+		result->InvalidateWhenDone(cache, m_sql);
+	}
+	return result;
+}
+
+std::unique_ptr<DBI::Cursor> DBI::StatementHandle::HookedQuery(const ParamBlock *params)
+{
+	std::shared_ptr<ResultCache> cache = m_result_cache;
+	std::unique_ptr<Cursor> cursor;
+	if (m_observer) {
+		cursor = ObservedQuery(params);
+	}
+	else {
+		if (params) {
+			BindParamBlock(*params);
+		}
+		cursor = InternalQuery();
+	}
+
+	//some backends only run the statement on the first Next(), writing through a cursor is rare enough
+	//that dropping results a little early is good enough
+	if (cache) {
+		cache->Invalidate(m_sql);
+	}
+	return cursor;
+}
+
+DBI::QueryClock::time_point DBI::StatementHandle::ObservedBind(QueryObserver &observer, const ParamBlock *params,
+	QueryClock::time_point start)
+{
+	if (!params) {
+		return start;
+	}
+
+	try {
+		BindParamBlock(*params);
+	}
+	catch (...) {
+		ReportQueryError(observer, QueryEvent::PhaseBind, m_sql, start, ErrorCode());
+		throw;
+	}
+	return ReportQuery(observer, QueryEvent::PhaseBind, m_sql, start, 0, 0);
+}
+
+std::unique_ptr<DBI::ResultSet> DBI::StatementHandle::ObservedExecute(const ParamBlock *params)
+{
+	//the observer could be swapped out from under us by a callback
+	std::shared_ptr<QueryObserver> observer = m_observer;
+	QueryClock::time_point start = ObservedBind(*observer, params, QueryClock::now());
+
+	std::unique_ptr<ResultSet> rs;
+	try {
+		rs = InternalExecute();
+	}
+	catch (...) {
+		ReportQueryError(*observer, QueryEvent::PhaseExecute, m_sql, start, ErrorCode());
+		throw;
+	}
+
+	ReportQuery(*observer, QueryEvent::PhaseExecute, m_sql, start, rs.get());
+	return rs;
+}
+
+std::unique_ptr<DBI::AsyncResult> DBI::StatementHandle::ObservedExecuteAsync(const ParamBlock *params)
+{
+	std::shared_ptr<QueryObserver> observer = m_observer;
+	QueryClock::time_point start = ObservedBind(*observer, params, QueryClock::now());
+
+	std::unique_ptr<AsyncResult> result;
+	try {
+		result = InternalExecuteAsync();
+	}
+	catch (...) {
+		ReportQueryError(*observer, QueryEvent::PhaseExecute, m_sql, start, ErrorCode());
+		throw;
+	}
+
+	result->Observe(observer, m_sql, start);
+	return result;
+}
+
+std::unique_ptr<DBI::Cursor> DBI::StatementHandle::ObservedQuery(const ParamBlock *params)
+{
+	std::shared_ptr<QueryObserver> observer = m_observer;
+	QueryClock::time_point start = ObservedBind(*observer, params, QueryClock::now());
+
+	std::unique_ptr<Cursor> cursor;
+	try {
+		cursor = InternalQuery();
+	}
+	catch (...) {
+		ReportQueryError(*observer, QueryEvent::PhaseExecute, m_sql, start, ErrorCode());
+		throw;
+	}
+
+	ReportQuery(*observer, QueryEvent::PhaseExecute, m_sql, start, 0, 0);
+	return std::unique_ptr<Cursor>(new ObservedCursor(std::move(cursor), observer, m_sql));
+}
+
 /*
 std::unique_ptr<DBI::ResultSet> DBI::StatementHandle::Execute(DBI::Any arg0) {
 	StatementArguments args(1, DBI::Any());
@@ -1,9 +1,42 @@
 #pragma once
 
+#include <stdint.h>
+#include <cstddef>
+#include <string>
+#include <memory>
+#include <tuple>
+
+#include "cursor.h"
+#include "async.h"
+#include "observer.h"
+#include "result-cache.h"
+#include "param.h"
+
 namespace DBI
 {
 
 	class ResultSet;
+	class DatabaseHandle;
+
+	//C++11 stand in for std::index_sequence, used to unpack tuples into BindArg() calls.
+	template<size_t... I>
+	struct IndexSequence { };
+
+	template<size_t N, size_t... I>
+	struct MakeIndexSequence : MakeIndexSequence<N - 1, N - 1, I...> { };
+
+	template<size_t... I>
+	struct MakeIndexSequence<0, I...> { typedef IndexSequence<I...> type; };
+
+	//Type an argument is kept as when a call is stored to run later, char pointers may not outlive the call.
+	template<typename T>
+	struct StoredArg { typedef T type; };
+
+	template<>
+	struct StoredArg<const char*> { typedef std::string type; };
+
+	template<>
+	struct StoredArg<char*> { typedef std::string type; };
 
 	class StatementHandle
 	{
@@ -12,28 +45,181 @@ namespace DBI
 		virtual ~StatementHandle() { }
 	
 		std::unique_ptr<ResultSet> Execute() {
+			if (m_observer || m_result_cache) {
+				return HookedExecute(nullptr);
+			}
 			return InternalExecute();
 		}
 
 		template<typename T, typename... Args>
 		std::unique_ptr<ResultSet> Execute(T value, Args... args)
 		{
-			BindArg(value, 1);
-			return _Execute(2, args...);
+			Param params[] = { Param(value), Param(args)... };
+			return ExecuteBound(ParamBlock(params, sizeof...(Args) + 1));
 		}
 
-	protected:
-		std::unique_ptr<ResultSet> _Execute(int i) {
+		//Execute() with params packed by the caller, they only need to live until it returns.
+		std::unique_ptr<ResultSet> ExecuteBound(const ParamBlock &params) {
+			if (m_observer || m_result_cache) {
+				return HookedExecute(&params);
+			}
+			BindParamBlock(params);
 			return InternalExecute();
 		}
 
+		//Execute() through the result cache, see ResultCache.  Runs Execute() when there is none.
+		template<typename... Args>
+		std::shared_ptr<const ResultSet> ExecuteCached(Args... args)
+		{
+			std::shared_ptr<ResultCache> cache = m_result_cache;
+			if (!cache) {
+				return std::shared_ptr<const ResultSet>(Execute(args...));
+			}
+
+			std::string key = ResultCache::Key(m_sql, args...);
+			std::shared_ptr<const ResultSet> rs = cache->Get(key);
+			if (!rs) {
+				uint64_t generation = cache->Generation();
+				rs = Execute(args...);
+				cache->Put(m_sql, key, rs, generation);
+			}
+			return rs;
+		}
+
+		//Starts executing and returns right away, see AsyncResult.  The statement must outlive the result.
+		std::unique_ptr<AsyncResult> ExecuteAsync() {
+			if (m_observer || m_result_cache) {
+				return HookedExecuteAsync(nullptr);
+			}
+			return InternalExecuteAsync();
+		}
+
 		template<typename T, typename... Args>
-		std::unique_ptr<ResultSet> _Execute(int i, T value, Args... args)
+		std::unique_ptr<AsyncResult> ExecuteAsync(T value, Args... args)
+		{
+			Param params[] = { Param(value), Param(args)... };
+			ParamBlock block(params, sizeof...(Args) + 1);
+			if (m_observer || m_result_cache) {
+				return HookedExecuteAsync(&block);
+			}
+			BindParamBlock(block);
+			return InternalExecuteAsync();
+		}
+
+		std::unique_ptr<Cursor> Query() {
+			if (m_observer || m_result_cache) {
+				return HookedQuery(nullptr);
+			}
+			return InternalQuery();
+		}
+
+		template<typename T, typename... Args>
+		std::unique_ptr<Cursor> Query(T value, Args... args)
+		{
+			Param params[] = { Param(value), Param(args)... };
+			ParamBlock block(params, sizeof...(Args) + 1);
+			if (m_observer || m_result_cache) {
+				return HookedQuery(&block);
+			}
+			BindParamBlock(block);
+			return InternalQuery();
+		}
+
+		//Calls callback(const Cursor&) for every row as it arrives and returns the row count.
+		template<typename Callback, typename... Args>
+		size_t QueryEach(Callback callback, Args... args)
+		{
+			std::unique_ptr<Cursor> cursor = Query(args...);
+			size_t rows = 0;
+			while (cursor->Next()) {
+				callback(*cursor);
+				++rows;
+			}
+
+			return rows;
+		}
+
+		/*
+			Executes the statement once per tuple (or pair) in rows and returns the
+			total affected rows.  Each backend uses its cheapest path, a single
+			transaction is used unless one is already open.  On error the batch
+			is rolled back if it started the transaction and the error rethrown.
+		*/
+		template<typename Container>
+		size_t ExecuteBatch(const Container &rows)
 		{
-			BindArg(value, i);
-			return _Execute(i + 1, args...);
+			typedef typename Container::value_type Tuple;
+			typedef typename MakeIndexSequence<std::tuple_size<Tuple>::value>::type Indices;
+
+			QueryClock::time_point start;
+			if (m_observer) {
+				start = QueryClock::now();
+			}
+
+			BeginBatch(rows.size());
+			try {
+				for (auto &row : rows) {
+					BindTuple(row, Indices());
+					AddBatchRow();
+				}
+
+				size_t affected = FinishBatch();
+				if (m_observer) {
+					ReportQuery(*m_observer, QueryEvent::PhaseExecute, m_sql, start, affected, 0);
+				}
+				if (m_result_cache) {
+					m_result_cache->Invalidate(m_sql);
+				}
+				return affected;
+			}
+			catch (...) {
+				AbortBatch();
+				if (m_observer) {
+					ReportQueryError(*m_observer, QueryEvent::PhaseExecute, m_sql, start, ErrorCode());
+				}
+				throw;
+			}
 		}
 
+		//SQL the statement was prepared from.
+		const std::string &SQL() const { return m_sql; }
+
+		//Set by DatabaseHandle::Prepare() from the handle's observer, null turns reporting off.
+		void SetObserver(std::shared_ptr<QueryObserver> observer) { m_observer = observer; }
+		const std::shared_ptr<QueryObserver> &Observer() const { return m_observer; }
+
+		//Set by DatabaseHandle::Prepare() from the handle's result cache, see ExecuteCached().
+		void SetResultCache(std::shared_ptr<ResultCache> cache) { m_result_cache = cache; }
+		const std::shared_ptr<ResultCache> &GetResultCache() const { return m_result_cache; }
+
+		//Backend code of the last error, see QueryEvent::error_code.
+		virtual int ErrorCode() const { return 0; }
+
+	protected:
+		//Execute() and friends when there is an observer or a result cache to tell about writes, params
+		//is null without any.
+		std::unique_ptr<ResultSet> HookedExecute(const ParamBlock *params);
+		std::unique_ptr<AsyncResult> HookedExecuteAsync(const ParamBlock *params);
+		std::unique_ptr<Cursor> HookedQuery(const ParamBlock *params);
+		//Execute() and friends with each phase reported to m_observer.
+		std::unique_ptr<ResultSet> ObservedExecute(const ParamBlock *params);
+		std::unique_ptr<AsyncResult> ObservedExecuteAsync(const ParamBlock *params);
+		std::unique_ptr<Cursor> ObservedQuery(const ParamBlock *params);
+		//Binds params as the bind phase and returns when it finished.
+		QueryClock::time_point ObservedBind(QueryObserver &observer, const ParamBlock *params, QueryClock::time_point start);
+
+		template<typename Tuple, size_t... I>
+		void BindTuple(const Tuple &row, IndexSequence<I...>)
+		{
+			//the trailing Param keeps the array from being empty
+			Param params[] = { Param(std::get<I>(row))..., Param() };
+			BindParamBlock(ParamBlock(params, sizeof...(I)));
+		}
+
+		//Binds every param, the default calls BindArg() for each.  Backends override it to bind the
+		//whole block without a virtual call per param.
+		virtual void BindParamBlock(const ParamBlock &params);
+
 		virtual void BindArg(bool v, int i) = 0;
 		virtual void BindArg(int8_t v, int i) = 0;
 		virtual void BindArg(uint8_t v, int i) = 0;
@@ -49,6 +235,26 @@ namespace DBI
 		virtual void BindArg(const char *v, int i) = 0;
 		virtual void BindArg(std::nullptr_t v, int i) = 0;
 		virtual std::unique_ptr<ResultSet> InternalExecute() = 0;
+		virtual std::unique_ptr<Cursor> InternalQuery() = 0;
+
+		//Runs InternalExecute() on a worker thread, backends with a non blocking client API override it.
+		virtual std::unique_ptr<AsyncResult> InternalExecuteAsync() {
+			return std::unique_ptr<AsyncResult>(new ThreadAsyncResult([this]() { return InternalExecute(); }));
+		}
+
+		//rows is a size hint, the backends in this tree have nothing to reserve with it.
+		virtual void BeginBatch(size_t rows) = 0;
+		//Runs the statement with the currently bound params as part of the batch.
+		virtual void AddBatchRow() = 0;
+		virtual size_t FinishBatch() = 0;
+		//Must not throw, called while unwinding a failed batch.
+		virtual void AbortBatch() = 0;
+
+		std::string m_sql;
+		std::shared_ptr<QueryObserver> m_observer;
+		std::shared_ptr<ResultCache> m_result_cache;
+
+		friend class DBI::DatabaseHandle;
 	};
 
 }
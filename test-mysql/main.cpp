@@ -352,6 +352,76 @@ int main() {
 				return 1;
 			}
 		}
+
+		//result columns bound with their native types
+		dbh->Do("DROP TABLE IF EXISTS db_types");
+		dbh->Do("CREATE TABLE db_types ("
+			"id INT,"
+			"small_value SMALLINT,"
+			"unsigned_value BIGINT UNSIGNED,"
+			"float_value FLOAT,"
+			"double_value DOUBLE,"
+			"decimal_value DECIMAL(10, 2),"
+			"long_value LONGTEXT,"
+			"PRIMARY KEY(id))");
+
+		std::string long_value(100000, 'x');
+		dbh->Do("INSERT INTO db_types (id, small_value, unsigned_value, float_value, double_value, decimal_value, long_value) VALUES(?, ?, ?, ?, ?, ?, ?)",
+			1,
+			(int16_t)-1234,
+			(uint64_t)18446744073709551615ULL,
+			(float)125.9,
+			(double)125.9,
+			std::string("12345678.91"),
+			long_value);
+
+		rs = dbh->Do("SELECT id, small_value, unsigned_value, float_value, double_value, decimal_value, long_value FROM db_types");
+		if (rs->RowCount() != 1) {
+			PrintErr("Failure to select value, 1 row not returned.");
+			return 1;
+		}
+
+		if (rs->GetType(0, 0) != DBI::ResultSet::FieldTypeInt64 || rs->GetInt32(0, 0) != 1) {
+			PrintErr("Native int column was incorrect");
+			return 1;
+		}
+
+		if (rs->GetType(0, 1) != DBI::ResultSet::FieldTypeInt64 || rs->GetInt64(0, 1) != -1234 || rs->GetValue(0, 1) != "-1234") {
+			PrintErr("Native signed column was incorrect");
+			return 1;
+		}
+
+		if (rs->GetType(0, 2) != DBI::ResultSet::FieldTypeUInt64 || rs->GetUInt64(0, 2) != 18446744073709551615ULL ||
+			rs->GetValue(0, 2) != "18446744073709551615") {
+			PrintErr("Native unsigned column was incorrect");
+			return 1;
+		}
+
+		if (rs->GetType(0, 3) != DBI::ResultSet::FieldTypeDouble || rs->GetValue(0, 3) != "125.9") {
+			PrintErr("FLOAT column was incorrect: %s", rs->GetValue(0, 3).c_str());
+			return 1;
+		}
+
+		if (rs->GetType(0, 4) != DBI::ResultSet::FieldTypeDouble || rs->GetDouble(0, 4) != 125.9 || rs->GetValue(0, 4) != "125.9") {
+			PrintErr("DOUBLE column was incorrect: %s", rs->GetValue(0, 4).c_str());
+			return 1;
+		}
+
+		if (rs->GetType(0, 5) != DBI::ResultSet::FieldTypeText || rs->GetValue(0, 5) != "12345678.91") {
+			PrintErr("DECIMAL column was incorrect: %s", rs->GetValue(0, 5).c_str());
+			return 1;
+		}
+
+		if (rs->GetType(0, 6) != DBI::ResultSet::FieldTypeText || rs->GetValue(0, 6) != long_value) {
+			PrintErr("LONGTEXT column was incorrect");
+			return 1;
+		}
+
+		auto rows_value = rs->Rows();
+		if (rows_value.front()["float_value"].value != "125.9" || rows_value.front()["long_value"].value.length() != long_value.length()) {
+			PrintErr("Rows() did not match the typed values");
+			return 1;
+		}
 	}
 	catch (std::exception &ex) {
 		printf("Tests failed with message: %s", ex.what());
@@ -18,10 +18,12 @@
 
 #include <stdio.h>
 #include <string.h>
+#include <vector>
 #include "../dbi/dbh.h"
 #include "../dbi/sth.h"
 #include "../dbi/rs.h"
 #include "../dbi/dbh-pg.h"
+#include "../dbi/pipeline-pg.h"
 
 #define PrintErr(x, ...) printf("Error at line %d: " x "\n", __LINE__, ##__VA_ARGS__)
 
@@ -358,6 +360,229 @@ int main() {
 				return 1;
 			}
 		}
+
+		std::vector<std::string> copy_columns;
+		copy_columns.push_back("id");
+		copy_columns.push_back("int_value");
+		copy_columns.push_back("text_value");
+		copy_columns.push_back("blob_value");
+
+		for (int binary = 0; binary < 2; ++binary) {
+			auto copy = dbh->CopyIn("db_test", copy_columns, binary != 0);
+			for (int64_t id = 100; id < 110; ++id) {
+				copy->WriteRow(id + binary * 100, id * 2, std::string("copied\t\value\n"), blob_value);
+			}
+
+			if (copy->Finish() != 10) {
+				PrintErr("Copy did not store 10 rows");
+				return 1;
+			}
+		}
+
+		auto copied = dbh->Do("SELECT COUNT(*) FROM db_test WHERE id >= 100 AND text_value = 'copied\t\value\n' AND blob_value = ?", blob_value);
+		if (copied->GetInt64(0, 0) != 20) {
+			PrintErr("Copied rows were not stored correctly");
+			return 1;
+		}
+
+		for (int binary = 0; binary < 2; ++binary) {
+			auto copy = dbh->CopyIn("db_test", copy_columns, binary != 0);
+			copy->WriteRow((int64_t)300 + binary, (int64_t)0, (const char*)nullptr, blob_value);
+			copy->Finish();
+		}
+
+		copied = dbh->Do("SELECT COUNT(*) FROM db_test WHERE id >= 300 AND text_value IS NULL");
+		if (copied->GetInt64(0, 0) != 2) {
+			PrintErr("Copied null const char* was not stored as NULL");
+			return 1;
+		}
+
+		//only placeholders outside literals, quoted identifiers and comments are rewritten
+		for (int i = 0; i < 2; ++i) {
+			auto quoted = dbh->Do("SELECT '?' AS q, ? AS v", 5);
+			if (quoted->GetValue(0, 0).compare("?") != 0 || quoted->GetValue(0, 1).compare("5") != 0) {
+				PrintErr("Placeholder inside a string literal was rewritten");
+				return 1;
+			}
+		}
+
+		auto escaped = dbh->Do("SELECT E'it\\'s ?' AS e, \"?\".v FROM (SELECT ? AS v) AS \"?\"", 6);
+		if (escaped->GetValue(0, 0).compare("it's ?") != 0 || escaped->GetValue(0, 1).compare("6") != 0) {
+			PrintErr("Placeholder inside an escape string or quoted identifier was rewritten");
+			return 1;
+		}
+
+		auto dollar = dbh->Do("SELECT $body$ what? $body$ AS d, ? AS v", 7);
+		if (dollar->GetValue(0, 0).compare(" what? ") != 0 || dollar->GetValue(0, 1).compare("7") != 0) {
+			PrintErr("Placeholder inside a dollar quoted string was rewritten");
+			return 1;
+		}
+
+		auto commented = dbh->Do("SELECT ? AS v -- not this ?\n /* nor ? this */", 8);
+		if (commented->FieldCount() != 1 || commented->GetValue(0, 0).compare("8") != 0) {
+			PrintErr("Placeholder inside a comment was rewritten");
+			return 1;
+		}
+
+		//Prepare() goes through the rewrite cache on every call, Do() only until its statement is cached
+		for (int i = 0; i < 2; ++i) {
+			auto rewritten_sth = dbh->Prepare("SELECT '?' AS q, ? AS v");
+			auto rewritten = rewritten_sth->Execute(9 + i);
+			if (rewritten->GetValue(0, 0).compare("?") != 0 || rewritten->GetInt64(0, 1) != 9 + i) {
+				PrintErr("Cached rewrite returned the wrong result");
+				return 1;
+			}
+		}
+
+		auto select_sth = dbh->Prepare("SELECT int_value FROM db_test WHERE id = ?", "PipelineSelect");
+		auto bad_sth = dbh->Prepare("SELECT 1 / (int_value - int_value) FROM db_test WHERE id = ?", "PipelineBad");
+		{
+			auto pipeline = dbh->Pipeline();
+			pipeline->Queue(*select_sth, (int64_t)100);
+			pipeline->Queue(*bad_sth, (int64_t)2);
+			pipeline->Queue(*select_sth, (int64_t)101);
+			pipeline->Sync();
+			pipeline->Queue(*select_sth, (int64_t)102);
+
+			auto results = pipeline->Collect();
+			if (results.size() != 4 || !results[0].Ok() || results[0].result_set->GetInt64(0, 0) != 200) {
+				PrintErr("Pipelined select returned the wrong result");
+				return 1;
+			}
+
+			if (results[1].Ok() || results[1].error.empty() || !results[2].aborted) {
+				PrintErr("Pipelined failure was not isolated to its sync block");
+				return 1;
+			}
+
+			if (!results[3].Ok() || results[3].result_set->GetInt64(0, 0) != 204) {
+				PrintErr("Pipelined select after the sync point did not run");
+				return 1;
+			}
+		}
+
+		auto first_sth = dbh->Prepare("SELECT int_value FROM db_test WHERE id = ?");
+		auto second_sth = dbh->Prepare("SELECT text_value FROM db_test WHERE id = ?");
+		auto shared_sth = dbh->Prepare("SELECT int_value FROM db_test WHERE id = ?");
+		if (first_sth->Execute((int64_t)2)->GetInt64(0, 0) != 5 || second_sth->Execute((int64_t)2)->GetValue(0, 0).compare("A test value") != 0 ||
+			shared_sth->Execute((int64_t)3)->GetInt64(0, 0) != 556) {
+			PrintErr("Unnamed prepared statements replaced each other");
+			return 1;
+		}
+
+		auto pending = first_sth->ExecuteAsync((int64_t)3);
+		while (!pending->Poll()) {
+			DBI::WaitForSocket(pending->Socket(), false, 100);
+		}
+
+		auto async_rs = pending->Get();
+		if (async_rs->RowCount() != 1 || async_rs->GetInt64(0, 0) != 556) {
+			PrintErr("ExecuteAsync returned the wrong result");
+			return 1;
+		}
+
+		pending = bad_sth->ExecuteAsync((int64_t)2);
+		try {
+			pending->Get();
+			PrintErr("ExecuteAsync did not report the failed statement");
+			return 1;
+		}
+		catch (std::runtime_error&) {
+		}
+
+		//statements released while the connection can't take a DEALLOCATE are sent once it can
+		const char *released_sql = "SELECT text_value FROM db_test WHERE id = $1 AND int_value >= 0";
+		auto count_released = [&dbh, released_sql]() {
+			return dbh->Do("SELECT COUNT(*) FROM pg_prepared_statements WHERE statement = ?", released_sql)->GetInt64(0, 0);
+		};
+
+		dbh->Begin();
+		auto released_sth = dbh->Prepare("SELECT text_value FROM db_test WHERE id = ? AND int_value >= 0");
+		try {
+			dbh->Do("SELECT 1 / 0");
+		}
+		catch (std::runtime_error&) {
+		}
+		released_sth.reset();
+		dbh->Rollback();
+		if (count_released() != 0) {
+			PrintErr("Statement released in a failed transaction was not deallocated");
+			return 1;
+		}
+
+		released_sth = dbh->Prepare("SELECT text_value FROM db_test WHERE id = ? AND int_value >= 0");
+		{
+			auto pipeline = dbh->Pipeline();
+			pipeline->Queue(*released_sth, (int64_t)2);
+			released_sth.reset();
+			if (pipeline->Collect().size() != 1) {
+				PrintErr("Pipeline lost a result after its statement was released");
+				return 1;
+			}
+		}
+		if (count_released() != 0) {
+			PrintErr("Statement released in a pipeline was not deallocated");
+			return 1;
+		}
+
+		DBI::DatabaseAttributes binary_attr;
+		binary_attr["pg_binary"] = "1";
+		binary_attr["pg_fetch_rows"] = "2";
+		DBI::PGDatabaseHandle binary_dbh;
+		binary_dbh.Connect("eqdb", "eqdb.cklzulhbla8r.us-east-1.rds.amazonaws.com", "eqdb", "eqdbpass", binary_attr);
+
+		auto binary_rs = binary_dbh.Do("SELECT int_value, real_value, text_value, blob_value FROM db_test WHERE id = ? AND blob_value = ?",
+			(int64_t)2, blob_value);
+		if (binary_rs->RowCount() != 1 || binary_rs->GetType(0, 0) != DBI::ResultSet::FieldTypeInt64 || binary_rs->GetInt64(0, 0) != 5) {
+			PrintErr("Binary int_value was incorrect value in row 2");
+			return 1;
+		}
+
+		if (binary_rs->GetValue(0, 1).compare("125.9") != 0 || binary_rs->GetValue(0, 2).compare("A test value") != 0) {
+			PrintErr("Binary real_value or text_value was incorrect value in row 2");
+			return 1;
+		}
+
+		if (binary_rs->GetLength(0, 3) != 12 || memcmp(binary_rs->GetData(0, 3), "hello\0world\0", 12) != 0) {
+			PrintErr("Binary blob_value was incorrect value in row 2");
+			return 1;
+		}
+
+		//more rows than pg_fetch_rows so results are put together from several chunks
+		DBI::DatabaseAttributes chunked_attr;
+		chunked_attr["pg_fetch_rows"] = "2";
+		DBI::PGDatabaseHandle chunked_dbh;
+		chunked_dbh.Connect("eqdb", "eqdb.cklzulhbla8r.us-east-1.rds.amazonaws.com", "eqdb", "eqdbpass", chunked_attr);
+
+		const char *all_rows = "SELECT id, int_value, real_value, text_value, blob_value FROM db_test ORDER BY id";
+		auto whole_rs = dbh->Do(all_rows);
+		auto chunked_rs = chunked_dbh.Do(all_rows);
+		if (whole_rs->RowCount() < 5 || chunked_rs->RowCount() != whole_rs->RowCount() || chunked_rs->FieldCount() != whole_rs->FieldCount()) {
+			PrintErr("Chunked result has %d rows, expected %d", (int)chunked_rs->RowCount(), (int)whole_rs->RowCount());
+			return 1;
+		}
+
+		auto chunked_sth = chunked_dbh.Prepare(all_rows);
+		auto chunked_cursor = chunked_sth->Query();
+		size_t cursor_rows = 0;
+		for (; chunked_cursor->Next(); ++cursor_rows) {
+			for (size_t c = 0; c < whole_rs->FieldCount(); ++c) {
+				bool cursor_null = chunked_cursor->IsNull(c);
+				std::string cursor_value(chunked_cursor->GetData(c), chunked_cursor->GetLength(c));
+				if (cursor_rows >= whole_rs->RowCount() || cursor_null != whole_rs->IsNull(cursor_rows, c) ||
+					chunked_rs->IsNull(cursor_rows, c) != whole_rs->IsNull(cursor_rows, c) ||
+					(!cursor_null && (cursor_value != whole_rs->GetValue(cursor_rows, c) ||
+					chunked_rs->GetValue(cursor_rows, c) != whole_rs->GetValue(cursor_rows, c)))) {
+					PrintErr("Chunked row %d column %d did not match the unchunked result", (int)cursor_rows, (int)c);
+					return 1;
+				}
+			}
+		}
+
+		if (cursor_rows != whole_rs->RowCount()) {
+			PrintErr("Chunked cursor returned %d rows, expected %d", (int)cursor_rows, (int)whole_rs->RowCount());
+			return 1;
+		}
 	}
 	catch (std::exception &ex) {
 		printf("Tests failed with message: %s", ex.what());
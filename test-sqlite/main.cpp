@@ -18,7 +18,14 @@
 
 #include <stdio.h>
 #include <string.h>
+#include <vector>
+#include <tuple>
+#include <thread>
+#include <memory>
 #include "../dbi/dbh-sqlite.h"
+#include "../dbi/pool.h"
+#include "../dbi/executor.h"
+#include "../dbi/fingerprint.h"
 
 #define PrintErr(x, ...) printf("Error at line %d: " x "\n", __LINE__, ##__VA_ARGS__)
 
@@ -110,6 +117,12 @@ int main() {
 
 		dbh->Commit();
 
+		auto cache_stats = dbh->DoCacheStats();
+		if (cache_stats.hits < 4) {
+			PrintErr("Repeated Do() statements were not served from the statement cache");
+			return 1;
+		}
+
 		auto sth = dbh->Prepare("INSERT INTO db_test (id, int_value, real_value, text_value, blob_value) VALUES(?, ?, ?, ?, ?)");
 		rs = sth->Execute(6, 2134, 125.9, std::string("Test value"), blob_value);
 		if(rs->AffectedRows() != 1) {
@@ -201,6 +214,57 @@ int main() {
 			}
 		}
 
+		int text_col = rs->FieldIndex("text_value");
+		if(rs->RowCount() != 1 || text_col < 0) {
+			PrintErr("Row count or field index was incorrect in row 2");
+			return 1;
+		}
+
+		if(rs->IsNull(0, text_col) || rs->GetValue(0, text_col).compare("A test value") != 0) {
+			PrintErr("Indexed text_value was incorrect value in row 2");
+			return 1;
+		}
+
+		if(rs->GetInt32(0, 0) != 5 || rs->GetInt64(0, 0) != 5 || rs->GetDouble(0, 1) > 126.0 || rs->GetDouble(0, 1) < 125.8) {
+			PrintErr("Typed int_value or real_value was incorrect value in row 2");
+			return 1;
+		}
+
+		if(rs->GetType(0, 0) != DBI::ResultSet::FieldTypeInt64 || rs->GetType(0, 1) != DBI::ResultSet::FieldTypeDouble ||
+			rs->GetType(0, 2) != DBI::ResultSet::FieldTypeText) {
+			PrintErr("Columns were not stored as their SQLite storage class in row 2");
+			return 1;
+		}
+
+		auto blob = rs->GetBlob(0, 3);
+		if(blob.size != 12 || memcmp(blob.data, "hello\0world\0", 12) != 0) {
+			PrintErr("Typed blob_value was incorrect value in row 2");
+			return 1;
+		}
+
+		//floats from MySQL and PG binary results keep their short text form
+		DBI::ResultSet float_rs(std::vector<std::string>(1, "f"), 0);
+		float_rs.AddFloatField(125.9f);
+		float_rs.FinishRow();
+		if(float_rs.GetType(0, 0) != DBI::ResultSet::FieldTypeDouble || float_rs.GetValue(0, 0).compare("125.9") != 0 ||
+			float_rs.GetDouble(0, 0) != (double)125.9f) {
+			PrintErr("Float cell was incorrect: %s", float_rs.GetValue(0, 0).c_str());
+			return 1;
+		}
+
+		//executes of one statement share its column names rather than copying them
+		if(&sth->Execute(3)->Fields() != &rs->Fields()) {
+			PrintErr("Field names were copied for each execute");
+			return 1;
+		}
+
+		try {
+			rs->GetInt64(0, text_col);
+			PrintErr("Typed text_value should not convert to an integer in row 2");
+			return 1;
+		} catch(std::runtime_error&) {
+		}
+
 		rs = sth->Execute(3);
 		if(rs->AffectedRows() != 1) {
 			PrintErr("Failure to select value");
@@ -359,6 +423,505 @@ int main() {
 				return 1;
 			}
 			}
+
+		sth = dbh->Prepare("SELECT id, text_value FROM db_test WHERE id >= ? ORDER BY id");
+		auto cursor = sth->Query(2);
+		int cursor_rows = 0;
+		while(cursor->Next()) {
+			++cursor_rows;
+			if(cursor_rows == 1 && cursor->GetValue(1).compare("A test value") != 0) {
+				PrintErr("Cursor text_value was incorrect value in row 2");
+				return 1;
+			}
+		}
+
+		if(cursor_rows != 5) {
+			PrintErr("Cursor returned %d rows instead of 5", cursor_rows);
+			return 1;
+		}
+
+		cursor.reset();
+		int64_t id_sum = 0;
+		size_t each_rows = sth->QueryEach([&id_sum](const DBI::Cursor &row) { id_sum += std::stoll(row.GetValue(0)); }, 3);
+		if(each_rows != 4 || id_sum != 18) {
+			PrintErr("QueryEach returned the wrong rows");
+			return 1;
+		}
+
+		auto pending = sth->ExecuteAsync(3);
+		rs = pending->Get();
+		if(!pending->Ready() || rs->RowCount() != 4) {
+			PrintErr("ExecuteAsync returned the wrong rows");
+			return 1;
+		}
+
+		size_t async_rows = 0;
+		std::string async_error;
+		pending = dbh->DoAsync("SELECT id FROM db_test WHERE id < ?", 3);
+		pending->OnComplete([&async_rows, &async_error](std::unique_ptr<DBI::ResultSet> res, const std::string &error) {
+			async_rows = res ? res->RowCount() : 0;
+			async_error = error;
+		});
+		while(!pending->Poll()) {
+			DBI::WaitForSocket(pending->Socket(), false, 100);
+		}
+
+		if(async_rows != 2 || !async_error.empty()) {
+			PrintErr("DoAsync callback got the wrong rows");
+			return 1;
+		}
+
+		pending.reset(new DBI::ThreadAsyncResult([]() -> std::unique_ptr<DBI::ResultSet> { throw 1; }));
+		try {
+			pending->Get();
+			PrintErr("Non standard exception on the worker thread was not reported");
+			return 1;
+		}
+		catch (std::runtime_error&) {
+		}
+
+		DBI::ConnectionPool::Options pool_options;
+		pool_options.min_size = 1;
+		pool_options.max_size = 2;
+		DBI::ConnectionPool pool([]() { return std::unique_ptr<DBI::DatabaseHandle>(new DBI::SQLiteDatabaseHandle()); },
+			"test.db", "", "", "", attr, pool_options);
+
+		{
+			auto first = pool.Acquire();
+			auto second = pool.Acquire(1000);
+			rs = second->Do("SELECT COUNT(*) AS c FROM db_test");
+			if(rs->RowCount() != 1 || rs->GetValue(0, 0).compare("6") != 0) {
+				PrintErr("Pooled connection returned the wrong row count");
+				return 1;
+			}
+
+			if(pool.GetStats().in_use != 2) {
+				PrintErr("Pool did not grow to two connections");
+				return 1;
+			}
+		}
+
+		auto pool_stats = pool.GetStats();
+		if(pool_stats.in_use != 0 || pool_stats.idle != 2 || pool_stats.acquisitions != 2) {
+			PrintErr("Pool did not take its connections back");
+			return 1;
+		}
+
+		{
+			DBI::CompletionQueue completions;
+			size_t callbacks = 0;
+			{
+				DBI::Executor executor([]() { return std::unique_ptr<DBI::DatabaseHandle>(new DBI::SQLiteDatabaseHandle()); },
+					"test.db", "", "", "", attr, 2, &completions);
+				for(int i = 1; i <= 6; ++i) {
+					executor.Do(i, "SELECT int_value FROM db_test WHERE id = ?", i);
+				}
+				executor.Submit([](DBI::DatabaseHandle &worker_dbh) { return worker_dbh.Do("SELECT COUNT(*) FROM db_test"); },
+					[&callbacks](DBI::CompletionQueue::Completion &completion) {
+						if(completion.Ok() && completion.result_set->GetInt64(0, 0) == 6) {
+							++callbacks;
+						}
+					});
+			}
+
+			if(completions.Size() != 7 || completions.Dispatch() != 7 || callbacks != 1) {
+				PrintErr("Executor did not complete every job");
+				return 1;
+			}
+		}
+
+		{
+			//no completion queue, callbacks run on the worker
+			std::atomic<size_t> failures(0);
+			{
+				DBI::Executor executor([]() { return std::unique_ptr<DBI::DatabaseHandle>(new DBI::SQLiteDatabaseHandle()); },
+					"test.db", "", "", "", attr, 1);
+				executor.Submit([](DBI::DatabaseHandle&) -> std::unique_ptr<DBI::ResultSet> { throw 1; },
+					[&failures](DBI::CompletionQueue::Completion &completion) {
+						if(!completion.Ok()) {
+							++failures;
+						}
+					});
+			}
+
+			if(failures != 1) {
+				PrintErr("Executor without a completion queue did not run the callback of a failed job");
+				return 1;
+			}
+		}
+
+		std::vector<std::tuple<int, int, std::string>> batch;
+		batch.push_back(std::make_tuple(7, 70, std::string("batch 7")));
+		batch.push_back(std::make_tuple(8, 80, std::string("batch 8")));
+		batch.push_back(std::make_tuple(9, 90, std::string("batch 9")));
+
+		sth = dbh->Prepare("INSERT INTO db_test (id, int_value, text_value) VALUES(?, ?, ?)");
+		if(sth->ExecuteBatch(batch) != 3) {
+			PrintErr("Batch insert did not affect 3 rows");
+			return 1;
+		}
+
+		rs = dbh->Do("SELECT SUM(int_value) AS s FROM db_test WHERE id >= 7");
+		if(rs->GetInt64(0, 0) != 240) {
+			PrintErr("Batch insert wrote the wrong values");
+			return 1;
+		}
+
+		size_t deferred_affected = 0;
+		size_t deferred_errors = 0;
+		auto deferred_callback = [&deferred_affected, &deferred_errors](size_t affected, const std::string &error) {
+			deferred_affected += affected;
+			deferred_errors += error.empty() ? 0 : 1;
+		};
+
+		dbh->EnableWriteCoalescing(3, 60000);
+		dbh->DoDeferred(deferred_callback, "UPDATE db_test SET int_value = int_value + 1 WHERE id = ?", 7);
+		dbh->DoDeferred(deferred_callback, "UPDATE db_test SET int_value = int_value + 1 WHERE id = ?", 8);
+		if(dbh->PendingWrites() != 2 || deferred_affected != 0) {
+			PrintErr("Deferred writes were not buffered");
+			return 1;
+		}
+
+		dbh->DoDeferred(deferred_callback, "UPDATE db_test SET int_value = int_value + 1 WHERE id = ?", 9);
+		if(dbh->PendingWrites() != 0 || deferred_affected != 3 || dbh->WriteStats().flushes != 1) {
+			PrintErr("Deferred writes were not committed together");
+			return 1;
+		}
+
+		dbh->DoDeferred(deferred_callback, "UPDATE db_test SET int_value = int_value + 1 WHERE id = ?", 7);
+		dbh->DoDeferred(deferred_callback, "UPDATE missing_table SET int_value = 0");
+		dbh->DisableWriteCoalescing();
+		if(deferred_affected != 4 || deferred_errors != 1 || dbh->WriteStats().fallbacks != 1) {
+			PrintErr("Failed deferred write was not isolated");
+			return 1;
+		}
+
+		rs = dbh->Do("SELECT SUM(int_value) AS s FROM db_test WHERE id >= 7");
+		if(rs->GetInt64(0, 0) != 244) {
+			PrintErr("Deferred writes stored the wrong values");
+			return 1;
+		}
+
+		//a flush fired inside the caller's transaction joins it rather than committing or rolling it back
+		dbh->EnableWriteCoalescing(2, 60000);
+		dbh->Begin();
+		dbh->Do("UPDATE db_test SET int_value = 0 WHERE id = 7");
+		uint64_t flushes = dbh->WriteStats().flushes;
+		dbh->DoDeferred(deferred_callback, "UPDATE db_test SET int_value = int_value + 1 WHERE id = ?", 8);
+		dbh->DoDeferred(deferred_callback, "UPDATE db_test SET int_value = int_value + 1 WHERE id = ?", 9);
+		if(!dbh->InTransaction() || dbh->PendingWrites() != 0 || dbh->WriteStats().flushes != flushes || deferred_affected != 6 ||
+			deferred_errors != 1 || dbh->Do("SELECT int_value FROM db_test WHERE id = 7")->GetInt64(0, 0) != 0) {
+			PrintErr("Deferred flush inside an open transaction broke it");
+			return 1;
+		}
+
+		dbh->Rollback();
+		dbh->DisableWriteCoalescing();
+		rs = dbh->Do("SELECT SUM(int_value) AS s FROM db_test WHERE id >= 7");
+		if(dbh->InTransaction() || rs->GetInt64(0, 0) != 244) {
+			PrintErr("Deferred writes did not roll back with the caller's transaction");
+			return 1;
+		}
+
+		{
+			size_t closed_affected = 0;
+			size_t closed_errors = 0;
+			{
+				DBI::SQLiteDatabaseHandle close_dbh;
+				close_dbh.Connect(":memory:", "", "", "", attr);
+				close_dbh.Do("CREATE TABLE closed (id INTEGER)");
+				close_dbh.EnableWriteCoalescing(10, 60000);
+				auto closed_callback = [&closed_affected, &closed_errors](size_t affected, const std::string &error) {
+					closed_affected += affected;
+					closed_errors += error.empty() ? 0 : 1;
+				};
+
+				close_dbh.DoDeferred(closed_callback, "INSERT INTO closed VALUES(?)", 1);
+				close_dbh.DoDeferred(closed_callback, "INSERT INTO closed VALUES(?)", 2);
+				close_dbh.Disconnect();
+				if(closed_affected != 2 || closed_errors != 0 || close_dbh.PendingWrites() != 0) {
+					PrintErr("Disconnect() did not flush buffered writes");
+					return 1;
+				}
+
+				close_dbh.DoDeferred(closed_callback, "INSERT INTO closed VALUES(?)", 3);
+			}
+
+			if(closed_errors != 1) {
+				PrintErr("Write buffered on a disconnected handle was dropped without its callback");
+				return 1;
+			}
+		}
+
+		DBI::DatabaseAttributes profile_attr;
+		profile_attr["sqlite_profile"] = "fast-read";
+		profile_attr["sqlite_cache_size"] = "-1024";
+		DBI::SQLiteDatabaseHandle profile_dbh;
+		profile_dbh.Connect(":memory:", "", "", "", profile_attr);
+		if(profile_dbh.Do("PRAGMA synchronous")->GetInt64(0, 0) != 1 || profile_dbh.Do("PRAGMA cache_size")->GetInt64(0, 0) != -1024 ||
+			profile_dbh.Do("PRAGMA temp_store")->GetInt64(0, 0) != 2) {
+			PrintErr("sqlite_profile settings were not applied");
+			return 1;
+		}
+
+		try {
+			DBI::DatabaseAttributes bad_attr;
+			bad_attr["sqlite_journal_mode"] = "WAL; DROP TABLE db_test";
+			DBI::SQLiteDatabaseHandle bad_dbh;
+			bad_dbh.Connect(":memory:", "", "", "", bad_attr);
+			PrintErr("Invalid sqlite_journal_mode was accepted");
+			return 1;
+		} catch(std::runtime_error&) {
+		}
+
+		remove("test_readers.db");
+		DBI::DatabaseAttributes reader_attr;
+		reader_attr["sqlite_readers"] = "2";
+		//exposes the reader leases so the test can keep every reader busy
+		struct LeasingHandle : public DBI::SQLiteDatabaseHandle
+		{
+			using DBI::SQLiteDatabaseHandle::AcquireReader;
+			using DBI::SQLiteDatabaseHandle::ReleaseReader;
+		};
+		LeasingHandle reader_dbh;
+		reader_dbh.Connect("test_readers.db", "", "", "", reader_attr);
+		reader_dbh.Do("CREATE TABLE lookup (id INTEGER PRIMARY KEY, value INTEGER)");
+		for(int i = 1; i <= 8; ++i) {
+			reader_dbh.Do("INSERT INTO lookup (id, value) VALUES(?, ?)", i, i * 10);
+		}
+
+		reader_dbh.Begin();
+		reader_dbh.Do("INSERT INTO lookup (id, value) VALUES(?, ?)", 9, 90);
+		if(reader_dbh.Do("SELECT COUNT(*) FROM lookup")->GetInt64(0, 0) != 9) {
+			PrintErr("Read inside a transaction did not see its own write");
+			return 1;
+		}
+		reader_dbh.Rollback();
+
+		std::vector<int64_t> reader_sums(4, 0);
+		std::vector<std::thread> reader_threads;
+		for(size_t t = 0; t < reader_sums.size(); ++t) {
+			reader_threads.push_back(std::thread([&reader_dbh, &reader_sums, t]() {
+				for(int i = 1; i <= 8; ++i) {
+					reader_sums[t] += reader_dbh.Read("SELECT value FROM lookup WHERE id = ?", i)->GetInt64(0, 0);
+				}
+			}));
+		}
+		for(auto &thread : reader_threads) {
+			thread.join();
+		}
+
+		if(reader_dbh.Readers() != 2 || reader_sums[0] != 360 || reader_sums[3] != 360 ||
+			reader_dbh.Do("SELECT COUNT(*) FROM lookup")->GetInt64(0, 0) != 8) {
+			PrintErr("Reader connections returned the wrong rows");
+			return 1;
+		}
+
+		//the 32 Read()s and the Do() above, the read inside the transaction stayed on the writer
+		if(reader_dbh.ReaderStats().reads != 33 || reader_dbh.ReaderStats().busy_fallbacks != 0) {
+			PrintErr("Reads were not served by the reader connections");
+			return 1;
+		}
+
+		DBI::SQLiteReader *held_readers[] = { reader_dbh.AcquireReader(), reader_dbh.AcquireReader() };
+		auto busy_rs = reader_dbh.Do("SELECT COUNT(*) FROM lookup");
+		reader_dbh.ReleaseReader(held_readers[0]);
+		reader_dbh.ReleaseReader(held_readers[1]);
+		if(busy_rs->GetInt64(0, 0) != 8 || reader_dbh.ReaderStats().reads != 33 || reader_dbh.ReaderStats().busy_fallbacks != 1) {
+			PrintErr("Do() with every reader busy did not run on the writer");
+			return 1;
+		}
+
+		//statements no reader has classified yet may be writes and don't count as fallbacks
+		held_readers[0] = reader_dbh.AcquireReader();
+		held_readers[1] = reader_dbh.AcquireReader();
+		reader_dbh.Do("UPDATE lookup SET value = value WHERE id = 0");
+		auto unclassified_rs = reader_dbh.Do("SELECT MAX(value) FROM lookup");
+		reader_dbh.ReleaseReader(held_readers[0]);
+		reader_dbh.ReleaseReader(held_readers[1]);
+		if(unclassified_rs->GetInt64(0, 0) != 80 || reader_dbh.ReaderStats().busy_fallbacks != 1) {
+			PrintErr("Unclassified statements were counted as reader fallbacks");
+			return 1;
+		}
+
+		//a prepare failure isn't remembered as needing the writer
+		try {
+			reader_dbh.Do("SELECT COUNT(*) FROM later_lookup");
+			PrintErr("Do() on a missing table did not fail");
+			return 1;
+		} catch(std::runtime_error&) {
+		}
+		reader_dbh.Do("CREATE TABLE later_lookup (id INTEGER PRIMARY KEY)");
+		if(reader_dbh.Do("SELECT COUNT(*) FROM later_lookup")->GetInt64(0, 0) != 0 || reader_dbh.ReaderStats().reads != 34) {
+			PrintErr("Read of a table created later was not served by a reader");
+			return 1;
+		}
+
+		try {
+			reader_dbh.Read("DELETE FROM lookup");
+			PrintErr("Read accepted a write statement");
+			return 1;
+		} catch(std::runtime_error&) {
+		}
+
+		struct ErrorObserver : public DBI::QueryObserver
+		{
+			ErrorObserver() : error_code(0) { }
+			virtual void OnQuery(const DBI::QueryEvent &event) {
+				if(!event.Ok()) {
+					error_code = event.error_code;
+				}
+			}
+			int error_code;
+		};
+
+		auto stats = std::make_shared<DBI::QueryStats>();
+		DBI::DatabaseAttributes stats_attr;
+		DBI::SQLiteDatabaseHandle stats_dbh;
+		stats_dbh.Connect(":memory:", "", "", "", stats_attr);
+		stats_dbh.SetObserver(stats);
+		stats_dbh.Do("CREATE TABLE items (id INTEGER PRIMARY KEY, name TEXT)");
+		for(int i = 1; i <= 5; ++i) {
+			stats_dbh.Do("INSERT INTO items (id, name) VALUES(?, ?)", i, "item");
+		}
+
+		auto items_sth = stats_dbh.Prepare("SELECT id, name FROM items WHERE id <= ?");
+		items_sth->Execute(3);
+		auto items_cursor = items_sth->Query(5);
+		while(items_cursor->Next()) {
+		}
+		items_cursor.reset();
+		stats_dbh.Do("SELECT  id,\n name FROM items WHERE id <= ?", 1);
+
+		auto error_observer = std::make_shared<ErrorObserver>();
+		stats_dbh.SetObserver(error_observer);
+		try {
+			stats_dbh.Do("SELECT * FROM missing_items");
+		} catch(std::runtime_error&) {
+		}
+		stats_dbh.SetObserver(nullptr);
+		stats_dbh.Do("SELECT * FROM items");
+
+		const DBI::QueryStatsEntry *insert_stats = nullptr;
+		const DBI::QueryStatsEntry *select_stats = nullptr;
+		auto entries = stats->Snapshot();
+		for(auto &entry : entries) {
+			if(entry.fingerprint == "insert into items(id, name) values(?, ?)") {
+				insert_stats = &entry;
+			}
+			else if(entry.fingerprint == "select id, name from items where id <= ?") {
+				select_stats = &entry;
+			}
+		}
+
+		if(stats->Size() != 3 || !insert_stats || !select_stats || insert_stats->calls != 5 ||
+			insert_stats->phases[DBI::QueryEvent::PhaseBind].Count() != 5 || insert_stats->rows != 5) {
+			PrintErr("Query stats missed the inserts");
+			return 1;
+		}
+
+		if(select_stats->calls != 3 || select_stats->rows != 9 || select_stats->errors != 0 ||
+			select_stats->phases[DBI::QueryEvent::PhasePrepare].Count() != 2 ||
+			select_stats->phases[DBI::QueryEvent::PhaseFetch].Count() != 1 || stats->Report().empty()) {
+			PrintErr("Query stats missed the selects");
+			return 1;
+		}
+
+		if(error_observer->error_code != 1) {
+			PrintErr("Failed query reported error code %d", error_observer->error_code);
+			return 1;
+		}
+
+		DBI::LatencyHistogram histogram;
+		for(uint64_t i = 1; i <= 1000; ++i) {
+			histogram.Record(i * 1000);
+		}
+		if(histogram.Count() != 1000 || histogram.Percentile(100.0) != 1000000 || histogram.Percentile(50.0) < 500000 ||
+			histogram.Percentile(50.0) > 515000 || histogram.Min() != 1000) {
+			PrintErr("Latency histogram percentiles are off");
+			return 1;
+		}
+
+		auto id_five = DBI::Fingerprint("SELECT * FROM items WHERE id = 5");
+		auto id_seven = DBI::Fingerprint("select *\n  from items -- by id\n where id = 7;");
+		if(id_five.text != "select * from items where id = ?" || id_five.text != id_seven.text || id_five.hash != id_seven.hash) {
+			PrintErr("Fingerprints differ by literal: %s, %s", id_five.text.c_str(), id_seven.text.c_str());
+			return 1;
+		}
+
+		auto in_list = DBI::Fingerprint("SELECT name FROM items WHERE id IN (1, 2, 3) AND name <> 'it''s' /* note */");
+		if(in_list.text != "select name from items where id in(?+) and name <> ?" ||
+			in_list.hash != DBI::Fingerprint("select name from items where id in (?) and name <> $$x$$").hash) {
+			PrintErr("IN list fingerprint is %s", in_list.text.c_str());
+			return 1;
+		}
+
+		auto result_cache = std::make_shared<DBI::ResultCache>();
+		DBI::DatabaseAttributes cache_attr;
+		DBI::SQLiteDatabaseHandle cache_dbh;
+		cache_dbh.Connect(":memory:", "", "", "", cache_attr);
+		cache_dbh.SetResultCache(result_cache);
+		cache_dbh.Do("CREATE TABLE items (id INTEGER PRIMARY KEY, name TEXT)");
+		cache_dbh.Do("CREATE TABLE logs (id INTEGER PRIMARY KEY, message TEXT)");
+		for(int i = 1; i <= 3; ++i) {
+			cache_dbh.Do("INSERT INTO items (id, name) VALUES(?, ?)", i, "item");
+		}
+
+		auto first_name = cache_dbh.DoCached("SELECT name FROM items WHERE id = ?", 1);
+		auto second_name = cache_dbh.DoCached("SELECT name FROM items WHERE id = ?", 2);
+		if(cache_dbh.DoCached("SELECT name FROM items WHERE id = ?", 1) != first_name || second_name == first_name ||
+			result_cache->Stats().hits != 1 || result_cache->Stats().size != 2) {
+			PrintErr("Result cache missed a repeated read");
+			return 1;
+		}
+
+		auto count_sth = cache_dbh.Prepare("SELECT COUNT(*) FROM items");
+		auto count = count_sth->ExecuteCached();
+		cache_dbh.Do("INSERT INTO logs (message) VALUES(?)", "unrelated");
+		if(count_sth->ExecuteCached() != count || count->GetInt32(0, 0) != 3) {
+			PrintErr("Result cache dropped a read of an unchanged table");
+			return 1;
+		}
+
+		cache_dbh.Do("UPDATE items SET name = ? WHERE id = ?", "changed", 1);
+		cache_dbh.Do("DELETE FROM items WHERE id = 3");
+		auto changed_name = cache_dbh.DoCached("SELECT name FROM items WHERE id = ?", 1);
+		auto changed_count = count_sth->ExecuteCached();
+		if(changed_name == first_name || changed_name->GetValue(0, 0) != "changed" || changed_count == count ||
+			changed_count->GetInt32(0, 0) != 2) {
+			PrintErr("Result cache kept results of a written table");
+			return 1;
+		}
+
+		result_cache->SetTTL("SELECT id FROM items", 0);
+		auto uncached = cache_dbh.DoCached("SELECT id FROM items");
+		if(cache_dbh.DoCached("SELECT id FROM items") == uncached) {
+			PrintErr("Result cache kept a statement with no TTL");
+			return 1;
+		}
+
+		auto small_cache = std::make_shared<DBI::ResultCache>(4096);
+		cache_dbh.SetResultCache(small_cache);
+		for(int i = 0; i < 64; ++i) {
+			cache_dbh.DoCached("SELECT ? AS value", i);
+		}
+		if(small_cache->Stats().evictions == 0 || small_cache->Stats().bytes > 4096 || small_cache->Stats().size == 0) {
+			PrintErr("Result cache went over its memory budget");
+			return 1;
+		}
+
+		cache_dbh.SetResultCache(nullptr);
+		std::string bound_name = "bound";
+		DBI::Param bound[] = { DBI::Param(10), DBI::Param(bound_name) };
+		cache_dbh.DoBound("INSERT INTO items (id, name) VALUES(?, ?)", DBI::ParamBlock(bound, 2));
+		const char *no_name = nullptr;
+		cache_dbh.Do("INSERT INTO items (id, name) VALUES(?, ?)", 11, no_name);
+		auto bound_sth = cache_dbh.Prepare("SELECT name FROM items WHERE id >= ? ORDER BY id");
+		auto bound_rs = bound_sth->ExecuteBound(DBI::ParamBlock(bound, 1));
+		if(bound_rs->RowCount() != 2 || bound_rs->GetValue(0, 0) != "bound" || !bound_rs->IsNull(1, 0)) {
+			PrintErr("Param block bound the wrong values");
+			return 1;
+		}
 	}
 	catch (std::exception &ex) {
 		printf("Tests failed with message: %s", ex.what());